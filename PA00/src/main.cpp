@@ -1,6 +1,7 @@
 #include <GL/glew.h> // glew must be included before the main gl libs
 #include <GL/glut.h> // doing otherwise causes compiler shouting
 #include <iostream>
+#include "framepacer.h"
 
 //--Data types
 //This object will define the attributes of a vertex(position, color, etc...)
@@ -20,15 +21,20 @@ GLuint vbo_geometry;// VBO handle for our geometry
 GLint loc_position;
 GLint loc_color;
 
+//update() runs from a timer at this rate instead of spinning in the idle callback
+FramePacer pacer(60.0, 60.0);
+
 //--GLUT Callbacks
 void render();
 void update();
+void tick(int value);
 void reshape(int n_w, int n_h);
 void keyboard(unsigned char key, int x_pos, int y_pos);
 
 //--Resource management
 bool initialize();
 void cleanUp();
+void reportPacing();
 
 int main(int argc, char **argv)
 {
@@ -52,13 +58,14 @@ int main(int argc, char **argv)
     // Set all of the callbacks to GLUT that we need
     glutDisplayFunc(render);// Called when its time to display
     glutReshapeFunc(reshape);// Called if the window is resized
-    glutIdleFunc(update);// Called if there is nothing else to do
+    glutTimerFunc(0, tick, 0);// Calls update() at the paced frame rate
     glutKeyboardFunc(keyboard);// Called if there is keyboard input
 
     // Initialize all of our resources(shaders, geometry)
     bool init = initialize();
     if(init)
     {
+        atexit(reportPacing);//ESC and Quit leave through exit()
         glutMainLoop();
     }
 
@@ -113,6 +120,15 @@ void update()
     glutPostRedisplay();//call the display callback
 }
 
+//runs a frame once the pacer says it is due, then books the next one
+void tick(int value)
+{
+    pacer.waitForFrame();
+    update();
+    pacer.frameDone(true);
+    glutTimerFunc(pacer.delayMs(), tick, 0);
+}
+
 void reshape(int n_w, int n_h)
 {
     // Change the Projection Matrix
@@ -225,6 +241,12 @@ bool initialize()
     return true;
 }
 
+//how busy the timer kept the CPU, compare against the old idle loop's 100%
+void reportPacing()
+{
+    std::cout << "Frame pacing: " << (int)(pacer.averageUtilisation() * 100.0 + 0.5) << "% of a core on average" << std::endl;
+}
+
 void cleanUp()
 {
     // Clean up, Clean up
@@ -6,6 +6,7 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp> //Makes passing matrices to shaders easier
+#include "framepacer.h"
 
 
 
@@ -38,9 +39,13 @@ glm::mat4 view;//world->eye
 glm::mat4 projection;//eye->clip
 glm::mat4 mvp;//premultiplied modelviewprojection
 
+//update() runs from a timer at this rate instead of spinning in the idle callback
+FramePacer pacer(60.0, 60.0);
+
 //--GLUT Callbacks
 void render();
 void update();
+void tick(int value);
 void reshape(int n_w, int n_h);
 void keyboard(unsigned char key, int x_pos, int y_pos);
 
@@ -50,6 +55,7 @@ char* loadShader( const char* filename );
 //--Resource management
 bool initialize();
 void cleanUp();
+void reportPacing();
 
 //--Random time things
 float getDT();
@@ -79,7 +85,7 @@ int main(int argc, char **argv)
     // Set all of the callbacks to GLUT that we need
     glutDisplayFunc(render);// Called when its time to display
     glutReshapeFunc(reshape);// Called if the window is resized
-    glutIdleFunc(update);// Called if there is nothing else to do
+    glutTimerFunc(0, tick, 0);// Calls update() at the paced frame rate
     glutKeyboardFunc(keyboard);// Called if there is keyboard input
 
     // Initialize all of our resources(shaders, geometry)
@@ -87,6 +93,7 @@ int main(int argc, char **argv)
     if(init)
     {
         t1 = std::chrono::high_resolution_clock::now();
+        atexit(reportPacing);//ESC and Quit leave through exit()
         glutMainLoop();
     }
 
@@ -158,6 +165,15 @@ void update()
     glutPostRedisplay();//call the display callback
 }
 
+//runs a frame once the pacer says it is due, then books the next one
+void tick(int value)
+{
+    pacer.waitForFrame();
+    update();
+    pacer.frameDone(true);
+    glutTimerFunc(pacer.delayMs(), tick, 0);
+}
+
 
 void reshape(int n_w, int n_h)
 {
@@ -338,6 +354,12 @@ bool initialize()
     return true;
 }
 
+//how busy the timer kept the CPU, compare against the old idle loop's 100%
+void reportPacing()
+{
+    std::cout << "Frame pacing: " << (int)(pacer.averageUtilisation() * 100.0 + 0.5) << "% of a core on average" << std::endl;
+}
+
 void cleanUp()
 {
     // Clean up, Clean up
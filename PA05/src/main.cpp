@@ -14,6 +14,7 @@
 #include "assimp/postprocess.h"
 #include "assimp/scene.h"
 #include <time.h>
+#include "framepacer.h"
 
 using namespace std;
 
@@ -47,9 +48,13 @@ glm::mat4 view;//world->eye
 glm::mat4 projection;//eye->clip
 glm::mat4 mvp;//premultiplied modelviewprojection
 
+//update() runs from a timer at this rate instead of spinning in the idle callback
+FramePacer pacer(60.0, 60.0);
+
 //--GLUT Callbacks
 void render();
 void update();
+void tick(int value);
 void reshape(int n_w, int n_h);
 void keyboard(unsigned char key, int x_pos, int y_pos);
 void arrows(int key, int x_pos, int y_pos);
@@ -65,6 +70,7 @@ float scaler = 1.;
 //--Resource management
 bool initialize();
 void cleanUp();
+void reportPacing();
 
 //--Random time things
 float getDT();
@@ -100,7 +106,7 @@ int main(int argc, char **argv)
     // Set all of the callbacks to GLUT that we need
     glutDisplayFunc(render);// Called when its time to display
     glutReshapeFunc(reshape);// Called if the window is resized
-    glutIdleFunc(update);// Called if there is nothing else to do
+    glutTimerFunc(0, tick, 0);// Calls update() at the paced frame rate
     glutKeyboardFunc(keyboard);// Called if there is keyboard input
 
     // Initialize all of our resources(shaders, geometry)
@@ -108,6 +114,7 @@ int main(int argc, char **argv)
     if(init)
     {
         t1 = std::chrono::high_resolution_clock::now();
+        atexit(reportPacing);//ESC and Quit leave through exit()
         glutMainLoop();
     }
 
@@ -177,6 +184,15 @@ void update()
     glutPostRedisplay();//call the display callback
 }
 
+//runs a frame once the pacer says it is due, then books the next one
+void tick(int value)
+{
+    pacer.waitForFrame();
+    update();
+    pacer.frameDone(true);
+    glutTimerFunc(pacer.delayMs(), tick, 0);
+}
+
 
 void reshape(int n_w, int n_h)
 {
@@ -316,6 +332,12 @@ bool initialize()
     return true;
 }
 
+//how busy the timer kept the CPU, compare against the old idle loop's 100%
+void reportPacing()
+{
+    cout << "Frame pacing: " << (int)(pacer.averageUtilisation() * 100.0 + 0.5) << "% of a core on average" << endl;
+}
+
 void cleanUp()
 {
     // Clean up, Clean up
@@ -18,6 +18,9 @@
 //Including texture stuff
 #include <IL/il.h>
 #include <map>
+#include <string>
+#include "dds.h"
+#include "framepacer.h"
 
 
 using namespace std;
@@ -60,9 +63,13 @@ glm::mat4 view;//world->eye
 glm::mat4 projection;//eye->clip
 glm::mat4 mvp;//premultiplied modelviewprojection
 
+//update() runs from a timer at this rate instead of spinning in the idle callback
+FramePacer pacer(60.0, 60.0);
+
 //--GLUT Callbacks
 void render();
 void update();
+void tick(int value);
 void reshape(int n_w, int n_h);
 void keyboard(unsigned char key, int x_pos, int y_pos);
 void arrows(int key, int x_pos, int y_pos);
@@ -71,6 +78,7 @@ void arrows(int key, int x_pos, int y_pos);
 char* loadShader( const char* filename );
 bool loadOBJ(char*, Vertex*&);
 bool loadTexture(char * );
+bool loadCookedTexture(const char*, GLuint &);
 unsigned int geometrySize;
 char* filename;
 char* textName;
@@ -80,6 +88,7 @@ float scaler = 1.;
 //--Resource management
 bool initialize();
 void cleanUp();
+void reportPacing();
 
 //--Random time things
 float getDT();
@@ -118,7 +127,7 @@ int main(int argc, char **argv)
     // Set all of the callbacks to GLUT that we need
     glutDisplayFunc(render);// Called when its time to display
     glutReshapeFunc(reshape);// Called if the window is resized
-    glutIdleFunc(update);// Called if there is nothing else to do
+    glutTimerFunc(0, tick, 0);// Calls update() at the paced frame rate
     glutKeyboardFunc(keyboard);// Called if there is keyboard input
 
     // Initialize all of our resources(shaders, geometry)
@@ -126,6 +135,7 @@ int main(int argc, char **argv)
     if(init)
     {
         t1 = std::chrono::high_resolution_clock::now();
+        atexit(reportPacing);//ESC and Quit leave through exit()
         glutMainLoop();
     }
 
@@ -198,6 +208,15 @@ void update()
     glutPostRedisplay();//call the display callback
 }
 
+//runs a frame once the pacer says it is due, then books the next one
+void tick(int value)
+{
+    pacer.waitForFrame();
+    update();
+    pacer.frameDone(true);
+    glutTimerFunc(pacer.delayMs(), tick, 0);
+}
+
 
 void reshape(int n_w, int n_h)
 {
@@ -352,6 +371,12 @@ bool initialize()
     return true;
 }
 
+//how busy the timer kept the CPU, compare against the old idle loop's 100%
+void reportPacing()
+{
+    cout << "Frame pacing: " << (int)(pacer.averageUtilisation() * 100.0 + 0.5) << "% of a core on average" << endl;
+}
+
 void cleanUp()
 {
     // Clean up, Clean up
@@ -465,6 +490,11 @@ bool loadTexture(char * name)
     ILuint texture;
     bool test;
 
+    //the cooked mip chain from texcook when there is one
+    textureId = new GLuint;
+    if(loadCookedTexture(name, *textureId))
+        return true;
+
     ilInit();
     ilGenImages(1, &texture);
     ilBindImage(texture);
@@ -479,7 +509,6 @@ bool loadTexture(char * name)
             cout << "Error: There was a problem with the conversion" << endl;
         }
             /* Create and load textures to OpenGL */
-        textureId = new GLuint;
         glGenTextures(1, textureId);
         glBindTexture(GL_TEXTURE_2D, *textureId); 
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -491,4 +520,29 @@ bool loadTexture(char * name)
 
     ilDeleteImages(1, textureId);
     return true;
-}
\ No newline at end of file
+}
+
+//loads the mip chain texcook left next to an image, false if there isn't one
+//or it is out of date
+bool loadCookedTexture(const char* filePath, GLuint &texture) {
+    DDSImage dds;
+    if(!GLEW_EXT_texture_compression_s3tc || !readCookedDDS(filePath, dds))
+        return false;
+
+    GLenum format = dds.fourCC == DDS_FOURCC_DXT1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+                                                  : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, dds.levels - 1);
+    size_t offset = 0;
+    for(unsigned int i = 0; i < dds.levels; i++) {
+        unsigned int width = ddsLevelDimension(dds.width, i);
+        unsigned int height = ddsLevelDimension(dds.height, i);
+        size_t size = ddsLevelSize(width, height, dds.fourCC);
+        glCompressedTexImage2D(GL_TEXTURE_2D, i, format, width, height, 0, size, &dds.data[offset]);
+        offset += size;
+    }
+    return true;
+}
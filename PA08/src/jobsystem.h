@@ -0,0 +1,293 @@
+#ifndef JOBSYSTEM_H
+#define JOBSYSTEM_H
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+#include "bullet/LinearMath/btThreads.h"
+
+//A pool of worker threads for data-parallel loops. The thread that calls
+//parallelFor() works too, as worker 0. A loop starts as one job on the
+//caller's deque. Whoever runs a job bigger than the grain splits it in half,
+//keeps the lower half and pushes the upper half onto its own deque. Idle
+//workers steal from the other end of someone else's deque, which is where the
+//biggest pieces are. Workers spin briefly between loops, since a physics step
+//runs several back to back, then sleep until the next one.
+class JobSystem
+{
+public:
+    //body(begin, end, worker) runs iterations [begin, end) on the given worker
+    typedef std::function<void(int, int, unsigned int)> Body;
+
+    //threads counts the caller, so 1 means no workers at all
+    explicit JobSystem(unsigned int threads) : deques(threads > 0 ? threads : 1)
+    {
+        numThreads = deques.size();
+        activeThreads = numThreads;
+        generation = 0;
+        pending = 0;
+        stopping = false;
+        sleepy = false;
+        busy = false;
+        loops = 0;
+        steals = 0;
+        for(unsigned int i = 1; i < numThreads; i++)
+            pool.push_back(std::thread(&JobSystem::worker, this, i));
+    }
+
+    ~JobSystem()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepLock);
+            stopping = true;
+        }
+        wakeUp.notify_all();
+        for(unsigned int i = 0; i < pool.size(); i++)
+            pool[i].join();
+    }
+
+    unsigned int maxThreads() const
+    {
+        return numThreads;
+    }
+
+    unsigned int threads() const
+    {
+        return activeThreads;
+    }
+
+    //workers past the count sit out later loops, for measuring scaling
+    void setThreads(unsigned int threads)
+    {
+        activeThreads = threads < 1 ? 1 : (threads > numThreads ? numThreads : threads);
+    }
+
+    //blocks until every iteration has run, nested calls run inline
+    void parallelFor(int begin, int end, int grain, const Body &body)
+    {
+        if(end <= begin)
+            return;
+        if(grain < 1)
+            grain = 1;
+        bool expected = false;
+        if(activeThreads == 1 || end - begin <= grain || !busy.compare_exchange_strong(expected, true)) {
+            body(begin, end, 0);
+            return;
+        }
+        loops++;
+
+        Job job = {begin, end, grain, &body};
+        pending.store(end - begin);
+        {
+            std::lock_guard<std::mutex> lock(deques[0].lock);
+            deques[0].jobs.push_back(job);
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleepLock);
+            generation++;
+            sleepy = false;
+        }
+        wakeUp.notify_all();
+
+        while(pending.load(std::memory_order_acquire) > 0) {
+            if(!runOne(0))
+                std::this_thread::yield();
+        }
+        busy = false;
+    }
+
+    //skip the spin after the next loop, for when nothing else is coming soon
+    void sleepHint()
+    {
+        sleepy = true;
+    }
+
+    //loops that went wide, and jobs taken from another worker's deque
+    unsigned long parallelLoops() const
+    {
+        return loops;
+    }
+
+    unsigned long stolenJobs() const
+    {
+        return steals;
+    }
+
+private:
+    struct Job
+    {
+        int begin, end, grain;
+        const Body* body;
+    };
+
+    struct Deque
+    {
+        std::mutex lock;
+        std::deque<Job> jobs;
+    };
+
+    //pops our own newest job, or steals someone's oldest, false if there was none
+    bool runOne(unsigned int self)
+    {
+        Job job;
+        if(!take(self, true, job)) {
+            bool found = false;
+            for(unsigned int i = 1; i < activeThreads && !found; i++)
+                found = take((self + i) % activeThreads, false, job);
+            if(!found)
+                return false;
+            steals++;
+        }
+
+        //halve until the job is a grain, leaving the halves for whoever wants them
+        while(job.end - job.begin > job.grain) {
+            Job upper = job;
+            upper.begin = job.begin + (job.end - job.begin) / 2;
+            job.end = upper.begin;
+            std::lock_guard<std::mutex> lock(deques[self].lock);
+            deques[self].jobs.push_back(upper);
+        }
+        (*job.body)(job.begin, job.end, self);
+        pending.fetch_sub(job.end - job.begin, std::memory_order_release);
+        return true;
+    }
+
+    bool take(unsigned int from, bool newest, Job &job)
+    {
+        std::lock_guard<std::mutex> lock(deques[from].lock);
+        if(deques[from].jobs.empty())
+            return false;
+        if(newest) {
+            job = deques[from].jobs.back();
+            deques[from].jobs.pop_back();
+        }
+        else {
+            job = deques[from].jobs.front();
+            deques[from].jobs.pop_front();
+        }
+        return true;
+    }
+
+    void worker(unsigned int self)
+    {
+        unsigned int seen = 0;
+        while(true) {
+            //spin a little first, the next loop of a step usually follows at once
+            std::chrono::time_point<std::chrono::high_resolution_clock> spinUntil;
+            spinUntil = std::chrono::high_resolution_clock::now() + std::chrono::microseconds(SPIN_MICROSECONDS);
+            while(generation.load() == seen && !sleepy && std::chrono::high_resolution_clock::now() < spinUntil)
+                std::this_thread::yield();
+            {
+                std::unique_lock<std::mutex> lock(sleepLock);
+                while(generation.load() == seen && !stopping)
+                    wakeUp.wait(lock);
+                if(stopping)
+                    return;
+                seen = generation.load();
+            }
+
+            if(self >= activeThreads)
+                continue;
+            while(pending.load(std::memory_order_acquire) > 0) {
+                if(!runOne(self))
+                    std::this_thread::yield();
+            }
+        }
+    }
+
+    static const int SPIN_MICROSECONDS = 200;
+
+    std::vector<Deque> deques;//one per thread, the caller's first
+    unsigned int numThreads;
+    std::atomic<unsigned int> activeThreads;
+    std::vector<std::thread> pool;
+    std::atomic<unsigned int> generation;//bumped once per loop
+    std::atomic<int> pending;//iterations of the current loop not yet run
+    std::atomic<bool> busy;//a loop is running
+    std::atomic<bool> sleepy;
+    bool stopping;
+    std::mutex sleepLock;
+    std::condition_variable wakeUp;
+    std::atomic<unsigned long> loops;
+    std::atomic<unsigned long> steals;
+};
+
+//How many threads a JobSystem for Bullet can use. Bullet sizes its per-thread
+//arrays for BT_MAX_THREAD_COUNT threads, the one calling parallelFor() included
+inline int bulletThreadLimit(int requested)
+{
+    if(requested < 1)
+        return 1;
+    return requested < (int)BT_MAX_THREAD_COUNT ? requested : (int)BT_MAX_THREAD_COUNT;
+}
+
+//Hands Bullet's parallel loops to a JobSystem, install it with btSetTaskScheduler()
+//before making a btDiscreteDynamicsWorldMt. Bullet has to be built with
+//BT_THREADSAFE for its loops to reach here at all.
+class JobScheduler : public btITaskScheduler
+{
+public:
+    explicit JobScheduler(JobSystem &system) : btITaskScheduler("JobSystem"), jobs(system)
+    {
+        partialSums.resize(jobs.maxThreads());
+    }
+
+    virtual int getMaxNumThreads() const
+    {
+        return jobs.maxThreads() < BT_MAX_THREAD_COUNT ? jobs.maxThreads() : BT_MAX_THREAD_COUNT;
+    }
+
+    virtual int getNumThreads() const
+    {
+        return jobs.threads();
+    }
+
+    virtual void setNumThreads(int threads)
+    {
+        jobs.setThreads(threads < getMaxNumThreads() ? threads : getMaxNumThreads());
+    }
+
+    virtual void parallelFor(int begin, int end, int grain, const btIParallelForBody &body)
+    {
+        jobs.parallelFor(begin, end, grain, [&body](int b, int e, unsigned int) { body.forLoop(b, e); });
+    }
+
+    //each worker adds into its own slot, the slots are summed at the end
+    virtual btScalar parallelSum(int begin, int end, int grain, const btIParallelSumBody &body)
+    {
+        for(unsigned int i = 0; i < partialSums.size(); i++)
+            partialSums[i].sum = 0.0;
+        std::vector<PartialSum> &sums = partialSums;
+        jobs.parallelFor(begin, end, grain, [&body, &sums](int b, int e, unsigned int worker) {
+            sums[worker].sum += body.sumLoop(b, e);
+        });
+        btScalar total = 0.0;
+        for(unsigned int i = 0; i < partialSums.size(); i++)
+            total += partialSums[i].sum;
+        return total;
+    }
+
+    virtual void sleepWorkerThreadsHint()
+    {
+        jobs.sleepHint();
+    }
+
+private:
+    //a cache line each so workers don't fight over them
+    struct PartialSum
+    {
+        btScalar sum;
+        char padding[64 - sizeof(btScalar)];
+    };
+
+    JobSystem &jobs;
+    std::vector<PartialSum> partialSums;
+};
+
+#endif
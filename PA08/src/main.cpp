@@ -6,6 +6,8 @@
 #include <vector>
 #include <ctime>
 #include <cstdlib>
+#include <cmath>
+#include <cstring>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -18,6 +20,12 @@
 
 #include "bullet/btBulletCollisionCommon.h"
 #include "bullet/btBulletDynamicsCommon.h"
+#include "bullet/BulletCollision/CollisionDispatch/btCollisionDispatcherMt.h"
+#include "bullet/BulletDynamics/Dynamics/btDiscreteDynamicsWorldMt.h"
+#include "bullet/BulletDynamics/ConstraintSolver/btSequentialImpulseConstraintSolverMt.h"
+
+#include "jobsystem.h"
+#include "framepacer.h"
 
 
 using namespace std;
@@ -36,7 +44,10 @@ struct Mesh
     Vertex* geometry;
     unsigned int numFaces;
     unsigned int numVertices;
+    GLuint* indices;//3 per face, into geometry
+    unsigned int numIndices;
     GLuint vbo_geometry;
+    GLuint ibo_geometry;
 };
 
 struct Object
@@ -45,6 +56,7 @@ struct Object
     glm::mat4 modelMatrix;
     unsigned int numMeshes;
     btRigidBody *rigidBody;
+    btTransform prevTransform;//body transform before the last physics step, for interpolation
 };
 
 // GLOBAL GAME OBJECTS
@@ -74,13 +86,31 @@ glm::mat4 mvp;//premultiplied modelviewprojection
 btBroadphaseInterface* broadphase;
 btDefaultCollisionConfiguration* collisionConfiguration;
 btCollisionDispatcher* dispatcher;
-btSequentialImpulseConstraintSolver* solver;
+btConstraintSolver* solver;
+btConstraintSolver* solverMt = NULL;//the solver the pool's islands use, multi-threaded worlds only
 btDiscreteDynamicsWorld* dynamicsWorld;
 
+//1 steps the plain world, more builds btDiscreteDynamicsWorldMt on a job system
+int physicsThreads = 1;
+JobSystem* physicsJobs = NULL;
+JobScheduler* physicsScheduler = NULL;
+
+//Fixed timestep physics, frames run as many steps as fit in the budget
+const float PHYSICS_STEP = 1.0 / 120.0;//simulated seconds per step
+const float PHYSICS_BUDGET = 0.008;//CPU seconds a frame may spend stepping
+const float MAX_FRAME_DT = 0.25;//longer frames are not caught up on
+float physicsAccumulator = 0.0;//simulated time still owed to the world
+float physicsAlpha = 0.0;//how far past the last step we are rendering, 0 to 1
+int droppedSteps = 0;//steps skipped because the budget ran out
+
+
+//update() runs from a timer at this rate instead of spinning in the idle callback
+FramePacer pacer(60.0, 60.0);
 
 //--GLUT Callbacks
 void render();
 void update();
+void tick(int value);
 void reshape(int n_w, int n_h);
 void keyboard(unsigned char key, int x_pos, int y_pos);
 void arrowkey(int key, int x_pos, int y_pos);
@@ -91,10 +121,12 @@ bool loadOBJ(const char*, Object &);
 void renderOBJ(Object &obj);
 void initPhysics();
 void update(Object &obj);
+void savePhysicsState(Object &obj);
 
 //--Resource management
 bool initialize();
 void cleanUp();
+void reportPacing();
 
 //--Random time things
 float getDT();
@@ -109,6 +141,21 @@ int main(int argc, char **argv)
     //   return 0;
     // }
     // OBJPath = argv[argc-1];
+
+    // --physics-threads N steps the world on N threads
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--physics-threads") == 0 && i+1 < argc)
+            physicsThreads = atoi(argv[++i]);
+    }
+    if(physicsThreads > 1) {
+        //before anything touches bullet, this thread has to be its main one
+        physicsThreads = bulletThreadLimit(physicsThreads);
+        physicsJobs = new JobSystem(physicsThreads);
+        physicsScheduler = new JobScheduler(*physicsJobs);
+        btSetTaskScheduler(physicsScheduler);
+        cout << "Physics: multi-threaded world on " << physicsScheduler->getNumThreads() << " threads" << endl;
+    }
+
     // Initialize glut
     glutInit(&argc, argv);
     glutInitDisplayMode(GLUT_DOUBLE | GLUT_DEPTH);
@@ -129,7 +176,7 @@ int main(int argc, char **argv)
     // Set all of the callbacks to GLUT that we need
     glutDisplayFunc(render);// Called when its time to display
     glutReshapeFunc(reshape);// Called if the window is resized
-    glutIdleFunc(update);// Called if there is nothing else to do
+    glutTimerFunc(0, tick, 0);// Calls update() at the paced frame rate
     glutKeyboardFunc(keyboard);// Called if there is keyboard input
     glutSpecialFunc(arrowkey);// Called if there is arrowkey input
 
@@ -138,6 +185,7 @@ int main(int argc, char **argv)
     if(init)
     {
         t1 = std::chrono::high_resolution_clock::now();
+        atexit(reportPacing);//ESC and Quit leave through exit()
         glutMainLoop();
     }
 
@@ -183,7 +231,29 @@ void update()
     //total time
     //static float rotate = 0.;
     float dt = getDT();// if you have anything moving, use dt.
-    dynamicsWorld->stepSimulation(dt,10);
+
+    //step at a fixed rate, a slow frame can't make the next one slower
+    if(dt > MAX_FRAME_DT)
+        dt = MAX_FRAME_DT;
+    physicsAccumulator += dt;
+    std::chrono::time_point<std::chrono::high_resolution_clock> stepStart, stepNow;
+    stepStart = std::chrono::high_resolution_clock::now();
+    while(physicsAccumulator >= PHYSICS_STEP) {
+        savePhysicsState(sphere);
+        savePhysicsState(cylinder);
+        savePhysicsState(cube);
+        dynamicsWorld->stepSimulation(PHYSICS_STEP, 0);
+        physicsAccumulator -= PHYSICS_STEP;
+
+        //out of budget, drop the backlog instead of spiraling
+        stepNow = std::chrono::high_resolution_clock::now();
+        if(std::chrono::duration_cast< std::chrono::duration<float> >(stepNow-stepStart).count() > PHYSICS_BUDGET) {
+            droppedSteps += (int)(physicsAccumulator / PHYSICS_STEP);
+            physicsAccumulator = fmod(physicsAccumulator, PHYSICS_STEP);
+            break;
+        }
+    }
+    physicsAlpha = physicsAccumulator / PHYSICS_STEP;
 
     //update each model separately
     update(sphere);
@@ -193,10 +263,26 @@ void update()
     glutPostRedisplay();//call the display callback
 }
 
+//runs a frame once the pacer says it is due, then books the next one
+void tick(int value)
+{
+    pacer.waitForFrame();
+    update();
+    pacer.frameDone(true);
+    glutTimerFunc(pacer.delayMs(), tick, 0);
+}
+
+void savePhysicsState(Object &obj) {
+    obj.prevTransform = obj.rigidBody->getCenterOfMassTransform();
+}
+
 void update(Object &obj) {
+    //blend between the last two physics steps so motion is smooth at any frame rate
     btTransform trans;
+    btTransform current = obj.rigidBody->getCenterOfMassTransform();
     btScalar buffer[16];
-    trans = obj.rigidBody -> getCenterOfMassTransform();
+    trans.setOrigin(obj.prevTransform.getOrigin().lerp(current.getOrigin(), physicsAlpha));
+    trans.setRotation(obj.prevTransform.getRotation().slerp(current.getRotation(), physicsAlpha));
     trans.getOpenGLMatrix(buffer);
     glm::mat4 modelPosition = glm::make_mat4(buffer);
     obj.modelMatrix = modelPosition;
@@ -399,10 +485,19 @@ bool initialize()
     return true;
 }
 
+//how busy the timer kept the CPU, compare against the old idle loop's 100%
+void reportPacing()
+{
+    cout << "Frame pacing: " << (int)(pacer.averageUtilisation() * 100.0 + 0.5) << "% of a core on average" << endl;
+}
+
 void cleanUp()
 {
     // Clean up, Clean up
     glDeleteProgram(program);
+
+    if(droppedSteps > 0)
+        cout << "Physics: dropped " << droppedSteps << " steps to stay within the frame budget" << endl;
 }
 
 //returns the time delta
@@ -438,7 +533,9 @@ bool loadOBJ(const char * filePath, Object &obj){
     //read file
     srand(time(NULL));
     Assimp::Importer importer;
-    const aiScene *scene = importer.ReadFile(filePath, aiProcess_Triangulate);
+    const aiScene *scene = importer.ReadFile(filePath, aiProcess_Triangulate |
+                                                 aiProcess_JoinIdenticalVertices | //share vertices between faces
+                                                 aiProcess_ImproveCacheLocality); //reorder faces for the post-transform cache
     //return false if there is a scene error
     if(scene == NULL){
         cout << "Error: Error in reading object file!" << endl;
@@ -449,39 +546,54 @@ bool loadOBJ(const char * filePath, Object &obj){
     obj.numMeshes = scene->mNumMeshes;
     obj.mesh = new Mesh[obj.numMeshes];
 
+    unsigned int oldVertices = 0;
+    unsigned int newVertices = 0;
+    unsigned int newIndices = 0;
+
     for( unsigned int i=0; i<scene->mNumMeshes; i++ ) {
         aiMesh *tmpMesh = scene->mMeshes[i]; //aiMesh temporary to give to struct
-        tmpMesh = scene->mMeshes[i];
-        obj.mesh[i].geometry = new Vertex[tmpMesh->mNumVertices]; //3 vertex for each face
+        obj.mesh[i].geometry = new Vertex[tmpMesh->mNumVertices]; //one per unique vertex
         obj.mesh[i].numVertices = tmpMesh->mNumVertices;
         obj.mesh[i].numFaces = tmpMesh->mNumFaces;
-        // cout << "||||| Mesh: " << i << "| Vertices: " << obj.mesh[i].numVertices << 
-        //     " | Faces: " << obj.mesh[i].numFaces << endl;
+        obj.mesh[i].numIndices = tmpMesh->mNumFaces * 3;
+        obj.mesh[i].indices = new GLuint[obj.mesh[i].numIndices];
+
+        for( unsigned int j=0; j<tmpMesh->mNumVertices; j++ ) {
+            obj.mesh[i].geometry[j].position[0] = tmpMesh->mVertices[j].x;
+            obj.mesh[i].geometry[j].position[1] = tmpMesh->mVertices[j].y;
+            obj.mesh[i].geometry[j].position[2] = tmpMesh->mVertices[j].z;
+
+            obj.mesh[i].geometry[j].color[0] = GLfloat((float)rand()/(float)RAND_MAX);
+            obj.mesh[i].geometry[j].color[1] = GLfloat((float)rand()/(float)RAND_MAX);
+            obj.mesh[i].geometry[j].color[2] = GLfloat((float)rand()/(float)RAND_MAX);
+        }
 
+        //faces stay in the order assimp optimized them for
         for( unsigned int j=0; j<tmpMesh->mNumFaces; j++ ) {
             aiFace &tmpFace = tmpMesh->mFaces[j];
             for( unsigned int k=0; k<3; k++ ) {
-                unsigned int tmpVertex = tmpFace.mIndices[k];
-                obj.mesh[i].geometry[3*j+k].position[0] = tmpMesh->mVertices[tmpVertex].x;
-                obj.mesh[i].geometry[3*j+k].position[1] = tmpMesh->mVertices[tmpVertex].y;
-                obj.mesh[i].geometry[3*j+k].position[2] = tmpMesh->mVertices[tmpVertex].z;
-
-                obj.mesh[i].geometry[3*j+k].color[0] = GLfloat((float)rand()/(float)RAND_MAX);
-                obj.mesh[i].geometry[3*j+k].color[1] = GLfloat((float)rand()/(float)RAND_MAX);
-                obj.mesh[i].geometry[3*j+k].color[2] = GLfloat((float)rand()/(float)RAND_MAX);
+                obj.mesh[i].indices[3*j+k] = tmpFace.mIndices[k];
             }
-            // cout << "Vertex: " << j << " | (" <<
-            //     obj.mesh[i].geometry[j].position[0] << ", " <<
-            //     obj.mesh[i].geometry[j].position[0] << ", " <<
-            //     obj.mesh[i].geometry[j].position[0] << ")" << endl;
         }
+
+        oldVertices += obj.mesh[i].numFaces * 3;
+        newVertices += obj.mesh[i].numVertices;
+        newIndices += obj.mesh[i].numIndices;
     }
 
+    cout << filePath << ": " << oldVertices << " vertices (" << oldVertices * sizeof(Vertex) << " bytes) -> "
+         << newVertices << " vertices + " << newIndices << " indices ("
+         << newVertices * sizeof(Vertex) + newIndices * sizeof(GLuint) << " bytes)" << endl;
+
     //Create Vertex Array Object for each mesh
     for(unsigned int i=0; i<scene->mNumMeshes; i++ ) {
         glGenBuffers(1, &(obj.mesh[i].vbo_geometry));
         glBindBuffer(GL_ARRAY_BUFFER, obj.mesh[i].vbo_geometry);
-        glBufferData(GL_ARRAY_BUFFER, obj.mesh[i].numFaces * 3 * sizeof(Vertex), &(obj.mesh[i].geometry[0]), GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, obj.mesh[i].numVertices * sizeof(Vertex), &(obj.mesh[i].geometry[0]), GL_STATIC_DRAW);
+
+        glGenBuffers(1, &(obj.mesh[i].ibo_geometry));
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj.mesh[i].ibo_geometry);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, obj.mesh[i].numIndices * sizeof(GLuint), &(obj.mesh[i].indices[0]), GL_STATIC_DRAW);
     }
 
     return true;
@@ -521,7 +633,8 @@ void renderOBJ(Object &obj) {
         // GLuint num = m.meshes[i].faces[j].texIndex;
         // glActiveTexture(GL_TEXTURE0);
         // glBindTexture(GL_TEXTURE_2D, num);
-        glDrawArrays(GL_TRIANGLES, 0, obj.mesh[i].numFaces * 3);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj.mesh[i].ibo_geometry);
+        glDrawElements(GL_TRIANGLES, obj.mesh[i].numIndices, GL_UNSIGNED_INT, 0);
     }
 }
 
@@ -530,16 +643,25 @@ void initPhysics() {
     collisionConfiguration = new btDefaultCollisionConfiguration();
     //m_collisionConfiguration->setConvexConvexMultipointIterations();
 
-    ///use the default collision dispatcher. For parallel processing you can use a diffent dispatcher (see Extras/BulletMultiThreaded)
-    dispatcher = new  btCollisionDispatcher(collisionConfiguration);
-
     broadphase = new btDbvtBroadphase();
 
-    ///the default constraint solver. For parallel processing you can use a different solver (see Extras/BulletMultiThreaded)
-    btSequentialImpulseConstraintSolver* sol = new btSequentialImpulseConstraintSolver;
-    solver = sol;
+    if(physicsScheduler != NULL) {
+        ///narrowphase, island solving and integration all go through the job system
+        dispatcher = new btCollisionDispatcherMt(collisionConfiguration);
+        btConstraintSolverPoolMt* pool = new btConstraintSolverPoolMt(physicsScheduler->getMaxNumThreads());
+        solver = pool;
+        solverMt = new btSequentialImpulseConstraintSolverMt;
+        dynamicsWorld = new btDiscreteDynamicsWorldMt(dispatcher,broadphase,pool,solverMt,collisionConfiguration);
+    }
+    else {
+        ///use the default collision dispatcher
+        dispatcher = new  btCollisionDispatcher(collisionConfiguration);
+
+        ///the default constraint solver
+        solver = new btSequentialImpulseConstraintSolver;
 
-    dynamicsWorld = new btDiscreteDynamicsWorld(dispatcher,broadphase,solver,collisionConfiguration);
+        dynamicsWorld = new btDiscreteDynamicsWorld(dispatcher,broadphase,solver,collisionConfiguration);
+    }
 
     dynamicsWorld->setGravity(btVector3(0,-10,0));
     dynamicsWorld->setForceUpdateAllAabbs(false);
@@ -603,4 +725,8 @@ void initPhysics() {
     cylinder.rigidBody->setActivationState(DISABLE_DEACTIVATION);
     dynamicsWorld->addRigidBody( cylinder.rigidBody );
 
+    //nothing to interpolate from until the first step
+    savePhysicsState(sphere);
+    savePhysicsState(cylinder);
+    savePhysicsState(cube);
 }
\ No newline at end of file
@@ -7,6 +7,9 @@
 #include <vector>
 #include <ctime>
 #include <cstdlib>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -18,9 +21,15 @@
 #include "assimp/scene.h"
 
 #include "IL/il.h"
+#include <string>
+#include "dds.h"
+#include "frustum.h"
+#include "simplify.h"
+#include "text.h"
 
 #include "bullet/btBulletCollisionCommon.h"
 #include "bullet/btBulletDynamicsCommon.h"
+#include "framepacer.h"
 
 using namespace std;
 
@@ -36,13 +45,26 @@ struct Vertex
     GLfloat uv[2];
 };
 
+//levels of detail a mesh can have, counting itself
+const unsigned int MAX_LODS = 4;
+
 struct Mesh
 {
     Vertex* geometry;
     unsigned int numFaces;
     unsigned int numVertices;
+    GLuint* indices;//3 per face, into geometry
+    unsigned int numIndices;
     GLuint vbo_geometry;
+    GLuint ibo_geometry;
     GLuint texture;
+    GLfloat boundsMin[3];//model-space box around the vertices
+    GLfloat boundsMax[3];
+    unsigned int numLods;//1 is just the mesh itself
+    GLuint lodFirst[MAX_LODS];//where each level starts in the ibo, in indices
+    GLsizei lodCount[MAX_LODS];
+    GLuint* lodIndices;//the coarser levels, after indices in the ibo
+    unsigned int numLodIndices;
 };
 
 struct Object
@@ -51,7 +73,11 @@ struct Object
     glm::mat4 modelMatrix;
     unsigned int numMeshes;
     btRigidBody *rigidBody;
+    btTransform prevTransform;//body transform before the last physics step, for interpolation
     GLuint texture;
+    btDbvtNode* cullNode;//world-space box in cullTree
+    bool visible;//survived the last cullScene()
+    unsigned int lod;//level drawn last frame
 };
 
 
@@ -73,6 +99,7 @@ Object table, paddleComputer, paddlePlayer, puck;
 //Just for this example!
 int windowWidth = 1366, windowHeight = 768;// Window size
 GLuint program;// The GLSL program handle
+TextRenderer hudText;// scoreboard glyphs
 const char* VERTEX_SHADER = "../bin/assets/shader.vert";
 const char* FRAGMENT_SHADER = "../bin/assets/shader.frag";
 
@@ -99,10 +126,34 @@ btCollisionDispatcher* dispatcher;
 btSequentialImpulseConstraintSolver* solver;
 btDiscreteDynamicsWorld* dynamicsWorld;
 
+//Fixed timestep physics, frames run as many steps as fit in the budget
+const float PHYSICS_STEP = 1.0 / 120.0;//simulated seconds per step
+const float PHYSICS_BUDGET = 0.008;//CPU seconds a frame may spend stepping
+const float MAX_FRAME_DT = 0.25;//longer frames are not caught up on
+float physicsAccumulator = 0.0;//simulated time still owed to the world
+float physicsAlpha = 0.0;//how far past the last step we are rendering, 0 to 1
+int droppedSteps = 0;//steps skipped because the budget ran out
+
+//Frustum culling, every object keeps its world-space box in a dynamic BVH
+btDbvt cullTree;
+const float CULL_MARGIN = 0.05;//leaves are this much bigger than their object, plus a step of its motion
+Frustum viewFrustum;//from the current projection * view
+
+//Levels of detail, picked from how many pixels tall an object's bounding sphere is
+bool lodEnabled = true;
+const float LOD_PIXELS[MAX_LODS] = {160.0, 80.0, 40.0, 0.0};//smallest size each level is drawn at
+const float LOD_HYSTERESIS = 0.2;//how far past a boundary a size has to go before the level changes
+const unsigned int LOD_MIN_FACES = 16;//no level gets smaller than this
+int trianglesDrawn = 0;//the last frame
+
+
+//update() runs from a timer at this rate instead of spinning in the idle callback
+FramePacer pacer(60.0, 60.0);
 
 //--GLUT Callbacks
 void render();
 void update();
+void tick(int value);
 void reshape(int n_w, int n_h);
 void mouseClick(int button, int state, int x, int y);
 void mousePassive(int x, int y);
@@ -117,9 +168,17 @@ void restart_game();
 //--Function Prototypes
 char* loadShader(const char*);
 bool loadOBJ(const char*, const char*, Object &);
+bool loadCookedTexture(const char*, GLuint &);
 void renderOBJ(Object &obj);
+void cullScene();
+void cullNode(const btDbvtNode* node, bool inside);
+void objectBounds(const Object &obj, btDbvtVolume &volume);
+void buildLods(Mesh &mesh);
+float projectedPixels(const glm::vec4 &eye, float radius);
+unsigned int pickLod(float pixels, unsigned int current);
 void initPhysics();
 void update(Object &obj);
+void savePhysicsState(Object &obj);
 void aiUpdate(Object &obj, float dtime);
 void easyAI(Object &obj, float dtime);
 void midAI(Object &obj);
@@ -130,6 +189,7 @@ void printText(float x, float y, char* text);
 bool initialize();
 void manageMenu();
 void cleanUp();
+void reportPacing();
 bool gameStart = false;
 
 //--Random time things
@@ -165,7 +225,7 @@ int main(int argc, char **argv)
     // Set all of the callbacks to GLUT that we need
     glutDisplayFunc(render);// Called when its time to display
     glutReshapeFunc(reshape);// Called if the window is resized
-    glutIdleFunc(update);// Called if there is nothing else to do
+    glutTimerFunc(0, tick, 0);// Calls update() at the paced frame rate
     glutKeyboardFunc(keyboard);// Called if there is keyboard input
     glutSpecialFunc(arrowkey);// Called if there is arrowkey input
     glutMouseFunc(mouseClick);// Called if there is mouse input
@@ -179,6 +239,7 @@ int main(int argc, char **argv)
     glutAddMenuEntry("Camera: Angled Side View", 5);
     glutAddMenuEntry("Turn AI On/Off",6);
     glutAddMenuEntry("Restart Game",7);
+    glutAddMenuEntry("Toggle Level of Detail", 9);
     glutAddMenuEntry("Quit", 8);
     glutAttachMenu(GLUT_RIGHT_BUTTON);        
 
@@ -187,6 +248,7 @@ int main(int argc, char **argv)
     if(init)
     {
         t1 = std::chrono::high_resolution_clock::now();
+        atexit(reportPacing);//ESC and Quit leave through exit()
         glutMainLoop();
     }
 
@@ -200,6 +262,7 @@ void render() {
     //clear the screen
     glClearColor(0.0, 0.0, 0.2, 1.0);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    trianglesDrawn = 0;
     if(startGame == true){
         //enable the shader program
         glUseProgram(program);
@@ -209,6 +272,9 @@ void render() {
         glEnableVertexAttribArray(loc_position);
         glEnableVertexAttribArray(loc_uv);
 
+        //anything outside the view is skipped by renderOBJ
+        cullScene();
+
         // render table
         renderOBJ(table);
         // render cube
@@ -226,11 +292,23 @@ void render() {
     char buff[10];
     sprintf(buff, "P1:%d P2:%d\n" ,scorePlayer1, scorePlayer2);
     printText(-0.95f, 0.9f, buff);        
+    char triangles[64];
+    sprintf(triangles, "Triangles: %d (LOD %s)", trianglesDrawn, lodEnabled ? "on" : "off");
+    printText(-0.95f, 0.82f, triangles);
     //swap the buffers
     glutSwapBuffers();
 }
 
 void renderOBJ(Object &obj) {
+    if(!obj.visible)
+        return;
+
+    //how big it looks picks the level, every mesh of it uses the same one
+    btVector3 center = obj.cullNode->volume.Center();
+    glm::vec4 eye = view * glm::vec4(center.x(), center.y(), center.z(), 1.0);
+    float radius = obj.cullNode->volume.Extents().length();
+    obj.lod = lodEnabled ? pickLod(projectedPixels(eye, radius), obj.lod) : 0;
+
     // //send to shader
 
     for(unsigned int i=0; i<obj.numMeshes; i++) {
@@ -256,16 +334,63 @@ void renderOBJ(Object &obj) {
                                (void*)offsetof(Vertex,uv));
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, obj.texture);
-        glDrawArrays(GL_TRIANGLES, 0, obj.mesh[i].numFaces * 3);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj.mesh[i].ibo_geometry);
+        unsigned int level = std::min(obj.lod, obj.mesh[i].numLods - 1);
+        glDrawElements(GL_TRIANGLES, obj.mesh[i].lodCount[level], GL_UNSIGNED_INT,
+                       (void*)(obj.mesh[i].lodFirst[level] * sizeof(GLuint)));
+        trianglesDrawn += obj.mesh[i].lodCount[level] / 3;
     }
 }
 
+//how many pixels tall a sphere at eye would be on screen
+float projectedPixels(const glm::vec4 &eye, float radius) {
+    if(-eye.z <= radius)
+        return FLT_MAX;//the camera is inside it
+    return radius * projection[1][1] * windowHeight / -eye.z;
+}
+
+//the level for a size, only leaving the current one once the size is well past its boundary
+unsigned int pickLod(float pixels, unsigned int current) {
+    unsigned int coarser = 0, finer = 0;
+    while(coarser + 1 < MAX_LODS && pixels * (1.0 + LOD_HYSTERESIS) < LOD_PIXELS[coarser])
+        coarser++;
+    while(finer + 1 < MAX_LODS && pixels / (1.0 + LOD_HYSTERESIS) < LOD_PIXELS[finer])
+        finer++;
+    if(coarser > current)
+        return coarser;
+    if(finer < current)
+        return finer;
+    return current;
+}
+
 void update()
 {
     //total time
     //static float rotate = 0.;
     float dt = getDT();// if you have anything moving, use dt.
-    dynamicsWorld->stepSimulation(dt,10);
+
+    //step at a fixed rate, a slow frame can't make the next one slower
+    if(dt > MAX_FRAME_DT)
+        dt = MAX_FRAME_DT;
+    physicsAccumulator += dt;
+    std::chrono::time_point<std::chrono::high_resolution_clock> stepStart, stepNow;
+    stepStart = std::chrono::high_resolution_clock::now();
+    while(physicsAccumulator >= PHYSICS_STEP) {
+        savePhysicsState(paddleComputer);
+        savePhysicsState(paddlePlayer);
+        savePhysicsState(puck);
+        dynamicsWorld->stepSimulation(PHYSICS_STEP, 0);
+        physicsAccumulator -= PHYSICS_STEP;
+
+        //out of budget, drop the backlog instead of spiraling
+        stepNow = std::chrono::high_resolution_clock::now();
+        if(std::chrono::duration_cast< std::chrono::duration<float> >(stepNow-stepStart).count() > PHYSICS_BUDGET) {
+            droppedSteps += (int)(physicsAccumulator / PHYSICS_STEP);
+            physicsAccumulator = fmod(physicsAccumulator, PHYSICS_STEP);
+            break;
+        }
+    }
+    physicsAlpha = physicsAccumulator / PHYSICS_STEP;
 
     //update each model separately
     if(aiToggle == true){
@@ -327,13 +452,80 @@ void update()
     glutPostRedisplay();//call the display callback
 }
 
+//runs a frame once the pacer says it is due, then books the next one
+void tick(int value)
+{
+    pacer.waitForFrame();
+    update();
+    pacer.frameDone(true);
+    glutTimerFunc(pacer.delayMs(), tick, 0);
+}
+
+void savePhysicsState(Object &obj) {
+    obj.prevTransform = obj.rigidBody->getCenterOfMassTransform();
+}
+
 void update(Object &obj) {
+    //blend between the last two physics steps so motion is smooth at any frame rate
     btTransform trans;
+    btTransform current = obj.rigidBody->getCenterOfMassTransform();
     btScalar buffer[16];
-    trans = obj.rigidBody -> getCenterOfMassTransform();
+    trans.setOrigin(obj.prevTransform.getOrigin().lerp(current.getOrigin(), physicsAlpha));
+    trans.setRotation(obj.prevTransform.getRotation().slerp(current.getRotation(), physicsAlpha));
     trans.getOpenGLMatrix(buffer);
     glm::mat4 modelPosition = glm::make_mat4(buffer);
     obj.modelMatrix = modelPosition;
+    //the box follows the body, the tree only restructures if it left its fattened volume
+    if(obj.cullNode != NULL) {
+        btDbvtVolume volume;
+        objectBounds(obj, volume);
+        btVector3 velocity = current.getOrigin() - obj.prevTransform.getOrigin();
+        cullTree.update(obj.cullNode, volume, velocity, CULL_MARGIN);
+    }
+}
+
+//world-space box around every mesh of an object at its current model matrix
+void objectBounds(const Object &obj, btDbvtVolume &volume) {
+    GLfloat worldMin[3], worldMax[3], meshMin[3], meshMax[3];
+    const GLfloat* matrix = glm::value_ptr(obj.modelMatrix);
+    transformAabb(matrix, obj.mesh[0].boundsMin, obj.mesh[0].boundsMax, worldMin, worldMax);
+    for(unsigned int i = 1; i < obj.numMeshes; i++) {
+        transformAabb(matrix, obj.mesh[i].boundsMin, obj.mesh[i].boundsMax, meshMin, meshMax);
+        for(int j = 0; j < 3; j++) {
+            worldMin[j] = std::min(worldMin[j], meshMin[j]);
+            worldMax[j] = std::max(worldMax[j], meshMax[j]);
+        }
+    }
+    volume = btDbvtVolume::FromMM(btVector3(worldMin[0], worldMin[1], worldMin[2]),
+                                  btVector3(worldMax[0], worldMax[1], worldMax[2]));
+}
+
+//marks what the camera can see, whole subtrees go at once when their box is in or out
+void cullScene() {
+    glm::mat4 viewProjection = projection * view;
+    extractFrustum(glm::value_ptr(viewProjection), viewFrustum);
+    table.visible = paddleComputer.visible = paddlePlayer.visible = puck.visible = false;
+    if(cullTree.m_root != NULL)
+        cullNode(cullTree.m_root, false);
+}
+
+void cullNode(const btDbvtNode* node, bool inside) {
+    if(!inside) {
+        const btVector3 &boxMin = node->volume.Mins();
+        const btVector3 &boxMax = node->volume.Maxs();
+        GLfloat min[3] = {(GLfloat)boxMin.x(), (GLfloat)boxMin.y(), (GLfloat)boxMin.z()};
+        GLfloat max[3] = {(GLfloat)boxMax.x(), (GLfloat)boxMax.y(), (GLfloat)boxMax.z()};
+        CullResult result = cullAabb(viewFrustum, min, max);
+        if(result == CULL_OUTSIDE)
+            return;
+        inside = result == CULL_INSIDE;
+    }
+    if(node->isleaf()) {
+        ((Object*)node->data)->visible = true;
+        return;
+    }
+    cullNode(node->childs[0], inside);
+    cullNode(node->childs[1], inside);
 }
 
 void aiUpdate(Object &obj, float dtime){
@@ -358,12 +550,7 @@ void easyAI(Object &obj, float dtime){
     float x = sign*rand()%100/10;
     float y = sign*rand()%100/10;
 
-        btTransform trans;
-    btScalar buffer[16];
-    trans = obj.rigidBody -> getCenterOfMassTransform();
-    trans.getOpenGLMatrix(buffer);
-    glm::mat4 modelPosition = glm::make_mat4(buffer);
-    obj.modelMatrix = modelPosition;
+    update(obj);
     if((int)dtime %3 == 0)
         obj.rigidBody->applyCentralImpulse(btVector3(x/5,0,y/5));
     //obj.rigidBody->clearForces();
@@ -502,6 +689,17 @@ bool initialize()
     }
 
     table.modelMatrix = glm::rotate(glm::mat4(1.f),90.f,glm::vec3(0,1,0));
+    update(paddleComputer);
+    update(paddlePlayer);
+    update(puck);
+
+    //the table never moves, the rest follow their bodies in update(Object&)
+    Object* objects[] = {&table, &paddleComputer, &paddlePlayer, &puck};
+    for(int i = 0; i < 4; i++) {
+        btDbvtVolume volume;
+        objectBounds(*objects[i], volume);
+        objects[i]->cullNode = cullTree.insert(volume, objects[i]);
+    }
     // cylinder.modelMatrix = glm::scale(cylinder.modelMatrix, glm::vec3(4.0, 4.0, 4.0));
     // cube.modelMatrix = glm::scale(cube.modelMatrix, glm::vec3(2.0, 2.0, 2.0));
     // sphere.modelMatrix = glm::scale(sphere.modelMatrix, glm::vec3(5.0, 5.0, 5.0));
@@ -603,16 +801,30 @@ bool initialize()
     glEnable(GL_DEPTH_TEST);
     glDepthFunc(GL_LESS);
 
+    //glyph atlas for the scoreboard
+    initText(hudText, GLUT_BITMAP_TIMES_ROMAN_24);
+
     //and its done
     return true;
 }
 
+//how busy the timer kept the CPU, compare against the old idle loop's 100%
+void reportPacing()
+{
+    cout << "Frame pacing: " << (int)(pacer.averageUtilisation() * 100.0 + 0.5) << "% of a core on average" << endl;
+}
+
 void cleanUp()
 {
     // Clean up, Clean up
     glDeleteProgram(program);
+    freeText(hudText);
+
+    if(droppedSteps > 0)
+        cout << "Physics: dropped " << droppedSteps << " steps to stay within the frame budget" << endl;
 
     // Clean up Bullet Stuff
+    cullTree.clear();
     delete dynamicsWorld;
     delete solver;
     delete dispatcher;
@@ -653,7 +865,9 @@ bool loadOBJ(const char* filePathOBJ, const char* filePathTex, Object &obj){
     //read file
     srand(time(NULL));
     Assimp::Importer importer;
-    const aiScene *scene = importer.ReadFile(filePathOBJ, aiProcess_Triangulate);
+    const aiScene *scene = importer.ReadFile(filePathOBJ, aiProcess_Triangulate |
+                                                 aiProcess_JoinIdenticalVertices | //share vertices between faces
+                                                 aiProcess_ImproveCacheLocality); //reorder faces for the post-transform cache
     //return false if there is a scene error
     if(scene == NULL){
         cout << "Error: Unable to read in " << filePathOBJ << endl;
@@ -662,61 +876,163 @@ bool loadOBJ(const char* filePathOBJ, const char* filePathTex, Object &obj){
         return false;
     }
 
-    // Get Materials (textures)
-    bool success;
-    success = ilLoadImage((const ILstring)filePathTex);
-    if(!success) {
-        cout << "Error: Unable to load texture " << filePathTex << endl;
-        return false;
-    }
-    else {
-        success = ilConvertImage(IL_RGB, IL_UNSIGNED_BYTE);
+    // Get Materials (textures), the mip chain from texcook when there is one
+    if(!loadCookedTexture(filePathTex, obj.texture)) {
+        bool success;
+        success = ilLoadImage((const ILstring)filePathTex);
         if(!success) {
-            cout << "Error: Unable to convert image " << filePathTex << endl;
+            cout << "Error: Unable to load texture " << filePathTex << endl;
             return false;
         }
-        glGenTextures(1, &obj.texture);
-        glBindTexture(GL_TEXTURE_2D, obj.texture);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexImage2D(GL_TEXTURE_2D, 0, ilGetInteger(IL_IMAGE_BPP), ilGetInteger(IL_IMAGE_WIDTH),
-            ilGetInteger(IL_IMAGE_HEIGHT), 0, ilGetInteger(IL_IMAGE_FORMAT), GL_UNSIGNED_BYTE,
-            ilGetData());
+        else {
+            success = ilConvertImage(IL_RGB, IL_UNSIGNED_BYTE);
+            if(!success) {
+                cout << "Error: Unable to convert image " << filePathTex << endl;
+                return false;
+            }
+            glGenTextures(1, &obj.texture);
+            glBindTexture(GL_TEXTURE_2D, obj.texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexImage2D(GL_TEXTURE_2D, 0, ilGetInteger(IL_IMAGE_BPP), ilGetInteger(IL_IMAGE_WIDTH),
+                ilGetInteger(IL_IMAGE_HEIGHT), 0, ilGetInteger(IL_IMAGE_FORMAT), GL_UNSIGNED_BYTE,
+                ilGetData());
+        }
     }
 
     // Get mesh
     obj.numMeshes = scene->mNumMeshes;
-    obj.mesh = new Mesh[obj.numMeshes];
+    obj.mesh = new Mesh[obj.numMeshes]();
+
+    unsigned int oldVertices = 0;
+    unsigned int newVertices = 0;
+    unsigned int newIndices = 0;
 
     for( unsigned int i=0; i<scene->mNumMeshes; i++ ) {
         aiMesh *tmpMesh = scene->mMeshes[i]; //aiMesh temporary to give to struct
-        tmpMesh = scene->mMeshes[i];
-        obj.mesh[i].geometry = new Vertex[tmpMesh->mNumVertices]; //3 vertex for each face
+        obj.mesh[i].geometry = new Vertex[tmpMesh->mNumVertices]; //one per unique vertex
         obj.mesh[i].numVertices = tmpMesh->mNumVertices;
         obj.mesh[i].numFaces = tmpMesh->mNumFaces;
+        obj.mesh[i].numIndices = tmpMesh->mNumFaces * 3;
+        obj.mesh[i].indices = new GLuint[obj.mesh[i].numIndices];
+
+        for( unsigned int j=0; j<tmpMesh->mNumVertices; j++ ) {
+            //load vertex positions
+            obj.mesh[i].geometry[j].position[0] = tmpMesh->mVertices[j].x;
+            obj.mesh[i].geometry[j].position[1] = tmpMesh->mVertices[j].y;
+            obj.mesh[i].geometry[j].position[2] = tmpMesh->mVertices[j].z;
+            //load vertex uv
+            obj.mesh[i].geometry[j].uv[0] = tmpMesh->mTextureCoords[0][j].x;
+            obj.mesh[i].geometry[j].uv[1] = tmpMesh->mTextureCoords[0][j].y;
+            //grow the culling bounds
+            for( unsigned int k=0; k<3; k++ ) {
+                GLfloat coord = obj.mesh[i].geometry[j].position[k];
+                obj.mesh[i].boundsMin[k] = j == 0 ? coord : std::min(obj.mesh[i].boundsMin[k], coord);
+                obj.mesh[i].boundsMax[k] = j == 0 ? coord : std::max(obj.mesh[i].boundsMax[k], coord);
+            }
+        }
 
+        //faces stay in the order assimp optimized them for
         for( unsigned int j=0; j<tmpMesh->mNumFaces; j++ ) {
             aiFace &tmpFace = tmpMesh->mFaces[j];
             for( unsigned int k=0; k<3; k++ ) {
-                unsigned int tmpVertex = tmpFace.mIndices[k];
-                //load vertex positions
-                obj.mesh[i].geometry[3*j+k].position[0] = tmpMesh->mVertices[tmpVertex].x;
-                obj.mesh[i].geometry[3*j+k].position[1] = tmpMesh->mVertices[tmpVertex].y;
-                obj.mesh[i].geometry[3*j+k].position[2] = tmpMesh->mVertices[tmpVertex].z;
-                //load vertex uv
-                obj.mesh[i].geometry[3*j+k].uv[0] = tmpMesh->mTextureCoords[0][tmpVertex].x;
-                obj.mesh[i].geometry[3*j+k].uv[1] = tmpMesh->mTextureCoords[0][tmpVertex].y;
+                obj.mesh[i].indices[3*j+k] = tmpFace.mIndices[k];
             }
         }
+
+        buildLods(obj.mesh[i]);
+
+        oldVertices += obj.mesh[i].numFaces * 3;
+        newVertices += obj.mesh[i].numVertices;
+        newIndices += obj.mesh[i].numIndices;
     }
 
+    cout << filePathOBJ << ": " << oldVertices << " vertices (" << oldVertices * sizeof(Vertex) << " bytes) -> "
+         << newVertices << " vertices + " << newIndices << " indices ("
+         << newVertices * sizeof(Vertex) + newIndices * sizeof(GLuint) << " bytes)" << endl;
+
     //Create Vertex Array Object for each mesh
     for(unsigned int i=0; i<scene->mNumMeshes; i++ ) {
         glGenBuffers(1, &(obj.mesh[i].vbo_geometry));
         glBindBuffer(GL_ARRAY_BUFFER, obj.mesh[i].vbo_geometry);
-        glBufferData(GL_ARRAY_BUFFER, obj.mesh[i].numFaces * 3 * sizeof(Vertex), &(obj.mesh[i].geometry[0]), GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, obj.mesh[i].numVertices * sizeof(Vertex), &(obj.mesh[i].geometry[0]), GL_STATIC_DRAW);
+
+        //every level in one ibo, the coarser ones after the mesh's own
+        glGenBuffers(1, &(obj.mesh[i].ibo_geometry));
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj.mesh[i].ibo_geometry);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, (obj.mesh[i].numIndices + obj.mesh[i].numLodIndices) * sizeof(GLuint), NULL, GL_STATIC_DRAW);
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, obj.mesh[i].numIndices * sizeof(GLuint), &(obj.mesh[i].indices[0]));
+        if(obj.mesh[i].numLodIndices > 0)
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, obj.mesh[i].numIndices * sizeof(GLuint),
+                            obj.mesh[i].numLodIndices * sizeof(GLuint), obj.mesh[i].lodIndices);
+    }
+
+    return true;
+}
+
+//decimates the mesh by half per level into lodIndices, stopping once a level
+//would be tiny or decimation stops paying. The vertices are shared by every level
+void buildLods(Mesh &mesh) {
+    mesh.numLods = 1;
+    mesh.lodFirst[0] = 0;
+    mesh.lodCount[0] = mesh.numIndices;
+    mesh.lodIndices = NULL;
+    mesh.numLodIndices = 0;
+    if(mesh.numFaces >> 1 < LOD_MIN_FACES)
+        return;
+
+    //the tolerance is the whole mesh, the face counts are what stop it.
+    //There are no normals, so each corner keeps the first vertex welded into it
+    GLfloat size = 0.0;
+    for(int k = 0; k < 3; k++)
+        size = std::max(size, mesh.boundsMax[k] - mesh.boundsMin[k]);
+    simplify::Decimator decimator(mesh.geometry[0].position, sizeof(Vertex) / sizeof(GLfloat), mesh.numVertices,
+                                  mesh.indices, mesh.numIndices, -1);
+    std::vector<GLuint> levels, level;
+    unsigned int faces = mesh.numFaces;
+    for(unsigned int i = 1; i < MAX_LODS; i++) {
+        unsigned int target = mesh.numFaces >> i;
+        if(target < LOD_MIN_FACES)
+            break;
+        decimator.run(size, target);
+        if(decimator.faceCount() > faces * 3 / 4)
+            break;
+        faces = decimator.faceCount();
+        decimator.outputIndices(level);
+        mesh.lodFirst[i] = mesh.numIndices + levels.size();
+        mesh.lodCount[i] = level.size();
+        levels.insert(levels.end(), level.begin(), level.end());
+        mesh.numLods++;
     }
+    if(levels.empty())
+        return;
+    mesh.numLodIndices = levels.size();
+    mesh.lodIndices = new GLuint[levels.size()];
+    std::copy(levels.begin(), levels.end(), mesh.lodIndices);
+}
 
+//loads the mip chain texcook left next to an image, false if there isn't one
+//or it is out of date
+bool loadCookedTexture(const char* filePath, GLuint &texture) {
+    DDSImage dds;
+    if(!GLEW_EXT_texture_compression_s3tc || !readCookedDDS(filePath, dds))
+        return false;
+
+    GLenum format = dds.fourCC == DDS_FOURCC_DXT1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+                                                  : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, dds.levels - 1);
+    size_t offset = 0;
+    for(unsigned int i = 0; i < dds.levels; i++) {
+        unsigned int width = ddsLevelDimension(dds.width, i);
+        unsigned int height = ddsLevelDimension(dds.height, i);
+        size_t size = ddsLevelSize(width, height, dds.fourCC);
+        glCompressedTexImage2D(GL_TEXTURE_2D, i, format, width, height, 0, size, &dds.data[offset]);
+        offset += size;
+    }
     return true;
 }
 
@@ -798,6 +1114,11 @@ void initPhysics() {
     paddlePlayer.rigidBody = new btRigidBody(paddlePlayerRigidBodyCI);
     paddlePlayer.rigidBody->setActivationState(DISABLE_DEACTIVATION);
     dynamicsWorld->addRigidBody(paddlePlayer.rigidBody);
+
+    //nothing to interpolate from until the first step
+    savePhysicsState(paddleComputer);
+    savePhysicsState(paddlePlayer);
+    savePhysicsState(puck);
 }
 
 void menu(int selection){
@@ -878,6 +1199,11 @@ void menu(int selection){
     case 8:
         exit(0);
         break;
+
+        //full detail everywhere, to compare triangle counts against
+    case 9:
+        lodEnabled = !lodEnabled;
+        break;
     }
 
 
@@ -892,6 +1218,11 @@ void restart_game(){
 }
 
 void printText(float x, float y, char* text) {
+    //one cached draw call per string from the glyph atlas
+    if(drawText(hudText, x, y, text, windowWidth, windowHeight, 1.0, 0.0, 0.0))
+        return;
+
+    //no atlas, the bitmap font it was built from goes straight to the screen
     glUseProgram(0);
 
     float r,g,b;
@@ -1,8 +1,83 @@
 #version 130
+#extension GL_ARB_uniform_buffer_object : require
 
+// the LightInfo lights from initLighting(), moved into eye space on the CPU
+// once per frame. The point lights come first, then the distant ones
+layout(std140) uniform LightData {
+	ivec4 lightCount; // (point lights, distant lights, unused, unused)
+	vec4 lightPosition[MAX_LIGHTS]; // w is 0 for distant lights, xyz is then toward the light
+	vec4 lightAmbient[MAX_LIGHTS]; // La
+	vec4 lightDiffuse[MAX_LIGHTS]; // Ld
+	vec4 lightSpecular[MAX_LIGHTS]; // Ls
+};
+
+// struct MaterialInfo {
+// 	vec3 Ka; // Ambient reflectivity
+// 	vec3 Kd; // Diffuse reflectivity
+// 	vec3 Ks; // Specular reflectivity
+// 	float Shininess; // Specular shininess factor
+// };
+// uniform MaterialInfo Material;
+
+// the lighting is picked when the program is built, with any of
+// AMBIENT_LIGHT, DISTANT_LIGHT, POINT_LIGHT and SPOT_LIGHT defined
 varying vec2 v_UV;
+in vec3 v_eyePosition;
+in vec3 v_eyeNormal;
 uniform sampler2D gSampler;
-in vec3 LightIntensity;
+uniform mat4 modelViewMatrix;
+
+#if defined(POINT_LIGHT) || defined(DISTANT_LIGHT)
+// one light from LightData, point or distant
+vec3 phongModel(int light, vec3 position, vec3 norm, vec3 v) {
+	vec3 s = normalize(lightPosition[light].xyz - position * lightPosition[light].w);
+	vec3 r = reflect( -s, norm );
+	float sDotN = max( dot(s,norm), 0.0 );
+	// vec3 diffuse = Light.Ld * Material.Kd * sDotN;
+	vec3 diffuse = lightDiffuse[light].rgb * sDotN;
+	// spec = Light.Ls * Material.Ks * pow( max( dot(r,v), 0.0 ), Material.Shininess );
+	// sign() drops the highlight facing away from the light, instead of a branch
+	vec3 spec = lightSpecular[light].rgb * pow( max( dot(r,v), 0.0 ), 0.5 ) * sign(sDotN);
+	return diffuse + spec;
+}
+
+vec3 phongLights(int first, int count, vec3 position, vec3 norm) {
+	vec3 total = vec3(0.0);
+	vec3 v = normalize(-position);
+	for(int i = first; i < first + count; i++)
+		total += phongModel(i, position, norm, v);
+	return total;
+}
+#endif
+
+#ifdef SPOT_LIGHT
+vec3 phongModelSpot(vec3 position, vec3 norm) {
+	vec3 lightPosition = (vec4(0.0,10.0,0.0,1.0) * modelViewMatrix).xyz;
+	vec3 spotDirection = normalize(vec3(0.0,1.0,0.0) * gl_NormalMatrix);
+	vec3 lightDirection = normalize(position - lightPosition);
+
+	float angle = max(dot(spotDirection, -lightDirection), 0.0);
+	// full white inside the cone, nothing outside it
+	return vec3(step(acos(angle), radians(36.666666)));
+}
+#endif
+
 void main(){
-   gl_FragColor = vec4(LightIntensity, 1.0) * texture2D(gSampler, vec2(v_UV[0], v_UV[1]));
-}
\ No newline at end of file
+	vec3 norm = normalize(v_eyeNormal);
+	vec3 LightIntensity = vec3(0.,0.,0.);
+#ifdef AMBIENT_LIGHT
+	// vec3 ambient = Light.La * Material.Ka;
+	for(int i = 0; i < lightCount.x + lightCount.y; i++)
+		LightIntensity += lightAmbient[i].rgb;
+#endif
+#ifdef POINT_LIGHT
+	LightIntensity += phongLights(0, lightCount.x, v_eyePosition, norm);
+#endif
+#ifdef DISTANT_LIGHT
+	LightIntensity += phongLights(lightCount.x, lightCount.y, v_eyePosition, norm);
+#endif
+#ifdef SPOT_LIGHT
+	LightIntensity += phongModelSpot(v_eyePosition, norm);
+#endif
+	gl_FragColor = vec4(LightIntensity, 1.0) * texture2D(gSampler, vec2(v_UV[0], v_UV[1]));
+}
@@ -0,0 +1,141 @@
+#ifndef DDS_H
+#define DDS_H
+
+#include <vector>
+#include <fstream>
+#include <cstddef>
+#include <string>
+
+//DirectDraw Surface files holding a full mip chain of BC1 (DXT1) or BC3 (DXT5)
+//blocks. texcook writes them and the texture loaders read them.
+const unsigned int DDS_MAGIC = 0x20534444;//"DDS "
+const unsigned int DDS_FOURCC_DXT1 = 0x31545844;//"DXT1", opaque RGB, 8 bytes a block
+const unsigned int DDS_FOURCC_DXT5 = 0x35545844;//"DXT5", RGBA, 16 bytes a block
+const unsigned int DDS_SOURCE_TAG = 0x4b4f4f43;//"COOK" in reserved1[0], the source's hash follows it
+
+//header flags
+const unsigned int DDSD_CAPS = 0x1;
+const unsigned int DDSD_HEIGHT = 0x2;
+const unsigned int DDSD_WIDTH = 0x4;
+const unsigned int DDSD_PIXELFORMAT = 0x1000;
+const unsigned int DDSD_MIPMAPCOUNT = 0x20000;
+const unsigned int DDSD_LINEARSIZE = 0x80000;
+const unsigned int DDPF_FOURCC = 0x4;
+const unsigned int DDSCAPS_COMPLEX = 0x8;
+const unsigned int DDSCAPS_TEXTURE = 0x1000;
+const unsigned int DDSCAPS_MIPMAP = 0x400000;
+
+struct DDSPixelFormat
+{
+    unsigned int size;//32
+    unsigned int flags;
+    unsigned int fourCC;
+    unsigned int rgbBitCount;
+    unsigned int rBitMask;
+    unsigned int gBitMask;
+    unsigned int bBitMask;
+    unsigned int aBitMask;
+};
+
+//follows the magic number
+struct DDSHeader
+{
+    unsigned int size;//124
+    unsigned int flags;
+    unsigned int height;
+    unsigned int width;
+    unsigned int linearSize;//bytes in the top level
+    unsigned int depth;
+    unsigned int mipMapCount;
+    unsigned int reserved1[11];
+    DDSPixelFormat format;
+    unsigned int caps;
+    unsigned int caps2;
+    unsigned int caps3;
+    unsigned int caps4;
+    unsigned int reserved2;
+};
+
+//a loaded file, every level back to back from the largest down
+struct DDSImage
+{
+    unsigned int width;
+    unsigned int height;
+    unsigned int levels;
+    unsigned int fourCC;
+    unsigned long long sourceHash;//of the image it was cooked from, 0 if the file doesn't say
+    std::vector<unsigned char> data;
+};
+
+//64 bit FNV-1a of a whole file, what texcook stamps into the header
+inline bool ddsHashFile(const char* filePath, unsigned long long &hash)
+{
+    std::ifstream input(filePath, std::ios::binary);
+    if(!input)
+        return false;
+    hash = 14695981039346656037ULL;
+    char buffer[65536];
+    while(input.read(buffer, sizeof(buffer)) || input.gcount() > 0) {
+        for(std::streamsize i = 0; i < input.gcount(); i++) {
+            hash ^= (unsigned char)buffer[i];
+            hash *= 1099511628211ULL;
+        }
+    }
+    return true;
+}
+
+inline unsigned int ddsLevelDimension(unsigned int size, unsigned int level)
+{
+    return (size >> level) > 0 ? size >> level : 1;
+}
+
+//blocks cover 4x4 texels, levels smaller than that still take a whole block
+inline size_t ddsLevelSize(unsigned int width, unsigned int height, unsigned int fourCC)
+{
+    size_t blocks = (size_t)((width + 3) / 4) * ((height + 3) / 4);
+    return blocks * (fourCC == DDS_FOURCC_DXT1 ? 8 : 16);
+}
+
+//reads a DXT1 or DXT5 file, false if it is missing or anything else
+inline bool readDDS(const char* filePath, DDSImage &image)
+{
+    std::ifstream input(filePath, std::ios::binary);
+    unsigned int magic;
+    DDSHeader header;
+    if(!input.read((char*)&magic, sizeof(magic)) || !input.read((char*)&header, sizeof(header)))
+        return false;
+    if(magic != DDS_MAGIC || header.size != sizeof(DDSHeader) ||
+       !(header.format.flags & DDPF_FOURCC) || header.width == 0 || header.height == 0)
+        return false;
+    if(header.format.fourCC != DDS_FOURCC_DXT1 && header.format.fourCC != DDS_FOURCC_DXT5)
+        return false;
+
+    image.width = header.width;
+    image.height = header.height;
+    image.fourCC = header.format.fourCC;
+    image.sourceHash = 0;
+    if(header.reserved1[0] == DDS_SOURCE_TAG)
+        image.sourceHash = header.reserved1[1] | (unsigned long long)header.reserved1[2] << 32;
+    image.levels = (header.flags & DDSD_MIPMAPCOUNT) && header.mipMapCount > 0 ? header.mipMapCount : 1;
+    if(image.levels > 32)
+        return false;
+
+    size_t bytes = 0;
+    for(unsigned int i = 0; i < image.levels; i++)
+        bytes += ddsLevelSize(ddsLevelDimension(image.width, i), ddsLevelDimension(image.height, i), image.fourCC);
+    image.data.resize(bytes);
+    return (bool)input.read((char*)&image.data[0], bytes);
+}
+
+//reads the "<image>.dds" texcook left next to sourcePath, false if there isn't
+//one or it was cooked from a different version of the image
+inline bool readCookedDDS(const char* sourcePath, DDSImage &image)
+{
+    std::string cookedPath = std::string(sourcePath) + ".dds";
+    unsigned long long hash;
+    if(!readDDS(cookedPath.c_str(), image) || !ddsHashFile(sourcePath, hash))
+        return false;
+    return image.sourceHash == hash;
+}
+
+#endif
@@ -4,7 +4,11 @@
 #include <chrono>
 #include <fstream>
 #include <vector>
+#include <map>
+#include <algorithm>
 #include <ctime>
+#include <cfloat>
+#include <cstring>
 #include <cstdlib>
 
 #include <glm/glm.hpp>
@@ -17,10 +21,15 @@
 #include "assimp/scene.h"
 
 #include "IL/il.h"
+#include <string>
+#include "dds.h"
+#include "simplify.h"
+#include "text.h"
 
 #include "bullet/btBulletCollisionCommon.h"
 #include "bullet/btBulletDynamicsCommon.h"
 #include <time.h>
+#include "framepacer.h"
 
 using namespace std;
 
@@ -44,14 +53,27 @@ struct Vertex
     GLfloat normal[3];
 };
 
+//levels of detail a mesh can have, counting itself
+const unsigned int MAX_LODS = 4;
+
 struct Mesh
 {
     Vertex* geometry;
     unsigned int numFaces;
     unsigned int numVertices;
+    GLuint* indices;//3 per face, into geometry
+    unsigned int numIndices;
     GLuint vbo_geometry;
+    GLuint ibo_geometry;
     GLuint texture;
     bool hasNormals;
+    GLfloat boundsMin[3];//model-space box around the vertices
+    GLfloat boundsMax[3];
+    unsigned int numLods;//1 is just the mesh itself
+    GLuint lodFirst[MAX_LODS];//where each level starts in the ibo, in indices
+    GLsizei lodCount[MAX_LODS];
+    GLuint* lodIndices;//the coarser levels, after indices in the ibo
+    unsigned int numLodIndices;
 };
 
 struct Object
@@ -61,6 +83,7 @@ struct Object
     unsigned int numMeshes;
     btRigidBody *rigidBody;
     GLuint texture;
+    unsigned int lod;//level drawn last frame
 };
 
 // Game stat variables
@@ -89,27 +112,54 @@ GLfloat light_position[] = { 1.0, 1.0, 1.0, 0.0 };
 Object lightObj;
 
 // GLOBAL LIGHTS
-LightInfo pointLight;
-GLint loc_pointLight;
+//in world space, initLighting() fills them in. Lit per pixel in shader.frag
+std::vector<LightInfo> pointLights;
+std::vector<LightInfo> distantLights;//Position is toward the light, w of 0
+
+//LightData in shader.frag, laid out std140. The point lights come first
+const unsigned int MAX_LIGHTS = 16;
+const GLuint LIGHT_BINDING = 0;
+struct LightData
+{
+    GLint lightCount[4];//point, distant
+    GLfloat position[MAX_LIGHTS][4];//eye space
+    GLfloat ambient[MAX_LIGHTS][4];
+    GLfloat diffuse[MAX_LIGHTS][4];
+    GLfloat specular[MAX_LIGHTS][4];
+};
+GLuint lightUbo;
 
 //--Evil Global variables
 //Just for this example!
 int windowWidth = 1366, windowHeight = 768;// Window size
 GLuint program;// The GLSL program handle
+TextRenderer hudText;// scoreboard glyphs
 const char* VERTEX_SHADER = "../bin/assets/shader.vert";
 const char* FRAGMENT_SHADER = "../bin/assets/shader.frag";
 
-//uniform locations
+//uniform locations, the current variant's
 GLint loc_mvpmat;// Location of the modelviewprojection matrix in the shader
 GLint loc_modelviewmat;
-GLint loc_bools;
 // GLint loc_projmat;
 
-//attribute locations
-GLint loc_position;
-GLint loc_uv;
-GLint loc_normal;
+//attribute locations, bound before linking so every variant agrees
+const GLint loc_position = 0;
+const GLint loc_uv = 1;
+const GLint loc_normal = 2;
 GLint gSampler;
+
+//Shader permutations, one program per set of lights compiled in with #defines,
+//so the shaders never branch on the toggles. Built the first time a set is picked
+const int SHADER_FEATURES = 4;
+const char* FEATURE_DEFINES[SHADER_FEATURES] = {"AMBIENT_LIGHT", "DISTANT_LIGHT", "POINT_LIGHT", "SPOT_LIGHT"};
+struct ShaderVariant
+{
+    GLuint program;//0 if it failed to build
+    GLint loc_mvpmat;
+    GLint loc_modelviewmat;
+    GLint gSampler;
+};
+std::map<unsigned int, ShaderVariant> shaderVariants;//by feature bits
 GLfloat lmodel_ambient[] = {0.2, 0.2, 0.2, 1.0};
 
 //transform matrices
@@ -118,11 +168,22 @@ glm::mat4 view;//world->eye
 glm::mat4 projection;//eye->clip
 glm::mat4 modelView;
 glm::mat4 mvp;//premultiplied modelviewprojection
-int toggles[4];
+int toggles[4];//(ambient, distant, point, spot), picks the shader variant
+
+//Levels of detail, picked from how many pixels tall an object's bounding sphere is
+bool lodEnabled = true;
+const float LOD_PIXELS[MAX_LODS] = {160.0, 80.0, 40.0, 0.0};//smallest size each level is drawn at
+const float LOD_HYSTERESIS = 0.2;//how far past a boundary a size has to go before the level changes
+const unsigned int LOD_MIN_FACES = 16;//no level gets smaller than this
+int trianglesDrawn = 0;//the last frame
+
+//update() runs from a timer at this rate instead of spinning in the idle callback
+FramePacer pacer(60.0, 60.0);
 
 //--GLUT Callbacks
 void render();
 void update();
+void tick(int value);
 void reshape(int n_w, int n_h);
 void mouseClick(int button, int state, int x, int y);
 void mousePassive(int x, int y);
@@ -133,11 +194,21 @@ void menuWrapper(int id){
 }
 void restart_game();
 void initLighting();
+void uploadLights();
 
 //--Function Prototypes
 char* loadShader(const char*);
+unsigned int toggleFeatures();
+bool buildVariant(unsigned int features, ShaderVariant &variant);
+bool useShaderVariant(unsigned int features);
+void clearShaderVariants();
+void shaderSource(GLuint shader, const char* source, const std::string &defines);
 bool loadOBJ(const char*, const char*, Object &);
+bool loadCookedTexture(const char*, GLuint &);
 void renderOBJ(Object &obj);
+void buildLods(Mesh &mesh);
+float projectedPixels(const glm::vec4 &eye, float radius);
+unsigned int pickLod(float pixels, unsigned int current);
 void update(Object &obj);
 void printText(float x, float y, char* text);
 
@@ -145,6 +216,7 @@ void printText(float x, float y, char* text);
 bool initialize();
 void manageMenu();
 void cleanUp();
+void reportPacing();
 
 //--Random time things
 float getDT();
@@ -179,7 +251,7 @@ int main(int argc, char **argv)
     // Set all of the callbacks to GLUT that we need
     glutDisplayFunc(render);// Called when its time to display
     glutReshapeFunc(reshape);// Called if the window is resized
-    glutIdleFunc(update);// Called if there is nothing else to do
+    glutTimerFunc(0, tick, 0);// Calls update() at the paced frame rate
     glutKeyboardFunc(keyboard);// Called if there is keyboard input
     glutMouseFunc(mouseClick);// Called if there is mouse input
     
@@ -192,6 +264,7 @@ int main(int argc, char **argv)
     glutAddMenuEntry("Camera: Top View", 6);
     glutAddMenuEntry("Camera: Player Perspective", 7);
     glutAddMenuEntry("Camera: Angled Side View", 8);
+    glutAddMenuEntry("Toggle Level of Detail", 10);
     glutAddMenuEntry("Quit", 9);
     glutAttachMenu(GLUT_RIGHT_BUTTON);        
 
@@ -200,6 +273,7 @@ int main(int argc, char **argv)
     if(init)
     {
         t1 = std::chrono::high_resolution_clock::now();
+        atexit(reportPacing);//ESC and Quit leave through exit()
         glutMainLoop();
     }
 
@@ -216,6 +290,8 @@ void render() {
     
     //enable the shader program
     glUseProgram(program);
+    uploadLights();
+    trianglesDrawn = 0;
 
     //enable
     glUniform1i(gSampler, 0);
@@ -234,11 +310,26 @@ void render() {
     char buff[10];
     sprintf(buff, "P1:%d P2:%d\n" ,scorePlayer1, scorePlayer2);
     printText(-0.95f, 0.9f, buff);        
+    char triangles[64];
+    sprintf(triangles, "Triangles: %d (LOD %s)", trianglesDrawn, lodEnabled ? "on" : "off");
+    printText(-0.95f, 0.82f, triangles);
     //swap the buffers
     glutSwapBuffers();
 }
 
 void renderOBJ(Object &obj) {
+    //how big it looks picks the level, every mesh of it uses the same one
+    glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+    for(unsigned int i=0; i<obj.numMeshes; i++) {
+        for(int k=0; k<3; k++) {
+            boundsMin[k] = std::min(boundsMin[k], obj.mesh[i].boundsMin[k]);
+            boundsMax[k] = std::max(boundsMax[k], obj.mesh[i].boundsMax[k]);
+        }
+    }
+    glm::vec4 eye = view * obj.modelMatrix * glm::vec4((boundsMin + boundsMax) * 0.5f, 1.0);
+    float radius = glm::length(boundsMax - boundsMin) * 0.5f;
+    obj.lod = lodEnabled ? pickLod(projectedPixels(eye, radius), obj.lod) : 0;
+
     // //send to shader
 
     for(unsigned int i=0; i<obj.numMeshes; i++) {
@@ -247,7 +338,6 @@ void renderOBJ(Object &obj) {
         modelView = view * obj.modelMatrix;
         glUniformMatrix4fv(loc_mvpmat, 1, GL_FALSE, glm::value_ptr(mvp));
         glUniformMatrix4fv(loc_modelviewmat, 1, GL_FALSE, glm::value_ptr(modelView));
-        glUniform4i(loc_bools, toggles[0], toggles[1], toggles[2], toggles[3]);
         // glUniformMatrix4fv(loc_projmat, 1, GL_FALSE, glm::value_ptr(projection));
         //set up the Vertex Buffer Object so it can be drawn
 
@@ -264,11 +354,35 @@ void renderOBJ(Object &obj) {
         glVertexAttribPointer(loc_uv, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex,uv));
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, obj.texture);
-        glDrawArrays(GL_TRIANGLES, 0, obj.mesh[i].numFaces * 3);
-
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj.mesh[i].ibo_geometry);
+        unsigned int level = std::min(obj.lod, obj.mesh[i].numLods - 1);
+        glDrawElements(GL_TRIANGLES, obj.mesh[i].lodCount[level], GL_UNSIGNED_INT,
+                       (void*)(obj.mesh[i].lodFirst[level] * sizeof(GLuint)));
+        trianglesDrawn += obj.mesh[i].lodCount[level] / 3;
     }
 }
 
+//how many pixels tall a sphere at eye would be on screen
+float projectedPixels(const glm::vec4 &eye, float radius) {
+    if(-eye.z <= radius)
+        return FLT_MAX;//the camera is inside it
+    return radius * projection[1][1] * windowHeight / -eye.z;
+}
+
+//the level for a size, only leaving the current one once the size is well past its boundary
+unsigned int pickLod(float pixels, unsigned int current) {
+    unsigned int coarser = 0, finer = 0;
+    while(coarser + 1 < MAX_LODS && pixels * (1.0 + LOD_HYSTERESIS) < LOD_PIXELS[coarser])
+        coarser++;
+    while(finer + 1 < MAX_LODS && pixels / (1.0 + LOD_HYSTERESIS) < LOD_PIXELS[finer])
+        finer++;
+    if(coarser > current)
+        return coarser;
+    if(finer < current)
+        return finer;
+    return current;
+}
+
 void update()
 {
     //total time
@@ -285,6 +399,15 @@ void update()
     glutPostRedisplay();//call the display callback
 }
 
+//runs a frame once the pacer says it is due, then books the next one
+void tick(int value)
+{
+    pacer.waitForFrame();
+    update();
+    pacer.frameDone(true);
+    glutTimerFunc(pacer.delayMs(), tick, 0);
+}
+
 void reshape(int n_w, int n_h)
 {
     windowWidth = n_w;
@@ -330,134 +453,175 @@ bool initialize()
     }
     //--Geometry done
 
-    GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-    GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+    //the program for the starting toggles, the rest are built the first time they're picked
+    if(!useShaderVariant(toggleFeatures()))
+        return false;
+    
+    //--Init the view and projection matrices
+    //  if you will be having a moving camera the view matrix will need to more dynamic
+    //  ...Like you should update it before you render more dynamic 
+    //  for this project having them static will be fine
+    view = glm::lookAt( glm::vec3(0, 1.0, -2.0), //Eye Position
+                        glm::vec3(0.0, 0.0, 0.0), //Focus point
+                        glm::vec3(0.0, 1.0, 0.0)); //Positive Y is up
+
+    projection = glm::perspective( 45.0f, //the FoV typically 90 degrees is good which is what this is set to
+                                   float(windowWidth)/float(windowHeight), //Aspect Ratio, so Circles stay Circular
+                                   0.01f, //Distance to the near plane, normally a small value like this
+                                   100.0f); //Distance to the far plane, 
 
-    //Shader Sources
-    // Put these into files and write a loader in the future
-    // Note the added uniform!
+    //enable depth testing
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+    glEnable(GL_CULL_FACE);
+
+    // Enable lighting
+    glEnable(GL_LIGHTING);
+    glEnable(GL_LIGHT0);
+
+    //glyph atlas for the scoreboard
+    initText(hudText, GLUT_BITMAP_TIMES_ROMAN_24);
 
-    //Load Vertex Shader
-    const char* vs = loadShader(VERTEX_SHADER);
-    const char* fs = loadShader(FRAGMENT_SHADER);
+    //and its done
+    return true;
+}
+
+//the lights the toggles ask for
+unsigned int toggleFeatures() {
+    unsigned int features = 0;
+    for(int i = 0; i < SHADER_FEATURES; i++) {
+        if(toggles[i] == 1)
+            features |= 1 << i;
+    }
+    return features;
+}
+
+//compiles and links the shaders with these features defined, false if anything fails
+bool buildVariant(unsigned int features, ShaderVariant &variant) {
+    variant.program = 0;
+    char sizes[32];
+    snprintf(sizes, sizeof(sizes), "#define MAX_LIGHTS %u\n", MAX_LIGHTS);
+    std::string defines = sizes, names;
+    for(int i = 0; i < SHADER_FEATURES; i++) {
+        if(features & (1 << i)) {
+            defines += std::string("#define ") + FEATURE_DEFINES[i] + "\n";
+            names += std::string(" ") + FEATURE_DEFINES[i];
+        }
+    }
+    char* vs = loadShader(VERTEX_SHADER);
+    char* fs = loadShader(FRAGMENT_SHADER);
+    GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+    GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+    shaderSource(vertex_shader, vs, defines);
+    shaderSource(fragment_shader, fs, defines);
+    delete[] vs;
+    delete[] fs;
 
     //compile the shaders
     GLint shader_status;
 
     // Vertex shader first
-    glShaderSource(vertex_shader, 1, &vs, NULL);
     glCompileShader(vertex_shader);
     //check the compile status
     glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &shader_status);
     if(!shader_status)
     {
         std::cerr << "[F] FAILED TO COMPILE VERTEX SHADER!" << std::endl;
+        glDeleteShader(vertex_shader);
+        glDeleteShader(fragment_shader);
         return false;
     }
 
     // Now the Fragment shader
-    glShaderSource(fragment_shader, 1, &fs, NULL);
     glCompileShader(fragment_shader);
     //check the compile status
     glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &shader_status);
     if(!shader_status)
     {
         std::cerr << "[F] FAILED TO COMPILE FRAGMENT SHADER!" << std::endl;
+        glDeleteShader(vertex_shader);
+        glDeleteShader(fragment_shader);
         return false;
     }
 
     //Now we link the 2 shader objects into a program
     //This program is what is run on the GPU
-    program = glCreateProgram();
-    glAttachShader(program, vertex_shader);
-    glAttachShader(program, fragment_shader);
-    glLinkProgram(program);
+    GLuint linked = glCreateProgram();
+    glAttachShader(linked, vertex_shader);
+    glAttachShader(linked, fragment_shader);
+    glBindAttribLocation(linked, loc_position, "v_position");
+    glBindAttribLocation(linked, loc_uv, "v_uv");
+    glBindAttribLocation(linked, loc_normal, "v_normal");
+    glLinkProgram(linked);
+    glDeleteShader(vertex_shader);
+    glDeleteShader(fragment_shader);
     //check if everything linked ok
-    glGetProgramiv(program, GL_LINK_STATUS, &shader_status);
+    glGetProgramiv(linked, GL_LINK_STATUS, &shader_status);
     if(!shader_status)
     {
         std::cerr << "[F] THE SHADER PROGRAM FAILED TO LINK" << std::endl;
+        glDeleteProgram(linked);
         return false;
     }
 
-    //Now we set the locations of the attributes and uniforms
+    //Now we set the locations of the uniforms
     //this allows us to access them easily while rendering
-    loc_position = glGetAttribLocation(program, const_cast<const char*>("v_position"));
-    if(loc_position == -1)
-    {
-        std::cerr << "[F] POSITION NOT FOUND" << std::endl;
-        return false;
-    }
-
-    loc_uv = glGetAttribLocation(program, const_cast<const char*>("v_uv"));
-    if(loc_uv == -1)
-    {
-        std::cerr << "[F] V_UV NOT FOUND" << std::endl;
-        return false;
-    }
-
-    loc_normal = glGetAttribLocation(program, const_cast<const char*>("v_normal"));
-    if(loc_normal == -1)
-    {
-        std::cerr << "[F] NORMAL NOT FOUND" << std::endl;
-        return false;
-    }
-
-    loc_bools = glGetUniformLocation(program, const_cast<const char*>("toggles"));
-    if(loc_bools == -1)
-    {
-        std::cerr << "[F] TOGGLES NOT FOUND" << std::endl;
-        return false;
-    }
-
-    loc_mvpmat = glGetUniformLocation(program, "mvpMatrix");
-    if(loc_mvpmat == -1)
+    variant.loc_mvpmat = glGetUniformLocation(linked, "mvpMatrix");
+    if(variant.loc_mvpmat == -1)
     {
         std::cerr << "[F] MVPMATRIX NOT FOUND" << std::endl;
+        glDeleteProgram(linked);
         return false;
     }
-    loc_modelviewmat = glGetUniformLocation(program, const_cast<const char*>("modelViewMatrix"));
-    if(loc_modelviewmat == -1)
-    {
-        std::cerr << "[F] MODELVIEW MATRIX NOT FOUND" << std::endl;
-        return false;
-    }
-    // loc_projmat = glGetUniformLocation(program, const_cast<const char*>("projectionMatrix"));
-    // if(loc_projmat == -1)
-    // {
-    //     std::cerr << "[F] PROJECTION MATRIX NOT FOUND" << std::endl;
-    //     return false;
-    // }
-    gSampler = glGetUniformLocation(program, const_cast<const char*>("gSampler"));
-    if(gSampler == -1){
+    //only the lit variants use it, -1 makes its glUniform a no-op
+    variant.loc_modelviewmat = glGetUniformLocation(linked, const_cast<const char*>("modelViewMatrix"));
+    variant.gSampler = glGetUniformLocation(linked, const_cast<const char*>("gSampler"));
+    if(variant.gSampler == -1){
         std::cerr << "[F] LMAG NOT FOUND" << std::endl;
+        glDeleteProgram(linked);
         return false;
     }
-    
-    //--Init the view and projection matrices
-    //  if you will be having a moving camera the view matrix will need to more dynamic
-    //  ...Like you should update it before you render more dynamic 
-    //  for this project having them static will be fine
-    view = glm::lookAt( glm::vec3(0, 1.0, -2.0), //Eye Position
-                        glm::vec3(0.0, 0.0, 0.0), //Focus point
-                        glm::vec3(0.0, 1.0, 0.0)); //Positive Y is up
-
-    projection = glm::perspective( 45.0f, //the FoV typically 90 degrees is good which is what this is set to
-                                   float(windowWidth)/float(windowHeight), //Aspect Ratio, so Circles stay Circular
-                                   0.01f, //Distance to the near plane, normally a small value like this
-                                   100.0f); //Distance to the far plane, 
+    //the unlit variants leave the lights out
+    GLuint lightBlock = glGetUniformBlockIndex(linked, "LightData");
+    if(lightBlock != GL_INVALID_INDEX)
+        glUniformBlockBinding(linked, lightBlock, LIGHT_BINDING);
+    variant.program = linked;
+    cout << "Shaders: program (" << (names.empty() ? " unlit" : names) << " ) compiled" << endl;
+    return true;
+}
 
-    //enable depth testing
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LESS);
-    glEnable(GL_CULL_FACE);
+//makes the variant for these features current, building it the first time.
+//Keeps the current one if that fails
+bool useShaderVariant(unsigned int features) {
+    std::map<unsigned int, ShaderVariant>::iterator found = shaderVariants.find(features);
+    if(found == shaderVariants.end()) {
+        ShaderVariant variant;
+        buildVariant(features, variant);
+        found = shaderVariants.insert(std::make_pair(features, variant)).first;
+    }
+    if(found->second.program == 0)
+        return false;
+    program = found->second.program;
+    loc_mvpmat = found->second.loc_mvpmat;
+    loc_modelviewmat = found->second.loc_modelviewmat;
+    gSampler = found->second.gSampler;
+    return true;
+}
 
-    // Enable lighting
-    glEnable(GL_LIGHTING);
-    glEnable(GL_LIGHT0);
+void clearShaderVariants() {
+    std::map<unsigned int, ShaderVariant>::iterator i;
+    for(i = shaderVariants.begin(); i != shaderVariants.end(); i++)
+        glDeleteProgram(i->second.program);
+    shaderVariants.clear();
+}
 
-    //and its done
-    return true;
+//defines go right after the #version line, which has to come first
+void shaderSource(GLuint shader, const char* source, const std::string &defines) {
+    const char* body = strchr(source, '\n');
+    body = body != NULL ? body + 1 : source + strlen(source);
+    const char* parts[3] = {source, defines.c_str(), body};
+    GLint lengths[3] = {(GLint)(body - source), (GLint)defines.size(), -1};
+    glShaderSource(shader, 3, parts, lengths);
 }
 
 void initLighting(){
@@ -469,16 +633,61 @@ void initLighting(){
     glLightfv(GL_LIGHT0, GL_SPECULAR, light_specular);
     glLightfv(GL_LIGHT0, GL_POSITION, light_position);
 
+    LightInfo pointLight;
     pointLight.Position = glm::vec4(0.0,10.0,10.0,1.0);
     pointLight.La = glm::vec3(0.5,0.5,0.5);
     pointLight.Ld = glm::vec3(0.5,0.5,0.5);
     pointLight.Ls = glm::vec3(0.5,0.5,0.5);
+    pointLights.push_back(pointLight);
+
+    //the ambient comes from the point light alone
+    LightInfo distantLight;
+    distantLight.Position = glm::vec4(-1.0,0.0,0.0,0.0);
+    distantLight.La = glm::vec3(0.0,0.0,0.0);
+    distantLight.Ld = glm::vec3(0.5,0.5,0.5);
+    distantLight.Ls = glm::vec3(0.5,0.5,0.5);
+    distantLights.push_back(distantLight);
+
+    glGenBuffers(1, &lightUbo);
+    glBindBuffer(GL_UNIFORM_BUFFER, lightUbo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(LightData), NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, LIGHT_BINDING, lightUbo);
+}
+
+//every light into eye space, once for the whole frame
+void uploadLights() {
+    static LightData data;
+    unsigned int points = std::min((unsigned int)pointLights.size(), MAX_LIGHTS);
+    unsigned int distant = std::min((unsigned int)distantLights.size(), MAX_LIGHTS - points);
+    for(unsigned int i = 0; i < points + distant; i++) {
+        const LightInfo &light = i < points ? pointLights[i] : distantLights[i - points];
+        glm::vec4 eye = view * light.Position;//shader.frag normalizes the distant ones
+        for(int k = 0; k < 3; k++) {
+            data.position[i][k] = eye[k];
+            data.ambient[i][k] = light.La[k];
+            data.diffuse[i][k] = light.Ld[k];
+            data.specular[i][k] = light.Ls[k];
+        }
+        data.position[i][3] = light.Position.w;
+    }
+    data.lightCount[0] = points;
+    data.lightCount[1] = distant;
+    glBindBuffer(GL_UNIFORM_BUFFER, lightUbo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(data), &data);
+}
+
+//how busy the timer kept the CPU, compare against the old idle loop's 100%
+void reportPacing()
+{
+    cout << "Frame pacing: " << (int)(pacer.averageUtilisation() * 100.0 + 0.5) << "% of a core on average" << endl;
 }
 
 void cleanUp()
 {
     // Clean up, Clean up
-    glDeleteProgram(program);
+    clearShaderVariants();
+    glDeleteBuffers(1, &lightUbo);
+    freeText(hudText);
 
     // Clean up Bullet Stuff
     // delete dynamicsWorld;
@@ -521,7 +730,9 @@ bool loadOBJ(const char* filePathOBJ, const char* filePathTex, Object &obj){
     //read file
     srand(time(NULL));
     Assimp::Importer importer;
-    const aiScene *scene = importer.ReadFile(filePathOBJ, aiProcess_Triangulate);
+    const aiScene *scene = importer.ReadFile(filePathOBJ, aiProcess_Triangulate |
+                                                 aiProcess_JoinIdenticalVertices | //share vertices between faces
+                                                 aiProcess_ImproveCacheLocality); //reorder faces for the post-transform cache
     //return false if there is a scene error
     if(scene == NULL){
         cout << "Error: Unable to read in " << filePathOBJ << endl;
@@ -530,74 +741,155 @@ bool loadOBJ(const char* filePathOBJ, const char* filePathTex, Object &obj){
         return false;
     }
 
-    // Get Materials (textures)
-    bool success;
-    success = ilLoadImage((const ILstring)filePathTex);
-    if(!success) {
-        cout << "Error: Unable to load texture " << filePathTex << endl;
-        return false;
-    }
-    else {
-        success = ilConvertImage(IL_RGB, IL_UNSIGNED_BYTE);
+    // Get Materials (textures), the mip chain from texcook when there is one
+    if(!loadCookedTexture(filePathTex, obj.texture)) {
+        bool success;
+        success = ilLoadImage((const ILstring)filePathTex);
         if(!success) {
-            cout << "Error: Unable to convert image " << filePathTex << endl;
+            cout << "Error: Unable to load texture " << filePathTex << endl;
             return false;
         }
-        glGenTextures(1, &obj.texture);
-        glBindTexture(GL_TEXTURE_2D, obj.texture);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexImage2D(GL_TEXTURE_2D, 0, ilGetInteger(IL_IMAGE_BPP), ilGetInteger(IL_IMAGE_WIDTH),
-            ilGetInteger(IL_IMAGE_HEIGHT), 0, ilGetInteger(IL_IMAGE_FORMAT), GL_UNSIGNED_BYTE,
-            ilGetData());
+        else {
+            success = ilConvertImage(IL_RGB, IL_UNSIGNED_BYTE);
+            if(!success) {
+                cout << "Error: Unable to convert image " << filePathTex << endl;
+                return false;
+            }
+            glGenTextures(1, &obj.texture);
+            glBindTexture(GL_TEXTURE_2D, obj.texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexImage2D(GL_TEXTURE_2D, 0, ilGetInteger(IL_IMAGE_BPP), ilGetInteger(IL_IMAGE_WIDTH),
+                ilGetInteger(IL_IMAGE_HEIGHT), 0, ilGetInteger(IL_IMAGE_FORMAT), GL_UNSIGNED_BYTE,
+                ilGetData());
+        }
     }
 
     // Get mesh
     obj.numMeshes = scene->mNumMeshes;
     obj.mesh = new Mesh[obj.numMeshes];
 
+    unsigned int oldVertices = 0;
+    unsigned int newVertices = 0;
+    unsigned int newIndices = 0;
+
     for( unsigned int i=0; i<scene->mNumMeshes; i++ ) {
         aiMesh *tmpMesh = scene->mMeshes[i]; //aiMesh temporary to give to struct
-        tmpMesh = scene->mMeshes[i];
-        obj.mesh[i].geometry = new Vertex[tmpMesh->mNumVertices]; //3 vertex for each face
+        obj.mesh[i].geometry = new Vertex[tmpMesh->mNumVertices]; //one per unique vertex
         obj.mesh[i].numVertices = tmpMesh->mNumVertices;
         obj.mesh[i].numFaces = tmpMesh->mNumFaces;
+        obj.mesh[i].numIndices = tmpMesh->mNumFaces * 3;
+        obj.mesh[i].indices = new GLuint[obj.mesh[i].numIndices];
+        obj.mesh[i].hasNormals = tmpMesh->HasNormals();
+
+        for( unsigned int j=0; j<tmpMesh->mNumVertices; j++ ) {
+            //load vertex positions
+            obj.mesh[i].geometry[j].position[0] = tmpMesh->mVertices[j].x;
+            obj.mesh[i].geometry[j].position[1] = tmpMesh->mVertices[j].y;
+            obj.mesh[i].geometry[j].position[2] = tmpMesh->mVertices[j].z;
+            //load vertex uv
+            obj.mesh[i].geometry[j].uv[0] = tmpMesh->mTextureCoords[0][j].x;
+            obj.mesh[i].geometry[j].uv[1] = tmpMesh->mTextureCoords[0][j].y;
+            //load vertex normal
+            if(tmpMesh->HasNormals()) {
+                obj.mesh[i].geometry[j].normal[0] = tmpMesh->mNormals[j].x;
+                obj.mesh[i].geometry[j].normal[1] = tmpMesh->mNormals[j].y;
+                obj.mesh[i].geometry[j].normal[2] = tmpMesh->mNormals[j].z;
+            }
+        }
 
+        //faces stay in the order assimp optimized them for
         for( unsigned int j=0; j<tmpMesh->mNumFaces; j++ ) {
             aiFace &tmpFace = tmpMesh->mFaces[j];
             for( unsigned int k=0; k<3; k++ ) {
-                unsigned int tmpVertex = tmpFace.mIndices[k];
-                //load vertex positions
-                obj.mesh[i].geometry[3*j+k].position[0] = tmpMesh->mVertices[tmpVertex].x;
-                obj.mesh[i].geometry[3*j+k].position[1] = tmpMesh->mVertices[tmpVertex].y;
-                obj.mesh[i].geometry[3*j+k].position[2] = tmpMesh->mVertices[tmpVertex].z;
-                //load vertex uv
-                obj.mesh[i].geometry[3*j+k].uv[0] = tmpMesh->mTextureCoords[0][tmpVertex].x;
-                obj.mesh[i].geometry[3*j+k].uv[1] = tmpMesh->mTextureCoords[0][tmpVertex].y;
-                //load vertex normal
-                obj.mesh[i].hasNormals = tmpMesh->HasNormals();
-                if(tmpMesh->HasNormals()) {
-                    obj.mesh[i].geometry[3*j+k].normal[0] = tmpMesh->mNormals[tmpVertex].x;
-                    obj.mesh[i].geometry[3*j+k].normal[1] = tmpMesh->mNormals[tmpVertex].y;
-                    obj.mesh[i].geometry[3*j+k].normal[2] = tmpMesh->mNormals[tmpVertex].z;
-                    // cout << "<" << obj.mesh[i].geometry[3*j+k].normal[0] << ", " <<
-                    //     obj.mesh[i].geometry[3*j+k].normal[1] << ", " <<
-                    //     obj.mesh[i].geometry[3*j+k].normal[2] << ">" << endl;
-                }
+                obj.mesh[i].indices[3*j+k] = tmpFace.mIndices[k];
             }
         }
+
+        //bounds for picking a level
+        for( int k=0; k<3; k++ ) {
+            obj.mesh[i].boundsMin[k] = obj.mesh[i].numVertices > 0 ? obj.mesh[i].geometry[0].position[k] : 0.0f;
+            obj.mesh[i].boundsMax[k] = obj.mesh[i].boundsMin[k];
+        }
+        for( unsigned int j=1; j<obj.mesh[i].numVertices; j++ ) {
+            for( int k=0; k<3; k++ ) {
+                obj.mesh[i].boundsMin[k] = std::min(obj.mesh[i].boundsMin[k], obj.mesh[i].geometry[j].position[k]);
+                obj.mesh[i].boundsMax[k] = std::max(obj.mesh[i].boundsMax[k], obj.mesh[i].geometry[j].position[k]);
+            }
+        }
+
+        buildLods(obj.mesh[i]);
+
+        oldVertices += obj.mesh[i].numFaces * 3;
+        newVertices += obj.mesh[i].numVertices;
+        newIndices += obj.mesh[i].numIndices;
     }
 
+    cout << filePathOBJ << ": " << oldVertices << " vertices (" << oldVertices * sizeof(Vertex) << " bytes) -> "
+         << newVertices << " vertices + " << newIndices << " indices ("
+         << newVertices * sizeof(Vertex) + newIndices * sizeof(GLuint) << " bytes)" << endl;
+
     //Create Vertex Array Object for each mesh
     for(unsigned int i=0; i<scene->mNumMeshes; i++ ) {
         glGenBuffers(1, &(obj.mesh[i].vbo_geometry));
         glBindBuffer(GL_ARRAY_BUFFER, obj.mesh[i].vbo_geometry);
-        glBufferData(GL_ARRAY_BUFFER, obj.mesh[i].numFaces * 3 * sizeof(Vertex), &(obj.mesh[i].geometry[0]), GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, obj.mesh[i].numVertices * sizeof(Vertex), &(obj.mesh[i].geometry[0]), GL_STATIC_DRAW);
+
+        //every level in one ibo, the coarser ones after the mesh's own
+        glGenBuffers(1, &(obj.mesh[i].ibo_geometry));
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj.mesh[i].ibo_geometry);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, (obj.mesh[i].numIndices + obj.mesh[i].numLodIndices) * sizeof(GLuint), NULL, GL_STATIC_DRAW);
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, obj.mesh[i].numIndices * sizeof(GLuint), &(obj.mesh[i].indices[0]));
+        if(obj.mesh[i].numLodIndices > 0)
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, obj.mesh[i].numIndices * sizeof(GLuint),
+                            obj.mesh[i].numLodIndices * sizeof(GLuint), obj.mesh[i].lodIndices);
     }
 
     return true;
 }    
 
+//decimates the mesh by half per level into lodIndices, stopping once a level
+//would be tiny or decimation stops paying. The vertices are shared by every level
+void buildLods(Mesh &mesh) {
+    mesh.numLods = 1;
+    mesh.lodFirst[0] = 0;
+    mesh.lodCount[0] = mesh.numIndices;
+    mesh.lodIndices = NULL;
+    mesh.numLodIndices = 0;
+    if(mesh.numFaces >> 1 < LOD_MIN_FACES)
+        return;
+
+    //the tolerance is the whole mesh, the face counts are what stop it.
+    //Each corner keeps the vertex whose normal suits its new face, uvs follow along
+    GLfloat size = 0.0;
+    for(int k = 0; k < 3; k++)
+        size = std::max(size, mesh.boundsMax[k] - mesh.boundsMin[k]);
+    int normalOffset = mesh.hasNormals ? (offsetof(Vertex, normal) - offsetof(Vertex, position)) / sizeof(GLfloat) : -1;
+    simplify::Decimator decimator(mesh.geometry[0].position, sizeof(Vertex) / sizeof(GLfloat), mesh.numVertices,
+                                  mesh.indices, mesh.numIndices, normalOffset);
+    std::vector<GLuint> levels, level;
+    unsigned int faces = mesh.numFaces;
+    for(unsigned int i = 1; i < MAX_LODS; i++) {
+        unsigned int target = mesh.numFaces >> i;
+        if(target < LOD_MIN_FACES)
+            break;
+        decimator.run(size, target);
+        if(decimator.faceCount() > faces * 3 / 4)
+            break;
+        faces = decimator.faceCount();
+        decimator.outputIndices(level);
+        mesh.lodFirst[i] = mesh.numIndices + levels.size();
+        mesh.lodCount[i] = level.size();
+        levels.insert(levels.end(), level.begin(), level.end());
+        mesh.numLods++;
+    }
+    if(levels.empty())
+        return;
+    mesh.numLodIndices = levels.size();
+    mesh.lodIndices = new GLuint[levels.size()];
+    std::copy(levels.begin(), levels.end(), mesh.lodIndices);
+}
+
 void menu(int selection){
     //make decision based on menu choice ---------------------
     float x, y, z;
@@ -609,33 +901,29 @@ void menu(int selection){
 
     // toggle ambient
     case 2:
-        if(toggles[0] == 0)
-            toggles[0] = 1;
-        else
-            toggles[0] = 0;
+        toggles[0] = 1 - toggles[0];
+        if(!useShaderVariant(toggleFeatures()))
+            toggles[0] = 1 - toggles[0];//keep the lights that have a program
         break;
     // toggle distant
     case 3:
-        if(toggles[1] == 0)
-            toggles[1] = 1;
-        else
-            toggles[1] = 0;
+        toggles[1] = 1 - toggles[1];
+        if(!useShaderVariant(toggleFeatures()))
+            toggles[1] = 1 - toggles[1];//keep the lights that have a program
         break;
 
     // toggle point
     case 4:
-        if(toggles[2] == 0)
-            toggles[2] = 1;
-        else
-            toggles[2] = 0;
+        toggles[2] = 1 - toggles[2];
+        if(!useShaderVariant(toggleFeatures()))
+            toggles[2] = 1 - toggles[2];//keep the lights that have a program
         break;
 
     //toggle spot
     case 5:
-        if(toggles[3] == 0)
-            toggles[3] = 1;
-        else
-            toggles[3] = 0;
+        toggles[3] = 1 - toggles[3];
+        if(!useShaderVariant(toggleFeatures()))
+            toggles[3] = 1 - toggles[3];//keep the lights that have a program
         break;
 
     //camera: top view
@@ -677,37 +965,43 @@ void menu(int selection){
     case 9:
         exit(0);
         break;
+
+        //full detail everywhere, to compare triangle counts against
+    case 10:
+        lodEnabled = !lodEnabled;
+        break;
     }
 
 
     glutPostRedisplay();
 }
 
-void printText(float x, float y, char* text) {
-    // glUseProgram(0);
-
-    // float r,g,b;
-    // r = 1.;
-    // g = 0.;
-    // b = 0.;
-
-    // glDisable(GL_TEXTURE_2D);
-    // glDisable(GL_LIGHTING);
-
-    // bool blending = false;
-
-    // if(glIsEnabled(GL_BLEND)) 
-    // blending = true;
-
-    // glEnable(GL_BLEND);
-    // glColor3f(r,g,b);
-    // glRasterPos2f(x,y);
+//loads the mip chain texcook left next to an image, false if there isn't one
+//or it is out of date
+bool loadCookedTexture(const char* filePath, GLuint &texture) {
+    DDSImage dds;
+    if(!GLEW_EXT_texture_compression_s3tc || !readCookedDDS(filePath, dds))
+        return false;
 
-    // while (*text) {
-    //     glutBitmapCharacter(GLUT_BITMAP_TIMES_ROMAN_24, *text);
-    //     text++;
-    // }
+    GLenum format = dds.fourCC == DDS_FOURCC_DXT1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+                                                  : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, dds.levels - 1);
+    size_t offset = 0;
+    for(unsigned int i = 0; i < dds.levels; i++) {
+        unsigned int width = ddsLevelDimension(dds.width, i);
+        unsigned int height = ddsLevelDimension(dds.height, i);
+        size_t size = ddsLevelSize(width, height, dds.fourCC);
+        glCompressedTexImage2D(GL_TEXTURE_2D, i, format, width, height, 0, size, &dds.data[offset]);
+        offset += size;
+    }
+    return true;
+}
 
-    // if(!blending) 
-    // glDisable(GL_BLEND);
+void printText(float x, float y, char* text) {
+    //drawn from the glyph atlas, without one the scoreboard stays hidden as before
+    drawText(hudText, x, y, text, windowWidth, windowHeight, 1.0, 0.0, 0.0);
 }
@@ -0,0 +1,309 @@
+#ifndef TEXT_H
+#define TEXT_H
+
+#include <GL/glew.h>
+#include <GL/glut.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//HUD text drawn from a glyph atlas. The atlas is rasterized once from a GLUT
+//bitmap font into a texture. After that every string is a batch of textured
+//quads drawn with one call, and a string that has not changed since the last
+//frame keeps the vertex buffer it already has.
+const int TEXT_ATLAS_WIDTH = 512;
+const int TEXT_CELL_HEIGHT = 32;//pixels, enough for the 24 point fonts
+const int TEXT_BASELINE = 8;//pixels in a cell below the baseline, for descenders
+const int TEXT_PAD = 2;//pixels either side of a glyph, bitmaps can spill past their advance
+const int TEXT_FIRST = 32;//printable ASCII
+const int TEXT_LAST = 126;
+const GLuint TEXT_ATTRIB_POSITION = 0;
+const GLuint TEXT_ATTRIB_UV = 1;
+
+struct Glyph
+{
+    float u0, v0, u1, v1;//its cell in the atlas
+    int width;//cell width in pixels
+    int advance;//pen movement in pixels
+};
+
+//one place on screen, rebuilt when its text or the window size changes
+struct TextString
+{
+    float x, y;//baseline start in normalized device coordinates
+    std::string text;
+    int windowWidth;
+    int windowHeight;
+    GLuint vao;
+    GLuint vbo;
+    GLsizei vertices;
+};
+
+struct TextRenderer
+{
+    bool ready;//false until initText succeeds, callers fall back or draw nothing
+    GLuint atlas;
+    GLuint program;
+    GLint loc_color;
+    Glyph glyphs[TEXT_LAST - TEXT_FIRST + 1];
+    std::vector<TextString> strings;
+};
+
+const char* const TEXT_VERTEX_SHADER =
+    "#version 120\n"
+    "attribute vec2 v_position;\n"
+    "attribute vec2 v_uv;\n"
+    "varying vec2 uv;\n"
+    "void main() {\n"
+    "    uv = v_uv;\n"
+    "    gl_Position = vec4(v_position, -1.0, 1.0);\n"//nearest depth, over everything
+    "}\n";
+
+const char* const TEXT_FRAGMENT_SHADER =
+    "#version 120\n"
+    "uniform sampler2D atlas;\n"
+    "uniform vec4 color;\n"
+    "varying vec2 uv;\n"
+    "void main() {\n"
+    "    gl_FragColor = vec4(color.rgb, color.a * texture2D(atlas, uv).a);\n"
+    "}\n";
+
+inline GLuint compileTextShader(GLenum type, const char* source)
+{
+    GLint status;
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if(!status) {
+        std::cerr << "[F] FAILED TO COMPILE TEXT SHADER!" << std::endl;
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+//rasterizes font into the atlas and builds the text program, needs GL 3.0 for the framebuffer
+inline bool initText(TextRenderer &text, void* font)
+{
+    text.ready = false;
+    if(!GLEW_VERSION_3_0)
+        return false;
+
+    //lay the glyphs out left to right in rows of cells
+    int cellX[TEXT_LAST - TEXT_FIRST + 1];
+    int cellY[TEXT_LAST - TEXT_FIRST + 1];
+    int x = 0, y = 0;
+    for(int c = TEXT_FIRST; c <= TEXT_LAST; c++) {
+        Glyph &glyph = text.glyphs[c - TEXT_FIRST];
+        glyph.advance = glutBitmapWidth(font, c);
+        glyph.width = glyph.advance + 2 * TEXT_PAD;
+        if(x + glyph.width > TEXT_ATLAS_WIDTH) {
+            x = 0;
+            y += TEXT_CELL_HEIGHT;
+        }
+        cellX[c - TEXT_FIRST] = x;
+        cellY[c - TEXT_FIRST] = y;
+        x += glyph.width;
+    }
+    int height = 1;
+    while(height < y + TEXT_CELL_HEIGHT)
+        height *= 2;
+    for(int i = 0; i <= TEXT_LAST - TEXT_FIRST; i++) {
+        Glyph &glyph = text.glyphs[i];
+        glyph.u0 = (float)cellX[i] / TEXT_ATLAS_WIDTH;
+        glyph.v0 = (float)cellY[i] / height;
+        glyph.u1 = (float)(cellX[i] + glyph.width) / TEXT_ATLAS_WIDTH;
+        glyph.v1 = (float)(cellY[i] + TEXT_CELL_HEIGHT) / height;
+    }
+
+    //texels map one to one onto pixels, so no filtering
+    glGenTextures(1, &text.atlas);
+    glBindTexture(GL_TEXTURE_2D, text.atlas);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, TEXT_ATLAS_WIDTH, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    GLuint fbo;
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, text.atlas, 0);
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "[F] TEXT ATLAS FRAMEBUFFER INCOMPLETE" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(1, &fbo);
+        glDeleteTextures(1, &text.atlas);
+        return false;
+    }
+
+    //the only time the bitmap font is drawn, white with coverage in alpha
+    glPushAttrib(GL_ENABLE_BIT | GL_VIEWPORT_BIT | GL_COLOR_BUFFER_BIT | GL_CURRENT_BIT);
+    glUseProgram(0);
+    glViewport(0, 0, TEXT_ATLAS_WIDTH, height);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    glDisable(GL_TEXTURE_2D);
+    glDisable(GL_LIGHTING);
+    glClearColor(0.0, 0.0, 0.0, 0.0);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glColor4f(1.0, 1.0, 1.0, 1.0);
+    for(int c = TEXT_FIRST; c <= TEXT_LAST; c++) {
+        glWindowPos2i(cellX[c - TEXT_FIRST] + TEXT_PAD, cellY[c - TEXT_FIRST] + TEXT_BASELINE);
+        glutBitmapCharacter(font, c);
+    }
+    glPopAttrib();
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+
+    GLuint vertexShader = compileTextShader(GL_VERTEX_SHADER, TEXT_VERTEX_SHADER);
+    GLuint fragmentShader = compileTextShader(GL_FRAGMENT_SHADER, TEXT_FRAGMENT_SHADER);
+    if(vertexShader == 0 || fragmentShader == 0) {
+        glDeleteShader(vertexShader);
+        glDeleteShader(fragmentShader);
+        glDeleteTextures(1, &text.atlas);
+        return false;
+    }
+    GLint status;
+    text.program = glCreateProgram();
+    glAttachShader(text.program, vertexShader);
+    glAttachShader(text.program, fragmentShader);
+    glBindAttribLocation(text.program, TEXT_ATTRIB_POSITION, "v_position");
+    glBindAttribLocation(text.program, TEXT_ATTRIB_UV, "v_uv");
+    glLinkProgram(text.program);
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+    glGetProgramiv(text.program, GL_LINK_STATUS, &status);
+    if(!status) {
+        std::cerr << "[F] THE TEXT PROGRAM FAILED TO LINK" << std::endl;
+        glDeleteProgram(text.program);
+        glDeleteTextures(1, &text.atlas);
+        return false;
+    }
+    text.loc_color = glGetUniformLocation(text.program, "color");
+    GLint program;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+    glUseProgram(text.program);
+    glUniform1i(glGetUniformLocation(text.program, "atlas"), 0);
+    glUseProgram(program);
+
+    text.ready = true;
+    return true;
+}
+
+//two triangles per character, positions in normalized device coordinates
+inline void buildText(const TextRenderer &text, TextString &string)
+{
+    std::vector<GLfloat> vertices;
+    vertices.reserve(string.text.size() * 24);
+    float scaleX = 2.0f / string.windowWidth;
+    float scaleY = 2.0f / string.windowHeight;
+    float pen = string.x;
+    float bottom = string.y - TEXT_BASELINE * scaleY;
+    float top = bottom + TEXT_CELL_HEIGHT * scaleY;
+    for(unsigned int i = 0; i < string.text.size(); i++) {
+        int c = (unsigned char)string.text[i];
+        if(c < TEXT_FIRST || c > TEXT_LAST)
+            continue;
+        const Glyph &glyph = text.glyphs[c - TEXT_FIRST];
+        float left = pen - TEXT_PAD * scaleX;
+        float right = left + glyph.width * scaleX;
+        GLfloat quad[24] = {left,  bottom, glyph.u0, glyph.v0,
+                            right, bottom, glyph.u1, glyph.v0,
+                            right, top,    glyph.u1, glyph.v1,
+                            left,  bottom, glyph.u0, glyph.v0,
+                            right, top,    glyph.u1, glyph.v1,
+                            left,  top,    glyph.u0, glyph.v1};
+        vertices.insert(vertices.end(), quad, quad + 24);
+        pen += glyph.advance * scaleX;
+    }
+    string.vertices = vertices.size() / 4;
+    glBindBuffer(GL_ARRAY_BUFFER, string.vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), vertices.empty() ? NULL : &vertices[0],
+                 GL_DYNAMIC_DRAW);
+}
+
+//draws str with its baseline starting at (x, y), strings are cached by position
+//so a HUD line that has not changed costs one draw call and no uploads
+inline bool drawText(TextRenderer &text, float x, float y, const char* str,
+                     int windowWidth, int windowHeight, float r, float g, float b)
+{
+    if(!text.ready)
+        return false;
+
+    TextString* string = NULL;
+    for(unsigned int i = 0; i < text.strings.size() && string == NULL; i++) {
+        if(text.strings[i].x == x && text.strings[i].y == y)
+            string = &text.strings[i];
+    }
+    if(string == NULL) {
+        TextString added;
+        added.x = x;
+        added.y = y;
+        added.windowWidth = 0;
+        added.windowHeight = 0;
+        added.vertices = 0;
+        glGenVertexArrays(1, &added.vao);
+        glGenBuffers(1, &added.vbo);
+        glBindVertexArray(added.vao);
+        glBindBuffer(GL_ARRAY_BUFFER, added.vbo);
+        glEnableVertexAttribArray(TEXT_ATTRIB_POSITION);
+        glVertexAttribPointer(TEXT_ATTRIB_POSITION, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), 0);
+        glEnableVertexAttribArray(TEXT_ATTRIB_UV);
+        glVertexAttribPointer(TEXT_ATTRIB_UV, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat),
+                              (void*)(2 * sizeof(GLfloat)));
+        glBindVertexArray(0);
+        text.strings.push_back(added);
+        string = &text.strings.back();
+        string->text = str;
+        string->windowWidth = windowWidth;
+        string->windowHeight = windowHeight;
+        buildText(text, *string);
+    }
+    else if(string->text != str || string->windowWidth != windowWidth || string->windowHeight != windowHeight) {
+        string->text = str;
+        string->windowWidth = windowWidth;
+        string->windowHeight = windowHeight;
+        buildText(text, *string);
+    }
+    if(string->vertices == 0)
+        return true;
+
+    //the caller's blending is put back afterwards, whatever it was
+    bool blending = glIsEnabled(GL_BLEND);
+    GLint blendSrcRgb, blendDstRgb, blendSrcAlpha, blendDstAlpha;
+    glGetIntegerv(GL_BLEND_SRC_RGB, &blendSrcRgb);
+    glGetIntegerv(GL_BLEND_DST_RGB, &blendDstRgb);
+    glGetIntegerv(GL_BLEND_SRC_ALPHA, &blendSrcAlpha);
+    glGetIntegerv(GL_BLEND_DST_ALPHA, &blendDstAlpha);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glUseProgram(text.program);
+    glUniform4f(text.loc_color, r, g, b, 1.0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, text.atlas);
+    glBindVertexArray(string->vao);
+    glDrawArrays(GL_TRIANGLES, 0, string->vertices);
+    glBindVertexArray(0);
+    glBlendFuncSeparate(blendSrcRgb, blendDstRgb, blendSrcAlpha, blendDstAlpha);
+    if(!blending)
+        glDisable(GL_BLEND);
+    return true;
+}
+
+inline void freeText(TextRenderer &text)
+{
+    if(!text.ready)
+        return;
+    for(unsigned int i = 0; i < text.strings.size(); i++) {
+        glDeleteVertexArrays(1, &text.strings[i].vao);
+        glDeleteBuffers(1, &text.strings[i].vbo);
+    }
+    text.strings.clear();
+    glDeleteProgram(text.program);
+    glDeleteTextures(1, &text.atlas);
+    text.ready = false;
+}
+
+#endif
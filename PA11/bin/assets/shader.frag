@@ -1,8 +1,112 @@
 #version 130
+#extension GL_ARB_uniform_buffer_object : require
 
+// updated once per frame
+layout(std140) uniform FrameData {
+	mat4 viewMatrix;
+	mat4 projectionMatrix;
+	vec4 RAVEMODE; // (red, green, blue, unused)
+	vec4 clusterScale; // (tiles per pixel across, down, slice scale, slice bias)
+};
+
+// every light this frame, moved into eye space on the CPU
+layout(std140) uniform LightData {
+	vec4 lightPosition[MAX_LIGHTS]; // (x, y, z, radius)
+	vec4 lightColor[MAX_LIGHTS]; // (red, green, blue, unused)
+};
+
+// updated when the object moves or its lights change
+layout(std140) uniform ObjectData {
+	mat4 modelMatrix;
+	ivec4 lightCount; // (count, unused, unused, unused)
+	ivec4 lightIndex[MAX_OBJECT_LIGHTS / 4]; // into LightData, four to an ivec4
+};
+
+// the lighting is picked when the program is built, with some of
+// AMBIENT_LIGHT, DISTANT_LIGHT, POINT_LIGHT or just RAVE defined
 varying vec2 v_UV;
+in vec3 v_eyePosition;
+in vec3 v_eyeNormal;
 uniform sampler2D gSampler;
-in vec3 LightIntensity;
+
+#if defined(POINT_LIGHT) || defined(RAVE)
+// one light from LightData, fading out to nothing at its radius
+vec3 pointLight(int light, vec3 position, vec3 norm, vec3 v) {
+	vec3 toLight = lightPosition[light].xyz - position;
+	float dist = length(toLight);
+	vec3 s = toLight / dist;
+	vec3 r = reflect( -s, norm );
+	float falloff = max(1.0 - dist / lightPosition[light].w, 0.0);
+	float sDotN = max( dot(s,norm), 0.0 );
+	// sign() drops the highlight facing away from the light, instead of a branch
+	float spec = pow( max( dot(r,v), 0.0 ), 0.5 ) * sign(sDotN);
+	return lightColor[light].rgb * (sDotN + spec) * falloff * falloff;
+}
+#endif
+
+#ifdef POINT_LIGHT
+// only the lights the CPU found touching this object
+vec3 pointLights(vec3 position, vec3 norm) {
+	vec3 total = vec3(0.0);
+	vec3 v = normalize(-position);
+	for(int i = 0; i < lightCount.x; i++)
+		total += pointLight(lightIndex[i / 4][i % 4], position, norm, v);
+	return total;
+}
+#endif
+
+#ifdef RAVE
+uniform usampler2D clusterCells; // (first, count) per cluster
+uniform usampler2D clusterIndices; // every cluster's lights, CLUSTER_INDEX_WIDTH to a row
+
+// only the lights the CPU binned into this pixel's cluster
+vec3 clusterLights(vec3 position, vec3 norm) {
+	ivec2 tile = ivec2(gl_FragCoord.xy * clusterScale.xy);
+	int slice = int(clamp(log(-position.z) * clusterScale.z + clusterScale.w, 0.0, float(CLUSTER_SLICES - 1)));
+	uvec2 cell = texelFetch(clusterCells, ivec2(tile.y * CLUSTER_TILES_X + tile.x, slice), 0).xy;
+	vec3 total = vec3(0.0);
+	vec3 v = normalize(-position);
+	for(int i = int(cell.x); i < int(cell.x + cell.y); i++) {
+		int light = int(texelFetch(clusterIndices, ivec2(i % CLUSTER_INDEX_WIDTH, i / CLUSTER_INDEX_WIDTH), 0).x);
+		total += pointLight(light, position, norm, v);
+	}
+	return total;
+}
+#endif
+
+#ifdef DISTANT_LIGHT
+vec3 phongModelDistant(vec3 position, vec3 norm) {
+	vec3 dir = normalize(vec3(-1,0,0));
+	vec3 v = normalize(-position);
+	vec3 r = reflect( -dir, norm );
+	float sDotN = max( dot(dir,norm), 0.0 );
+	// vec3 diffuse = Light.Ld * Material.Kd * sDotN;
+	vec3 diffuse = vec3(0.5,0.5,0.5) * sDotN;
+	// spec = Light.Ls * Material.Ks * pow( max( dot(r,v), 0.0 ), Material.Shininess );
+	vec3 spec = vec3(0.5,0.5,0.5) * pow( max( dot(r,v), 0.0 ), 0.5 ) * sign(sDotN);
+	return diffuse + spec;
+}
+#endif
+
 void main(){
-   gl_FragColor = vec4(LightIntensity, 1.0) * texture2D(gSampler, vec2(v_UV[0], v_UV[1]));
-}
\ No newline at end of file
+	vec3 norm = normalize(v_eyeNormal);
+	vec3 LightIntensity = vec3(0.,0.,0.);
+#ifdef RAVE
+	// rave mode lights with the party colour and its strobes
+	LightIntensity += RAVEMODE.xyz;
+#endif
+#ifdef AMBIENT_LIGHT
+	// vec3 ambient = Light.La * Material.Ka;
+	LightIntensity += vec3(0.5,0.5,0.5);
+#endif
+#ifdef POINT_LIGHT
+	LightIntensity += pointLights(v_eyePosition, norm);
+#endif
+#ifdef RAVE
+	LightIntensity += clusterLights(v_eyePosition, norm);
+#endif
+#ifdef DISTANT_LIGHT
+	LightIntensity += phongModelDistant(v_eyePosition, norm);
+#endif
+	gl_FragColor = vec4(LightIntensity, 1.0) * texture2D(gSampler, vec2(v_UV[0], v_UV[1]));
+}
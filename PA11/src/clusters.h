@@ -0,0 +1,241 @@
+#ifndef CLUSTERS_H
+#define CLUSTERS_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+//the shaders' grid size, it reaches them as #defines
+const int CLUSTER_TILES_X = 16;
+const int CLUSTER_TILES_Y = 9;
+const int CLUSTER_SLICES = 24;
+const int CLUSTER_COUNT = CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES;
+
+//Clustered light culling, plain floats so it runs without GL. The view frustum
+//is cut into screen tiles and depth slices, the slices spaced exponentially so
+//a cluster is about as deep as it is wide at any distance. Every frame each
+//eye-space light is binned into the clusters its sphere touches, going slice
+//by slice, then row by row, then tile by tile, so each step only tests the
+//lights that got through the one before. The tests take four lights at a time
+//with SSE2 where it's there. The fragment shader finds its cluster from its
+//pixel and depth and loops over just those lights.
+class ClusterGrid
+{
+public:
+    ClusterGrid() : simd(true)
+    {
+        setProjection(1.0f, 1.0f, 0.1f, 100.0f);
+    }
+
+    //xScale and yScale are the projection matrix's [0][0] and [1][1]
+    void setProjection(float xScale, float yScale, float nearPlane, float farPlane)
+    {
+        scale[0] = xScale;
+        scale[1] = yScale;
+        for(int s = 0; s <= CLUSTER_SLICES; s++)
+            depths[s] = nearPlane * std::pow(farPlane / nearPlane, (float)s / CLUSTER_SLICES);
+        sliceScale = CLUSTER_SLICES / std::log(farPlane / nearPlane);
+        sliceBias = -sliceScale * std::log(nearPlane);
+    }
+
+    //the slice for an eye-space distance is log(distance) * sliceScale + sliceBias
+    float depthScale() const
+    {
+        return sliceScale;
+    }
+
+    float depthBias() const
+    {
+        return sliceBias;
+    }
+
+    //SSE2 off gives the plain version, for checking and timing against
+    void useSimd(bool enabled)
+    {
+        simd = enabled;
+    }
+
+    //lights holds x, y, z and radius for each light, in eye space
+    void bin(const float* lights, unsigned int numLights)
+    {
+        all.clear();
+        for(unsigned int i = 0; i < numLights; i++)
+            all.push(lights + 4 * i, i);
+        all.pad();
+        cells.assign(2 * CLUSTER_COUNT, 0);
+        indices.clear();
+
+        Box box;
+        for(int s = 0; s < CLUSTER_SLICES; s++) {
+            float nearDepth = depths[s], farDepth = depths[s + 1];
+            box.min[2] = -farDepth;
+            box.max[2] = -nearDepth;
+            for(int k = 0; k < 2; k++) {
+                box.max[k] = farDepth / scale[k];
+                box.min[k] = -box.max[k];
+            }
+            filter(all, box, inSlice);
+            if(inSlice.size() == 0)
+                continue;
+
+            for(int ty = 0; ty < CLUSTER_TILES_Y; ty++) {
+                span(ty, CLUSTER_TILES_Y, nearDepth, farDepth, scale[1], box.min[1], box.max[1]);
+                box.max[0] = farDepth / scale[0];
+                box.min[0] = -box.max[0];
+                filter(inSlice, box, inRow);
+                if(inRow.size() == 0)
+                    continue;
+
+                for(int tx = 0; tx < CLUSTER_TILES_X; tx++) {
+                    span(tx, CLUSTER_TILES_X, nearDepth, farDepth, scale[0], box.min[0], box.max[0]);
+                    unsigned int cell = 2 * ((s * CLUSTER_TILES_Y + ty) * CLUSTER_TILES_X + tx);
+                    cells[cell] = indices.size();
+                    std::vector<unsigned short> &out = indices;
+                    const std::vector<unsigned short> &ids = inRow.id;
+                    overlaps(inRow, box, [&out, &ids](unsigned int i) { out.push_back(ids[i]); });
+                    cells[cell + 1] = indices.size() - cells[cell];
+                }
+            }
+        }
+    }
+
+    //first index and count for each cluster, laid out tile x fastest, then tile y, then slice
+    const std::vector<unsigned int>& clusterCells() const
+    {
+        return cells;
+    }
+
+    //every cluster's lights back to back, as indices into the binned lights
+    const std::vector<unsigned short>& lightIndices() const
+    {
+        return indices;
+    }
+
+private:
+    struct Box
+    {
+        float min[3], max[3];
+    };
+
+    //structure of arrays so four lights load at once, padded with ones that reach nothing
+    struct LightSoa
+    {
+        std::vector<float> x, y, z, r2;
+        std::vector<unsigned short> id;
+
+        void clear()
+        {
+            x.clear();
+            y.clear();
+            z.clear();
+            r2.clear();
+            id.clear();
+        }
+
+        void push(const float* light, unsigned short index)
+        {
+            x.push_back(light[0]);
+            y.push_back(light[1]);
+            z.push_back(light[2]);
+            r2.push_back(light[3] * light[3]);
+            id.push_back(index);
+        }
+
+        void pushFrom(const LightSoa &other, unsigned int i)
+        {
+            x.push_back(other.x[i]);
+            y.push_back(other.y[i]);
+            z.push_back(other.z[i]);
+            r2.push_back(other.r2[i]);
+            id.push_back(other.id[i]);
+        }
+
+        //real lights before the padding
+        unsigned int size() const
+        {
+            return lights;
+        }
+
+        void pad()
+        {
+            lights = id.size();
+            float nothing[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+            while(id.size() % 4 != 0) {
+                push(nothing, 0);
+                r2.back() = -1.0f;//no distance is under it
+            }
+        }
+
+        unsigned int lights;
+    };
+
+    //eye-space range of tile i of n between two depths
+    static void span(int i, int n, float nearDepth, float farDepth, float scale, float &lo, float &hi)
+    {
+        float a = -1.0f + 2.0f * i / n, b = -1.0f + 2.0f * (i + 1) / n;
+        lo = std::min(a * nearDepth, a * farDepth) / scale;
+        hi = std::max(b * nearDepth, b * farDepth) / scale;
+    }
+
+    void filter(const LightSoa &in, const Box &box, LightSoa &out)
+    {
+        out.clear();
+        overlaps(in, box, [&out, &in](unsigned int i) { out.pushFrom(in, i); });
+        out.pad();
+    }
+
+    //calls hit(i) for each light in lights whose sphere reaches the box
+    template<class Hit>
+    void overlaps(const LightSoa &lights, const Box &box, Hit hit) const
+    {
+        unsigned int padded = lights.id.size();
+#ifdef __SSE2__
+        if(simd) {
+            __m128 zero = _mm_setzero_ps();
+            __m128 lo[3], hi[3];
+            for(int k = 0; k < 3; k++) {
+                lo[k] = _mm_set1_ps(box.min[k]);
+                hi[k] = _mm_set1_ps(box.max[k]);
+            }
+            const std::vector<float>* axes[3] = {&lights.x, &lights.y, &lights.z};
+            for(unsigned int i = 0; i < padded; i += 4) {
+                __m128 d2 = zero;
+                for(int k = 0; k < 3; k++) {
+                    __m128 p = _mm_loadu_ps(&(*axes[k])[i]);
+                    __m128 d = _mm_max_ps(_mm_max_ps(_mm_sub_ps(lo[k], p), _mm_sub_ps(p, hi[k])), zero);
+                    d2 = _mm_add_ps(d2, _mm_mul_ps(d, d));
+                }
+                int mask = _mm_movemask_ps(_mm_cmplt_ps(d2, _mm_loadu_ps(&lights.r2[i])));
+                for(int k = 0; mask != 0; k++, mask >>= 1) {
+                    if(mask & 1)
+                        hit(i + k);
+                }
+            }
+            return;
+        }
+#endif
+        for(unsigned int i = 0; i < padded; i++) {
+            float p[3] = {lights.x[i], lights.y[i], lights.z[i]};
+            float d2 = 0.0f;
+            for(int k = 0; k < 3; k++) {
+                float d = std::max(std::max(box.min[k] - p[k], p[k] - box.max[k]), 0.0f);
+                d2 += d * d;
+            }
+            if(d2 < lights.r2[i])
+                hit(i);
+        }
+    }
+
+    bool simd;
+    float scale[2];
+    float depths[CLUSTER_SLICES + 1];//slice boundaries, eye-space distance
+    float sliceScale, sliceBias;
+    LightSoa all, inSlice, inRow;
+    std::vector<unsigned int> cells;
+    std::vector<unsigned short> indices;
+};
+
+#endif
@@ -0,0 +1,237 @@
+#ifndef DECOMPOSE_H
+#define DECOMPOSE_H
+
+#include <vector>
+#include <map>
+#include <cmath>
+#include <algorithm>
+
+//Convex decomposition for extruded meshes like the mazes, plain floats so it
+//can be checked without Bullet. Every face of such a mesh is either flat (a
+//floor, a wall top, an underside) or vertical. Each upward facing triangle is
+//extruded down to the face directly beneath it, and neighbouring triangles
+//with the same top and bottom are merged while the outline stays convex. The
+//result is a set of convex prisms that fill the mesh exactly. Meshes with
+//sloped faces can't be cut this way and are left alone.
+struct ConvexPrism
+{
+    std::vector<float> outline;//x, z pairs, counter-clockwise seen from above
+    float bottom;
+    float top;
+};
+
+namespace decompose
+{
+    struct Point
+    {
+        float x, z;
+    };
+
+    //twice the signed area of abc seen from above, positive turning counter-clockwise
+    inline float turn(const Point &a, const Point &b, const Point &c)
+    {
+        return (b.z - a.z) * (c.x - a.x) - (b.x - a.x) * (c.z - a.z);
+    }
+
+    inline bool contains(const Point* tri, const Point &p, float eps)
+    {
+        float a = turn(tri[0], tri[1], p);
+        float b = turn(tri[1], tri[2], p);
+        float c = turn(tri[2], tri[0], p);
+        return (a >= -eps && b >= -eps && c >= -eps) || (a <= eps && b <= eps && c <= eps);
+    }
+
+    //drops vertices that don't turn, false if the polygon turns clockwise anywhere
+    //eps is an area, turn() is one
+    inline bool convexOutline(const std::vector<int> &polygon, const std::vector<Point> &points,
+                              float eps, std::vector<int> &out)
+    {
+        out.clear();
+        unsigned int n = polygon.size();
+        for(unsigned int i = 0; i < n; i++) {
+            float t = turn(points[polygon[(i + n - 1) % n]], points[polygon[i]], points[polygon[(i + 1) % n]]);
+            if(t < -eps)
+                return false;
+            if(t > eps)
+                out.push_back(polygon[i]);
+        }
+        return out.size() >= 3;
+    }
+}
+
+//triangles holds 9 floats per triangle, false if the mesh isn't an extrusion
+inline bool decomposePrisms(const std::vector<float> &triangles, std::vector<ConvexPrism> &prisms)
+{
+    using namespace decompose;
+    unsigned int numTriangles = triangles.size() / 9;
+    if(numTriangles == 0)
+        return false;
+
+    //tolerances scale with the mesh
+    float lo[3], hi[3];
+    for(int k = 0; k < 3; k++)
+        lo[k] = hi[k] = triangles[k];
+    for(unsigned int i = 0; i < triangles.size(); i++) {
+        lo[i % 3] = std::min(lo[i % 3], triangles[i]);
+        hi[i % 3] = std::max(hi[i % 3], triangles[i]);
+    }
+    float size = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2]));
+    if(size <= 0.0f)
+        return false;
+    float eps = 1e-5f * size;
+    float areaEps = eps * size;
+
+    //welded outline vertices, the same corner of two triangles gets one id
+    std::vector<Point> points;
+    std::map< std::pair<long, long>, int > weld;
+    std::vector<int> tops;//triangle index
+    std::vector<int> bottoms;
+    std::vector<int> corners(3 * numTriangles);
+    for(unsigned int i = 0; i < numTriangles; i++) {
+        const float* v = &triangles[9 * i];
+        float ux = v[3] - v[0], uy = v[4] - v[1], uz = v[5] - v[2];
+        float wx = v[6] - v[0], wy = v[7] - v[1], wz = v[8] - v[2];
+        float nx = uy * wz - uz * wy, ny = uz * wx - ux * wz, nz = ux * wy - uy * wx;
+        float length = std::sqrt(nx*nx + ny*ny + nz*nz);
+        if(length <= areaEps)
+            continue;//degenerate, contributes nothing
+        ny /= length;
+        if(ny > 0.999f)
+            tops.push_back(i);
+        else if(ny < -0.999f)
+            bottoms.push_back(i);
+        else if(std::fabs(ny) > 0.001f)
+            return false;//sloped
+        for(int c = 0; c < 3; c++) {
+            std::pair<long, long> key(std::lround(v[3*c] / eps / 8.0f), std::lround(v[3*c+2] / eps / 8.0f));
+            std::map< std::pair<long, long>, int >::iterator it = weld.find(key);
+            if(it == weld.end()) {
+                Point p = {v[3*c], v[3*c+2]};
+                it = weld.insert(std::make_pair(key, (int)points.size())).first;
+                points.push_back(p);
+            }
+            corners[3*i + c] = it->second;
+        }
+    }
+    if(tops.empty())
+        return false;
+
+    //each top reaches down to the nearest underside below its middle
+    std::map< std::pair<float, float>, std::vector< std::vector<int> > > slabs;//(top, bottom) -> outlines
+    for(unsigned int t = 0; t < tops.size(); t++) {
+        const float* v = &triangles[9 * tops[t]];
+        float top = (v[1] + v[4] + v[7]) / 3.0f;
+        Point middle = {(v[0] + v[3] + v[6]) / 3.0f, (v[2] + v[5] + v[8]) / 3.0f};
+        bool found = false;
+        float bottom = 0.0f;
+        for(unsigned int b = 0; b < bottoms.size(); b++) {
+            const float* u = &triangles[9 * bottoms[b]];
+            float y = (u[1] + u[4] + u[7]) / 3.0f;
+            if(y >= top - eps || (found && y <= bottom))
+                continue;
+            Point tri[3] = {{u[0], u[2]}, {u[3], u[5]}, {u[6], u[8]}};
+            if(contains(tri, middle, areaEps)) {
+                bottom = y;
+                found = true;
+            }
+        }
+        if(!found)
+            return false;//open underneath, there is no solid to fill
+
+        std::vector<int> outline(corners.begin() + 3 * tops[t], corners.begin() + 3 * tops[t] + 3);
+        if(turn(points[outline[0]], points[outline[1]], points[outline[2]]) < 0.0f)
+            std::swap(outline[1], outline[2]);
+        //heights snap like the outline vertices so a slab's triangles group together
+        float snap = 8.0f * eps;
+        slabs[std::make_pair(std::floor(top / snap + 0.5f) * snap, std::floor(bottom / snap + 0.5f) * snap)].push_back(outline);
+    }
+
+    //merge across shared edges while the result stays convex
+    std::map< std::pair<float, float>, std::vector< std::vector<int> > >::iterator slab;
+    for(slab = slabs.begin(); slab != slabs.end(); slab++) {
+        std::vector< std::vector<int> > &polygons = slab->second;
+        bool merged = true;
+        while(merged) {
+            merged = false;
+            std::map< std::pair<int, int>, int > edges;//directed edge -> polygon
+            for(unsigned int p = 0; p < polygons.size(); p++) {
+                for(unsigned int i = 0; i < polygons[p].size(); i++)
+                    edges[std::make_pair(polygons[p][i], polygons[p][(i + 1) % polygons[p].size()])] = p;
+            }
+            std::vector<bool> used(polygons.size(), false);
+            std::vector< std::vector<int> > next;
+            std::vector<int> joined, outline;
+            for(unsigned int p = 0; p < polygons.size(); p++) {
+                if(used[p])
+                    continue;
+                std::vector<int> &a = polygons[p];
+                for(unsigned int i = 0; i < a.size() && !used[p]; i++) {
+                    int from = a[i], to = a[(i + 1) % a.size()];
+                    std::map< std::pair<int, int>, int >::iterator other = edges.find(std::make_pair(to, from));
+                    if(other == edges.end() || used[other->second] || other->second == (int)p)
+                        continue;
+                    //a from `to` round to `from`, then b's vertices between them
+                    std::vector<int> &b = polygons[other->second];
+                    joined.clear();
+                    for(unsigned int k = 0; k < a.size(); k++)
+                        joined.push_back(a[(i + 1 + k) % a.size()]);
+                    unsigned int j = std::find(b.begin(), b.end(), from) - b.begin();
+                    for(unsigned int k = 0; k + 2 < b.size(); k++)
+                        joined.push_back(b[(j + 1 + k) % b.size()]);
+                    if(!convexOutline(joined, points, areaEps, outline))
+                        continue;
+                    used[p] = used[other->second] = true;
+                    next.push_back(outline);
+                    merged = true;
+                }
+                if(!used[p]) {
+                    used[p] = true;
+                    next.push_back(a);
+                }
+            }
+            polygons.swap(next);
+        }
+
+        for(unsigned int p = 0; p < polygons.size(); p++) {
+            ConvexPrism prism;
+            prism.top = slab->first.first;
+            prism.bottom = slab->first.second;
+            for(unsigned int i = 0; i < polygons[p].size(); i++) {
+                prism.outline.push_back(points[polygons[p][i]].x);
+                prism.outline.push_back(points[polygons[p][i]].z);
+            }
+            prisms.push_back(prism);
+        }
+    }
+    return true;
+}
+
+//true for a rectangle lined up with the axes, which is cheaper to collide with as a box
+inline bool prismIsBox(const ConvexPrism &prism, float* center, float* halfExtents)
+{
+    if(prism.outline.size() != 8)
+        return false;
+    float x0 = prism.outline[0], x1 = x0, z0 = prism.outline[1], z1 = z0;
+    for(unsigned int i = 2; i < 8; i += 2) {
+        x0 = std::min(x0, prism.outline[i]);
+        x1 = std::max(x1, prism.outline[i]);
+        z0 = std::min(z0, prism.outline[i+1]);
+        z1 = std::max(z1, prism.outline[i+1]);
+    }
+    float eps = 1e-4f * std::max(x1 - x0, z1 - z0);
+    for(unsigned int i = 0; i < 8; i += 2) {
+        bool onX = std::fabs(prism.outline[i] - x0) < eps || std::fabs(prism.outline[i] - x1) < eps;
+        bool onZ = std::fabs(prism.outline[i+1] - z0) < eps || std::fabs(prism.outline[i+1] - z1) < eps;
+        if(!onX || !onZ)
+            return false;
+    }
+    center[0] = 0.5f * (x0 + x1);
+    center[1] = 0.5f * (prism.bottom + prism.top);
+    center[2] = 0.5f * (z0 + z1);
+    halfExtents[0] = 0.5f * (x1 - x0);
+    halfExtents[1] = 0.5f * (prism.top - prism.bottom);
+    halfExtents[2] = 0.5f * (z1 - z0);
+    return true;
+}
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef FRAMEPACER_H
+#define FRAMEPACER_H
+
+#include <chrono>
+#include <thread>
+#include <ctime>
+
+//Decides when the next frame should run, in place of running update() from
+//glutIdleFunc as fast as the CPU allows. The caller waits delayMs() in a GLUT
+//timer, which sleeps in the event loop, then calls waitForFrame() to yield away
+//the last part of a millisecond the timer cannot resolve. Frames where nothing
+//changed drop to the idle rate.
+//
+//With vsync on, glutSwapBuffers already blocks until the display is ready. The
+//deadline is counted from the last one rather than from when the frame ended,
+//so time spent in the swap comes out of the wait instead of being added to it.
+//A deadline that is already a whole frame late is dropped rather than caught up.
+class FramePacer
+{
+public:
+    typedef std::chrono::high_resolution_clock Clock;
+
+    FramePacer(float rate, float idleRate)
+    {
+        setRate(rate, idleRate);
+        deadline = Clock::now();
+        active = true;
+        sampleStart = deadline;
+        sampleCpu = std::clock();
+        startTime = deadline;
+        startCpu = sampleCpu;
+        utilisation = 0.0;
+        frames = 0;
+        framesPerSecond = 0.0;
+    }
+
+    //frames per second to aim for while things change, and while they don't
+    void setRate(float rate, float idleRate)
+    {
+        interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / rate));
+        idleInterval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / idleRate));
+    }
+
+    //whole milliseconds until the next frame, rounded down so the timer fires early
+    unsigned int delayMs() const
+    {
+        Clock::duration remaining = deadline - Clock::now();
+        if(remaining <= Clock::duration::zero())
+            return 0;
+        return std::chrono::duration_cast<std::chrono::milliseconds>(remaining).count();
+    }
+
+    //gives the CPU away until the deadline, the timer got us to within a millisecond
+    void waitForFrame()
+    {
+        while(Clock::now() < deadline)
+            std::this_thread::yield();
+    }
+
+    //call once a frame, changed says whether anything on screen moved
+    void frameDone(bool changed)
+    {
+        Clock::time_point now = Clock::now();
+        active = changed;
+        deadline += changed ? interval : idleInterval;
+        if(now - deadline > interval)
+            deadline = now;
+        frames++;
+
+        //utilisation is process CPU time over wall time, refreshed every second
+        std::chrono::duration<double> elapsed = now - sampleStart;
+        if(elapsed.count() >= 1.0) {
+            std::clock_t cpu = std::clock();
+            utilisation = (double)(cpu - sampleCpu) / CLOCKS_PER_SEC / elapsed.count();
+            framesPerSecond = frames / elapsed.count();
+            sampleStart = now;
+            sampleCpu = cpu;
+            frames = 0;
+        }
+    }
+
+    //run the next frame straight away, for input arriving while idle
+    void wake()
+    {
+        Clock::time_point now = Clock::now();
+        if(deadline > now)
+            deadline = now;
+        active = true;
+    }
+
+    bool isActive() const
+    {
+        return active;
+    }
+
+    //over the last second, 1.0 is one core kept busy
+    double cpuUtilisation() const
+    {
+        return utilisation;
+    }
+
+    double frameRate() const
+    {
+        return framesPerSecond;
+    }
+
+    //since the pacer was made
+    double averageUtilisation() const
+    {
+        std::chrono::duration<double> elapsed = Clock::now() - startTime;
+        if(elapsed.count() <= 0.0)
+            return 0.0;
+        return (double)(std::clock() - startCpu) / CLOCKS_PER_SEC / elapsed.count();
+    }
+
+private:
+    Clock::duration interval;
+    Clock::duration idleInterval;
+    Clock::time_point deadline;//when the next frame should start
+    bool active;
+    Clock::time_point sampleStart;
+    std::clock_t sampleCpu;
+    Clock::time_point startTime;
+    std::clock_t startCpu;
+    double utilisation;
+    int frames;
+    double framesPerSecond;
+};
+
+#endif
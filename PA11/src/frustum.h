@@ -0,0 +1,122 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <cmath>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+//View frustum culling, plain floats so it can be checked without a GL context.
+//Matrices are column-major 4x4, the layout glm::value_ptr and bullet's
+//getOpenGLMatrix both hand out.
+enum CullResult
+{
+    CULL_OUTSIDE,//nothing of the box can be seen
+    CULL_INTERSECT,//partly on screen
+    CULL_INSIDE//all of it on screen
+};
+
+//the six planes stored a component per array so four test at once,
+//padded to eight with planes every point is in front of
+const int FRUSTUM_PLANES = 6;
+const int FRUSTUM_LANES = 8;
+
+struct Frustum
+{
+    float nx[FRUSTUM_LANES];
+    float ny[FRUSTUM_LANES];
+    float nz[FRUSTUM_LANES];
+    float d[FRUSTUM_LANES];//n.p + d >= 0 is in front of the plane
+};
+
+//pulls the planes out of a projection * view matrix, normals point inward
+inline void extractFrustum(const float* m, Frustum &frustum)
+{
+    //left, right, bottom, top, near, far are row 3 plus or minus rows 0, 1, 2
+    for(int i = 0; i < FRUSTUM_PLANES; i++) {
+        int row = i / 2;
+        float sign = (i % 2 == 0) ? 1.0f : -1.0f;
+        float a = m[3] + sign * m[row];
+        float b = m[7] + sign * m[4 + row];
+        float c = m[11] + sign * m[8 + row];
+        float w = m[15] + sign * m[12 + row];
+        float length = std::sqrt(a*a + b*b + c*c);
+        if(length > 0.0f) {
+            a /= length;
+            b /= length;
+            c /= length;
+            w /= length;
+        }
+        frustum.nx[i] = a;
+        frustum.ny[i] = b;
+        frustum.nz[i] = c;
+        frustum.d[i] = w;
+    }
+    for(int i = FRUSTUM_PLANES; i < FRUSTUM_LANES; i++) {
+        frustum.nx[i] = frustum.ny[i] = frustum.nz[i] = 0.0f;
+        frustum.d[i] = 1.0f;
+    }
+}
+
+//tests a box against every plane using its center and half extents
+inline CullResult cullAabb(const Frustum &frustum, const float* boxMin, const float* boxMax)
+{
+    float cx = 0.5f * (boxMin[0] + boxMax[0]);
+    float cy = 0.5f * (boxMin[1] + boxMax[1]);
+    float cz = 0.5f * (boxMin[2] + boxMax[2]);
+    float ex = 0.5f * (boxMax[0] - boxMin[0]);
+    float ey = 0.5f * (boxMax[1] - boxMin[1]);
+    float ez = 0.5f * (boxMax[2] - boxMin[2]);
+
+#ifdef __SSE__
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    __m128 centerX = _mm_set1_ps(cx), centerY = _mm_set1_ps(cy), centerZ = _mm_set1_ps(cz);
+    __m128 extentX = _mm_set1_ps(ex), extentY = _mm_set1_ps(ey), extentZ = _mm_set1_ps(ez);
+    int outside = 0;
+    int straddling = 0;
+    for(int i = 0; i < FRUSTUM_LANES; i += 4) {
+        __m128 nx = _mm_loadu_ps(frustum.nx + i);
+        __m128 ny = _mm_loadu_ps(frustum.ny + i);
+        __m128 nz = _mm_loadu_ps(frustum.nz + i);
+        //signed distance of the center and how far the box reaches along the normal
+        __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, centerX), _mm_mul_ps(ny, centerY)),
+                                     _mm_add_ps(_mm_mul_ps(nz, centerZ), _mm_loadu_ps(frustum.d + i)));
+        __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask, nx), extentX),
+                                              _mm_mul_ps(_mm_andnot_ps(signMask, ny), extentY)),
+                                   _mm_mul_ps(_mm_andnot_ps(signMask, nz), extentZ));
+        outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+        straddling |= _mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(distance, radius), _mm_setzero_ps()));
+    }
+    if(outside)
+        return CULL_OUTSIDE;
+    return straddling ? CULL_INTERSECT : CULL_INSIDE;
+#else
+    CullResult result = CULL_INSIDE;
+    for(int i = 0; i < FRUSTUM_PLANES; i++) {
+        float distance = frustum.nx[i]*cx + frustum.ny[i]*cy + frustum.nz[i]*cz + frustum.d[i];
+        float radius = std::fabs(frustum.nx[i])*ex + std::fabs(frustum.ny[i])*ey + std::fabs(frustum.nz[i])*ez;
+        if(distance + radius < 0.0f)
+            return CULL_OUTSIDE;
+        if(distance - radius < 0.0f)
+            result = CULL_INTERSECT;
+    }
+    return result;
+#endif
+}
+
+//the world-space box around a transformed local box (Arvo's method)
+inline void transformAabb(const float* m, const float* localMin, const float* localMax,
+                          float* worldMin, float* worldMax)
+{
+    for(int i = 0; i < 3; i++) {
+        worldMin[i] = worldMax[i] = m[12 + i];
+        for(int j = 0; j < 3; j++) {
+            float a = m[4*j + i] * localMin[j];
+            float b = m[4*j + i] * localMax[j];
+            worldMin[i] += a < b ? a : b;
+            worldMax[i] += a < b ? b : a;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+//the shaders' array sizes, shader.vert and shader.frag have to agree
+const unsigned int MAX_LIGHTS = 512;//in the LightData block, which then fills the 16KB every driver takes
+const unsigned int MAX_OBJECT_LIGHTS = 8;//lit per object, in its ObjectData block
+
+//A point light in world space. It fades to nothing at radius, so an object
+//further away than that can leave it out
+struct PointLight
+{
+    float position[3];
+    float radius;
+    float color[3];
+};
+
+//squared distance from p to the box, 0 inside it
+inline float boxDistance2(const float* p, const float* boxMin, const float* boxMax)
+{
+    float d2 = 0.0f;
+    for(int k = 0; k < 3; k++) {
+        float d = std::max(std::max(boxMin[k] - p[k], p[k] - boxMax[k]), 0.0f);
+        d2 += d * d;
+    }
+    return d2;
+}
+
+//Picks the lights that reach the box into out, as indices into lights, and
+//returns how many. With more than MAX_OBJECT_LIGHTS reaching it the brightest
+//at the box's nearest point are kept, so the ones dropped matter least
+inline unsigned int selectLights(const std::vector<PointLight> &lights, const float* boxMin, const float* boxMax, int* out)
+{
+    float scores[MAX_OBJECT_LIGHTS];
+    unsigned int count = 0;
+    unsigned int numLights = std::min((unsigned int)lights.size(), MAX_LIGHTS);
+    for(unsigned int i = 0; i < numLights; i++) {
+        const PointLight &light = lights[i];
+        float d2 = boxDistance2(light.position, boxMin, boxMax);
+        if(d2 >= light.radius * light.radius)
+            continue;
+        //the shader's falloff at that distance times the brightest channel
+        float falloff = 1.0f - std::sqrt(d2) / light.radius;
+        float score = falloff * falloff * std::max(light.color[0], std::max(light.color[1], light.color[2]));
+        if(count == MAX_OBJECT_LIGHTS && score <= scores[count - 1])
+            continue;
+
+        //insertion into the list kept brightest first
+        unsigned int slot = count < MAX_OBJECT_LIGHTS ? count++ : count - 1;
+        while(slot > 0 && scores[slot - 1] < score) {
+            scores[slot] = scores[slot - 1];
+            out[slot] = out[slot - 1];
+            slot--;
+        }
+        scores[slot] = score;
+        out[slot] = i;
+    }
+    return count;
+}
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef LOCKFREE_H
+#define LOCKFREE_H
+
+#include <atomic>
+
+//Hands whole values from one writer thread to one reader thread without either
+//waiting. The writer fills the back slot and swaps it with the middle one.
+//The reader swaps the middle slot for its front slot only when something new
+//has been published. Each side keeps its slot to itself until it swaps again.
+template<class T>
+class TripleBuffer
+{
+public:
+    TripleBuffer()
+    {
+        front = 0;
+        middle.store(1);
+        back = 2;
+    }
+
+    //writer only, the slot to fill for the next publish()
+    T& writeBuffer()
+    {
+        return slots[back];
+    }
+
+    //writer only, makes the back slot the newest one
+    void publish()
+    {
+        back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    //reader only, moves to the newest published slot, false if there was none
+    bool update()
+    {
+        if(!(middle.load(std::memory_order_relaxed) & FRESH))
+            return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+    //reader only, stays valid until the next update()
+    const T& readBuffer() const
+    {
+        return slots[front];
+    }
+
+private:
+    static const int INDEX = 3;
+    static const int FRESH = 4;//set on middle when the writer put it there
+
+    T slots[3];
+    int front;//the reader's
+    std::atomic<int> middle;//slot index plus FRESH
+    int back;//the writer's
+};
+
+//Fixed size ring from one producer thread to one consumer thread. Size must be
+//a power of two. push() fails instead of waiting when the ring is full.
+template<class T, unsigned int Size>
+class SpscQueue
+{
+public:
+    SpscQueue()
+    {
+        head.store(0);
+        tail.store(0);
+    }
+
+    //producer only
+    bool push(const T &item)
+    {
+        unsigned int h = head.load(std::memory_order_relaxed);
+        if(h - tail.load(std::memory_order_acquire) == Size)
+            return false;
+        items[h & (Size - 1)] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    //consumer only
+    bool pop(T &item)
+    {
+        unsigned int t = tail.load(std::memory_order_relaxed);
+        if(t == head.load(std::memory_order_acquire))
+            return false;
+        item = items[t & (Size - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    //consumer only, true until something is pushed
+    bool empty() const
+    {
+        return tail.load(std::memory_order_relaxed) == head.load(std::memory_order_acquire);
+    }
+
+private:
+    T items[Size];
+    std::atomic<unsigned int> head;//next slot to write
+    std::atomic<unsigned int> tail;//next slot to read
+};
+
+#endif
@@ -4,8 +4,13 @@
 #include <chrono>
 #include <fstream>
 #include <vector>
+#include <map>
 #include <ctime>
 #include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -20,7 +25,36 @@
 
 #include "bullet/btBulletCollisionCommon.h"
 #include "bullet/btBulletDynamicsCommon.h"
+#include "bullet/BulletCollision/CollisionDispatch/btCollisionDispatcherMt.h"
+#include "bullet/BulletDynamics/Dynamics/btDiscreteDynamicsWorldMt.h"
+#include "bullet/BulletDynamics/ConstraintSolver/btSequentialImpulseConstraintSolverMt.h"
 #include <time.h>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <GL/glxew.h>
+#endif
+
+#include "taskgraph.h"
+#include "dds.h"
+#include "frustum.h"
+#include "text.h"
+#include "framepacer.h"
+#include "lockfree.h"
+#include "jobsystem.h"
+#include "decompose.h"
+#include "simplify.h"
+#include "lights.h"
+#include "clusters.h"
 
 using namespace std;
 
@@ -34,16 +68,108 @@ struct Vertex
     GLfloat normal[3];
 };
 
+//levels of detail a mesh can have, counting itself
+const unsigned int MAX_LODS = 4;
+
 //Mesh will hold the geometry of each mesh loaded
 struct Mesh
 {
     Vertex* geometry;
     unsigned int numFaces;
     unsigned int numVertices;
+    GLuint* indices;//3 per face, into geometry
+    unsigned int numIndices;
     GLuint vbo_geometry;
+    GLuint ibo_geometry;
+    GLuint vao;//vertex layout and both buffers, bound once per draw
     GLuint texture;
     GLuint _texture;
     bool hasNormals;
+    GLfloat boundsMin[3];//model-space box around the vertices
+    GLfloat boundsMax[3];
+    GLuint* lodIndices;//the coarser levels, after indices in the ibo
+    unsigned int numLodIndices;
+    unsigned int numLods;//1 is just the mesh itself
+    GLuint lodFirst[MAX_LODS];//where each level starts in the ibo, in indices
+    GLsizei lodCount[MAX_LODS];
+};
+
+//Binary mesh cache, "<obj>.mesh" holds this header, one entry per mesh,
+//then each mesh's vertices, indices and LOD indices, then the collision triangles
+const unsigned int MESH_CACHE_MAGIC = 0x4853454d;//"MESH"
+const unsigned int MESH_CACHE_VERSION = 2;
+const unsigned long long FNV_OFFSET = 14695981039346656037ULL;
+
+struct MeshCacheHeader
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned long long sourceSize;//size of the .obj it came from
+    long long sourceMtime;//modification time of the .obj
+    unsigned long long sourceHash;//FNV-1a of the .obj bytes
+    unsigned int numMeshes;
+    unsigned int vertexSize;//sizeof(Vertex), catches layout changes
+    float physicsTolerance;//what the collision triangles were simplified with
+    unsigned int numPhysicsTriangles;//9 floats each
+};
+
+//Serialized collision BVHs, "<hash>.bvh" in BVH_CACHE_DIR holds this header
+//then btOptimizedBvh::serializeInPlace's buffer
+const char* BVH_CACHE_DIR = "../bin/assets/bvh";
+const unsigned int BVH_CACHE_MAGIC = 0x00485642;//"BVH"
+const unsigned int BVH_CACHE_VERSION = 1;
+
+struct BvhCacheHeader
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned int bulletVersion;//the in-place layout is bullet's own
+    unsigned int pointerSize;
+    unsigned int scalarSize;
+    unsigned int numTriangles;
+    unsigned long long meshHash;//FNV-1a of the triangles the BVH was built over
+    unsigned int bufferSize;
+    float buildMs;//what it took to build, for the startup report
+};
+
+//Linked shader programs, "<hash>.bin" in PROGRAM_CACHE_DIR holds this header
+//then glGetProgramBinary's bytes. The hash covers the sources and the driver
+const char* PROGRAM_CACHE_DIR = "../bin/assets/programs";
+const unsigned int PROGRAM_CACHE_MAGIC = 0x47525050;//"PPRG"
+const unsigned int PROGRAM_CACHE_VERSION = 1;
+
+struct ProgramCacheHeader
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned long long sourceHash;
+    unsigned int format;//binaryFormat glGetProgramBinary gave
+    unsigned int length;
+};
+
+struct MeshCacheEntry
+{
+    unsigned int numVertices;
+    unsigned int numIndices;
+    unsigned int hasNormals;
+    unsigned int numLods;
+    unsigned int numLodIndices;
+    unsigned int lodFirst[MAX_LODS];
+    unsigned int lodCount[MAX_LODS];
+};
+
+//how a mesh becomes a collision shape
+enum CollisionMode
+{
+    COLLISION_TRIANGLES,//every render triangle in a BVH
+    COLLISION_CONVEX//convex pieces under a compound shape
+};
+
+//the lights an object is lit by, as written to its ObjectData block
+struct LightList
+{
+    unsigned int count;
+    int lights[MAX_OBJECT_LIGHTS];//indices into this frame's lights
 };
 
 //Objects can hold one or more meshes
@@ -51,11 +177,81 @@ struct Object
 {
     Mesh* mesh;
     glm::mat4 modelMatrix;
+    GLuint ubo;//ObjectData block holding modelMatrix
+    bool modelDirty;//modelMatrix changed since the ubo was last written
     unsigned int numMeshes;
     btRigidBody *rigidBody;
+    btTransform prevTransform;//body transform before the last physics step, for interpolation
+    btTransform currTransform;//and after it, both from the physics thread's snapshot
     btTriangleMesh *btMesh;
     GLuint texture;
     GLuint _texture;
+    //resources this object holds a reference to
+    unsigned long long meshKey;
+    unsigned long long textureKey;
+    unsigned long long _textureKey;
+    unsigned long long shapeKey;
+    CollisionMode collision;//what acquireMeshShape builds
+    btQuaternion tilt;//last rotation given to a kinematic board, physics thread only
+    btDbvtNode* cullNode;//world-space box in cullTree
+    bool visible;//survived the last cullScene()
+    unsigned int lod;//level drawn last frame, switching goes by it
+    LightList lit;
+};
+
+//--Shared resources, keyed by a hash of their contents so duplicates load once
+enum ResourceType
+{
+    RESOURCE_MESH,//Mesh array with its VBOs and the btTriangleMesh
+    RESOURCE_TEXTURE,
+    RESOURCE_SHAPE//btCollisionShape
+};
+
+struct Resource
+{
+    ResourceType type;
+    int refCount;
+    size_t bytes;//what loading another copy would have cost
+    Mesh* mesh;
+    unsigned int numMeshes;
+    btTriangleMesh* btMesh;
+    void* mapping;//mesh cache file the geometry points into, if any
+    size_t mappingSize;
+    GLuint texture;
+    btCollisionShape* shape;
+    void* bvhBuffer;//loaded BVH the shape points into, if any
+};
+
+std::map<unsigned long long, Resource> resources;
+int resourceHits = 0;
+int resourceMisses = 0;
+size_t resourceBytesSaved = 0;
+std::mutex resourceMutex;//startup loads from several threads at once
+std::mutex ilMutex;//DevIL keeps its bound image in globals, one decode at a time
+
+//--Startup loads, each file is read once no matter how many objects use it
+struct MeshLoad
+{
+    const char* path;
+    std::vector<Object*> objects;//the first one does the reading
+    int task;//graph task that reads it
+};
+
+//a texture on its way from disk to the GPU
+struct TextureLoad
+{
+    const char* path;
+    unsigned long long key;
+    GLuint texture;//0 until uploaded or found already loaded
+    bool cooked;//came from texcook's .dds instead of the image
+    DDSImage dds;
+    std::vector<unsigned char> pixels;//decoded, waiting for the GL thread
+    int width;
+    int height;
+    int bpp;//bytes per pixel
+    int format;
+    std::vector<GLuint*> textures;//where each object wants it
+    std::vector<unsigned long long*> keys;
 };
 
 // View Vars
@@ -78,18 +274,98 @@ GLuint program;// The GLSL program handle
 const char* VERTEX_SHADER = "../bin/assets/shader.vert";
 const char* FRAGMENT_SHADER = "../bin/assets/shader.frag";
 
-//uniform locations
-GLint loc_mvpmat;// Location of the modelviewprojection matrix in the shader
-GLint loc_modelviewmat;
-GLint loc_bools;
-GLint loc_RAVEMODE;
-// GLint loc_projmat;
-
-//attribute locations
-GLint loc_position;
-GLint loc_uv;
-GLint loc_normal;
-GLint gSampler;
+//Shader permutations, each lighting toggle is a #define compiled into its own
+//program rather than a uniform the shader branches on every vertex. A feature
+//bit matches the toggle at the same index. Combinations are built the first
+//time the toggles ask for them and kept until the shaders change
+const int SHADER_FEATURES = 4;
+const unsigned int FEATURE_RAVE = 1 << 3;//on its own, it replaces the other lights
+const char* FEATURE_DEFINES[SHADER_FEATURES] = {"AMBIENT_LIGHT", "DISTANT_LIGHT", "POINT_LIGHT", "RAVE"};
+struct ShaderVariant
+{
+    GLuint program;//0 when it failed to build, so it isn't retried every frame
+    GLuint instancedProgram;
+};
+std::map<unsigned int, ShaderVariant> shaderVariants;//feature bits -> programs
+std::atomic<unsigned int> activeFeatures(0);//what program and instancedProgram were built with
+
+//Live shader reload, a thread sleeps on inotify until a shader file is saved,
+//rebuilds the active variant on a GL context of its own that shares objects
+//with GLUT's, and hands it over in reloaded for render() to swap in
+struct ReloadedShaders
+{
+    ShaderVariant variant;
+    unsigned int features;
+    bool ready;//built and not swapped in yet
+};
+std::thread shaderWatcher;
+std::atomic<bool> shaderWatching(false);
+std::mutex reloadLock;
+ReloadedShaders reloaded = {{0, 0}, 0, false};
+std::atomic<bool> shadersChanged(false);//saved, with no context to rebuild on, render() does it
+#ifdef __linux__
+int shaderNotify = -1;
+Display* reloadDisplay = NULL;
+GLXContext reloadContext = NULL;
+GLXPbuffer reloadSurface = 0;
+#endif
+
+//attribute locations, bound before linking so every VAO can use them
+const GLuint ATTRIB_POSITION = 0;
+const GLuint ATTRIB_UV = 1;
+const GLuint ATTRIB_NORMAL = 2;
+const GLuint ATTRIB_MODEL = 3;//instanced only, a mat4 takes 3 through 6
+
+//uniform block bindings
+const GLuint FRAME_BINDING = 0;
+const GLuint OBJECT_BINDING = 1;
+const GLuint LIGHT_BINDING = 2;
+
+//FrameData in the shaders, laid out std140
+struct FrameData
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    GLfloat RAVEMODE[4];
+    GLfloat clusterScale[4];//tiles per pixel across and down, then the slice scale and bias
+};
+GLuint frameUbo;
+
+//ObjectData in the shaders, laid out std140
+struct ObjectData
+{
+    glm::mat4 model;
+    GLint lightCount[4];
+    GLint lightIndex[MAX_OBJECT_LIGHTS];//ivec4s in the shaders
+};
+
+//LightData in the shaders, laid out std140
+struct LightData
+{
+    GLfloat position[MAX_LIGHTS][4];//eye space, radius in w
+    GLfloat color[MAX_LIGHTS][4];
+};
+GLuint lightUbo;
+
+//Point lights in world space, lit per pixel. Each object only gets the few that
+//reach its box, so there can be many more lights than any one object pays for
+std::vector<PointLight> sceneLights;//one over each board
+std::vector<PointLight> raveLights;//strobes circling the boards in Rave Mode
+const int RAVE_LIGHTS = 256;
+
+//Rave Mode has too many lights for a list per object. They are binned into a
+//grid of view-space clusters instead (src/clusters.h), which goes up as two
+//integer textures: a first index and count per cluster, and the indices
+const int CLUSTER_INDEX_WIDTH = 1024;//indices to a texture row
+const GLuint CLUSTER_CELLS_UNIT = 1;//texture units, 0 is the object's own
+const GLuint CLUSTER_INDICES_UNIT = 2;
+ClusterGrid clusters;
+GLuint clusterCells;
+GLuint clusterIndices;
+int clusterIndexRows = 0;//allocated so far
+const float NEAR_PLANE = 0.01;
+const float FAR_PLANE = 100.0;
+
 GLfloat lmodel_ambient[] = {0.2, 0.2, 0.2, 1.0};
 GLfloat RAVEMODE[3] = {0.,0.,0.};
 int counter;
@@ -104,14 +380,148 @@ glm::mat4 projection;//eye->clip
 glm::mat4 modelView;
 glm::mat4 mvp;//premultiplied modelviewprojection
 int toggles[4];
+bool compressedTextures = false;//the GPU takes DXT1/DXT5 so cooked textures can be used
+
+//Frustum culling, every drawn object keeps its world-space box in a dynamic BVH
+btDbvt cullTree;
+const float CULL_MARGIN = 0.05;//leaves are this much bigger than their object, plus a step of its motion
+Frustum viewFrustum;//from the current projection * view
+int objectsCulled = 0;//last frame
+int marblesCulled = 0;
+
+//Render queue, draws are collected each frame then sorted so ones sharing state run back to back
+struct DrawPacket
+{
+    unsigned long long key;//program, texture, vertex array, depth from the high bits down
+    GLuint program;
+    GLuint texture;
+    GLuint vao;//the mesh's buffers and layout
+    GLuint ubo;//ObjectData block, 0 for instanced draws
+    GLuint first;//index in the ibo to start at, where the level of detail starts
+    GLsizei count;//indices
+    GLsizei instances;//0 for a plain draw
+};
+std::vector<DrawPacket> renderQueue;
+int stateChanges = 0;//binds the last frame made
+int stateChangesAvoided = 0;//binds it skipped because the state was already current
+int trianglesDrawn = 0;//the last frame, instances included
+
+//Levels of detail, picked from how many pixels tall an object's bounding sphere is
+bool lodEnabled = true;
+const float LOD_PIXELS[MAX_LODS] = {160.0, 80.0, 40.0, 0.0};//smallest size each level is drawn at
+const float LOD_HYSTERESIS = 0.2;//how far past a boundary a size has to go before the level changes
+const unsigned int LOD_MIN_FACES = 16;//no level gets smaller than this
+
+//Profiler, CPU time per frame phase plus GPU time for the draws, averaged over PROFILE_FRAMES
+enum ProfilePhase
+{
+    PHASE_PHYSICS,//stepSimulation
+    PHASE_UPDATE,//update(Object&)
+    PHASE_RENDER,//culling and the render queue
+    PHASE_SWAP,//glutSwapBuffers
+    PHASE_COUNT
+};
+const char* PHASE_NAMES[PHASE_COUNT] = {"physics", "update", "render", "swap"};
+const int PROFILE_FRAMES = 60;
+const int GPU_QUERIES = 4;//frames a timer query has to come back in before its slot is skipped
+
+struct ProfileHistory
+{
+    float samples[PROFILE_FRAMES];//milliseconds
+    int next;
+    int count;
+};
+
+struct PhaseProfile
+{
+    ProfileHistory cpu;
+    ProfileHistory gpu;
+    float cpuFrame;//milliseconds spent in the phase so far this frame
+    GLuint queries[GPU_QUERIES];//GL_TIME_ELAPSED, one per frame in flight
+    bool queryPending[GPU_QUERIES];//ended but not read back yet
+    int activeQuery;//slot begun this frame, -1 for none
+};
+PhaseProfile profile[PHASE_COUNT];
+bool showProfiler = false;
+bool gpuTimers = false;//the GPU has timer queries
+int profileFrame = 0;
+
+//adds the time until the end of the enclosing scope to a phase, while the profiler is showing
+struct ProfileScope
+{
+    ProfilePhase phase;
+    std::chrono::time_point<std::chrono::high_resolution_clock> start;
+
+    explicit ProfileScope(ProfilePhase p) : phase(p) {
+        if(showProfiler)
+            start = std::chrono::high_resolution_clock::now();
+    }
+    ~ProfileScope() {
+        if(showProfiler)
+            profile[phase].cpuFrame += std::chrono::duration_cast< std::chrono::duration<float, std::milli> >(
+                                           std::chrono::high_resolution_clock::now() - start).count();
+    }
+};
+
+//Frame pacing, update() runs from a GLUT timer instead of spinning in the idle callback
+float targetFps = 60.0;//while anything moves
+const float IDLE_FPS = 4.0;//while nothing does, enough to keep the clock ticking
+FramePacer pacer(targetFps, IDLE_FPS);
+int tickGeneration = 0;//timers from before the last wakeFrames() are ignored
+bool sceneMoved = false;//an object's model matrix changed this frame
+
+//HUD text, drawn from a glyph atlas when the GPU can build one
+TextRenderer hudText;
+
+//GL calls made drawing the last frame, wrap render path calls in GL() to count them
+int glCalls = 0;
+int glCallsLastFrame = 0;
+bool showGLCalls = false;
+#define GL(call) (glCalls++, call)
+
+//Fixed timestep physics on its own thread, the GLUT thread only ever reads snapshots
+const float PHYSICS_STEP = 1.0 / 120.0;//simulated seconds per step
+const int MAX_PHYSICS_LAG = 30;//steps behind before the thread gives up catching up
+float physicsAlpha = 0.0;//how far past the snapshot's step we are rendering, 0 to 1
+int droppedSteps = 0;//steps skipped because the thread fell behind
+
+//what the input callbacks control, sent to the physics thread whole whenever it changes
+struct PhysicsControls
+{
+    float yaw, pitch, roll;
+    float pitchDEMO, rollDEMO;
+    bool paused;
+};
+
+//bodies the snapshots carry, in this order
+const int PHYSICS_OBJECTS = 4;
+
+//the world after one step, published by the physics thread
+struct PhysicsSnapshot
+{
+    btTransform previous[PHYSICS_OBJECTS];//before the step
+    btTransform current[PHYSICS_OBJECTS];//after it
+    std::vector<btTransform> marblePrevious;
+    std::vector<btTransform> marbleCurrent;
+    int marblesHome;
+    bool ballHome;//ball01 reached the goal
+    std::chrono::time_point<std::chrono::high_resolution_clock> time;//when the step finished
+    double stepMs;//time spent stepping since the thread started, for the profiler
+};
 
 //Physics Globals
 btBroadphaseInterface* broadphase;
 btDefaultCollisionConfiguration* collisionConfiguration;
 btCollisionDispatcher* dispatcher;
-btSequentialImpulseConstraintSolver* solver;
+btConstraintSolver* solver;
+btConstraintSolver* solverMt = NULL;//the solver the pool's islands use, multi-threaded worlds only
 btDiscreteDynamicsWorld* dynamicsWorld;
 
+//1 steps the plain world, more builds btDiscreteDynamicsWorldMt on a job system
+int physicsThreads = 1;
+JobSystem* physicsJobs = NULL;
+JobScheduler* physicsScheduler = NULL;
+
 //maze transforms
 float yaw, pitch, roll;
 float pitchDEMO, rollDEMO;
@@ -124,11 +534,58 @@ bool mouseControl;
 bool gameWon = false;
 float gameWinTime = 0.0;
 
+//the physics thread and what goes between it and the GLUT thread
+std::thread physicsThread;
+std::atomic<bool> physicsRunning(false);//stepping, only changed under physicsWakeMutex
+bool physicsParked = false;//stopped and waiting to be started again, under physicsWakeMutex
+bool physicsQuit = false;
+std::mutex physicsWakeMutex;//stopped or paused, the thread sleeps on physicsWake
+std::condition_variable physicsWake;
+TripleBuffer<PhysicsSnapshot> physicsSnapshots;
+SpscQueue<PhysicsControls, 256> physicsInput;
+PhysicsControls physicsControls;//the physics thread's copy
+double physicsStepMsSeen = 0.0;//stepMs of the last snapshot the profiler counted
+
+//headless simulation globals (no GLUT window or GL context)
+bool headless = false;
+int headlessTicks = 6000;
+float headlessRate = 60.0;
+const char* headlessScript = NULL;
+bool scalingReport = false;//time the headless run at every thread count instead
+bool collisionBench = false;//or with the mazes as triangles and then as convex pieces
+const float HULL_MARGIN = 0.01;//hulls grow by their margin, boxes and triangle meshes don't
+float physicsTolerance = 0.02;//how far collision triangles may stray from the render ones, negative keeps them all
+bool simplifyBench = false;//or with each board's full and simplified collision triangles
+bool clusterBench = false;//or the Rave Mode light binning, with and without SSE
+
+//multi-marble mode, extra balls sharing ball01's mesh and shape drawn in one instanced call
+bool multiMarble = false;
+int marbleCount = 500;//how many the mode spawns
+std::vector<btRigidBody*> marbles;
+int marblesHome = 0;//marbles sitting in the goal corner
+GLuint instancedProgram;
+GLuint marbleInstances;//one model matrix per marble
+GLuint marbleUbo;//ObjectData for the marbles, only the lights are used
+LightList marblesLit;
+std::vector<GLuint> marbleVaos;//one per ball mesh and level, with that level's instance matrices attached
+std::vector<unsigned int> marbleLods;//level each marble was drawn at last frame
+
+//a scripted tilt input, held from its tick until the next one
+struct TiltKey
+{
+    int tick;
+    float pitch;
+    float roll;
+};
+
 
 //--GLUT Callbacks
 void render();
 void update();
 void update(Object &obj);
+void tick(int generation);
+void scheduleTick();
+void wakeFrames();
 void reshape(int n_w, int n_h);
 void mouseClick(int button, int state, int x, int y);
 void mousePassive(int x, int y);
@@ -140,16 +597,117 @@ void menuWrapper(int id){
 
 //--Function Prototypes
 char* loadShader(const char*);
-bool loadOBJ(const char*, const char*, const char*, Object &);
-void renderOBJ(Object &obj);
+bool initShaders();
+bool loadAssets();
+bool readMesh(const char*, Object &);
+bool readMeshes(MeshLoad &);
+void uploadMesh(Object &);
+void shareMesh(const Resource &, Object &);
+void freeMesh(Mesh*, unsigned int, btTriangleMesh*, void*, size_t);
+bool importOBJ(const char*, Object &);
+bool loadMeshCache(const char*, Object &, void* &, size_t &, const float* &, unsigned int &);
+void saveMeshCache(const char*, const Object &, const std::vector<float> &);
+bool meshSourceHash(const char*, unsigned long long &);
+unsigned long long hashBytes(const void*, size_t, unsigned long long);
+bool hashFile(const char*, unsigned long long &);
+bool decodeTexture(TextureLoad &);
+void uploadTexture(TextureLoad &);
+unsigned long long resourceKey(ResourceType, unsigned long long);
+Resource* findResource(unsigned long long);
+Resource& addResource(unsigned long long, ResourceType, size_t);
+void releaseResource(unsigned long long);
+void releaseObject(Object &);
+btCollisionShape* acquireMeshShape(Object &);
+btCollisionShape* buildConvexShape(Object &, size_t &);
+btTriangleMesh* buildPhysicsMesh(const Object &, float);
+void physicsTriangles(const Object &, float, std::vector<float> &);
+btTriangleMesh* makePhysicsMesh(const float*, unsigned int);
+void setBoardShape(Object &, btCollisionShape*);
+btBvhTriangleMeshShape* buildTriangleShape(Object &, void* &);
+unsigned long long triangleHash(const Object &);
+std::string bvhCachePath(unsigned long long);
+btBvhTriangleMeshShape* loadBvhCache(Object &, unsigned long long, void* &);
+void saveBvhCache(unsigned long long, const Object &, btOptimizedBvh*, float);
+void setMeshCollision(Object &, CollisionMode);
+btCollisionShape* acquireSphereShape(btScalar, Object &);
+void queueOBJ(Object &obj);
+void initLights();
+void updateRaveLights(float seconds, bool recolor);
+const std::vector<PointLight>& frameLights();
+unsigned int eyeLights(const std::vector<PointLight> &lights, const glm::mat4 &toEye, LightData &data);
+void uploadLights();
+void uploadClusters();
+void setProjection();
+void lightObject(GLuint ubo, const btVector3 &boxMin, const btVector3 &boxMax, LightList &lit);
+void queueMarbles();
+void queueDraw(GLuint program, GLuint texture, GLuint vao, GLuint ubo, GLuint first, GLsizei count, GLsizei instances, float depth);
+void buildLods(Mesh &mesh);
+float projectedPixels(const glm::vec4 &eye, float radius);
+unsigned int pickLod(float pixels, unsigned int current);
+void flushRenderQueue();
+bool drawPacketLess(const DrawPacket &a, const DrawPacket &b);
+void cullScene();
+void cullNode(const btDbvtNode* node, bool inside);
+void objectBounds(const Object &obj, btDbvtVolume &volume);
+bool spawnMarbles(int count);
+void clearMarbles();
+bool atGoal(const btVector3 &pos);
+unsigned int toggleFeatures();
+bool buildVariant(unsigned int features, ShaderVariant &variant);
+bool useShaderVariant(unsigned int features);
+void clearShaderVariants();
+GLuint buildProgram(bool instanced, unsigned int features);
+GLuint compileProgram(const char* vs, const char* fs, const std::string &defines, bool instanced);
+void shaderSource(GLuint shader, const char* source, const std::string &defines);
+bool setupProgram(GLuint linked, bool instanced);
+unsigned long long programHash(const char* vs, const char* fs, const std::string &defines);
+std::string programCachePath(unsigned long long);
+GLuint loadProgramCache(unsigned long long hash);
+void saveProgramCache(unsigned long long hash, GLuint linked);
+void startShaderWatcher();
+void stopShaderWatcher();
+void watchShaders();
+void swapReloadedShaders();
+void setVertexLayout();
+void initObjectData(Object &obj);
 void update(Object &obj);
 void printText(float x, float y, char* text);
+void initProfiler();
+void beginGpuTimer(ProfilePhase phase);
+void endGpuTimer(ProfilePhase phase);
+void endProfileFrame();
+void renderProfiler();
+void addSample(ProfileHistory &history, float sample);
+float historyAverage(const ProfileHistory &history);
+float historyMax(const ProfileHistory &history);
 void initPhysics();
+bool updatePhysics(float dt, int maxSubSteps, const PhysicsControls &controls);
+void tiltBoard(Object &board, const btVector3 &origin, const btQuaternion &rotation, bool paused);
+void savePhysicsState(Object &obj);
+PhysicsControls currentControls();
+void sendControls();
+void fillSnapshot(PhysicsSnapshot &snapshot, bool previous);
+void physicsLoop();
+void stepPhysics();
+void launchPhysicsThread();
+void startPhysicsThread();
+void stopPhysicsThread();
+void quitPhysicsThread();
+void wakePhysicsThread();
 
 //--Resource management
 bool initialize();
+bool initializeHeadless();
+void runHeadless(int ticks, float rate, const char* scriptPath);
+void runScaling(int ticks, float rate);
+void runCollisionBench(int ticks, float rate);
+void runSimplifyBench(int ticks, float rate);
+void runClusterBench(int ticks, float rate);
+void resetPhysicsScene();
+void startPhysicsJobs();
 void manageMenu();
 void cleanUp();
+void reportPacing();
 
 //--Random time things
 float getDT();
@@ -164,9 +722,83 @@ int main(int argc, char **argv) {
     //   return 0;
     // }
     // OBJPath = argv[argc-1];
-    // Initialize glut
     srand(time(NULL));
 
+    // --headless [--ticks N] [--rate HZ] [--script FILE] runs only the physics
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--headless") == 0)
+            headless = true;
+        else if(strcmp(argv[i], "--ticks") == 0 && i+1 < argc)
+            headlessTicks = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--rate") == 0 && i+1 < argc)
+            headlessRate = atof(argv[++i]);
+        else if(strcmp(argv[i], "--script") == 0 && i+1 < argc)
+            headlessScript = argv[++i];
+        else if(strcmp(argv[i], "--marbles") == 0 && i+1 < argc) {
+            marbleCount = atoi(argv[++i]);
+            multiMarble = marbleCount > 0;
+        }
+        else if(strcmp(argv[i], "--fps") == 0 && i+1 < argc) {
+            targetFps = atof(argv[++i]);
+            if(targetFps <= 0.0)
+                targetFps = 60.0;
+            pacer.setRate(targetFps, IDLE_FPS);
+        }
+        else if(strcmp(argv[i], "--physics-threads") == 0 && i+1 < argc)
+            physicsThreads = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--scaling") == 0)
+            scalingReport = true;
+        else if(strcmp(argv[i], "--collision") == 0 && i+1 < argc) {
+            CollisionMode mode = strcmp(argv[++i], "convex") == 0 ? COLLISION_CONVEX : COLLISION_TRIANGLES;
+            maze01.collision = mode;
+            mazeDEMO.collision = mode;
+        }
+        else if(strcmp(argv[i], "--collision-bench") == 0)
+            collisionBench = true;
+        else if(strcmp(argv[i], "--physics-tolerance") == 0 && i+1 < argc)
+            physicsTolerance = atof(argv[++i]);
+        else if(strcmp(argv[i], "--simplify-bench") == 0)
+            simplifyBench = true;
+        else if(strcmp(argv[i], "--cluster-bench") == 0)
+            clusterBench = true;
+        else if(strcmp(argv[i], "--no-lod") == 0)
+            lodEnabled = false;
+    }
+    if(scalingReport && physicsThreads < 2)
+        physicsThreads = std::max(std::thread::hardware_concurrency(), 2u);
+    //before anything touches bullet, the thread that steps the world has to be its main one.
+    //Windowed that's the physics thread, which starts now and lives until exit
+    if(physicsThreads > 1) {
+        if(headless)
+            startPhysicsJobs();
+        else
+            launchPhysicsThread();
+    }
+    if(headless) {
+        if(headlessTicks <= 0 || headlessRate <= 0.0) {
+            cout << "ERROR: --ticks and --rate must be positive. Aborting." << endl;
+            return -1;
+        }
+        if(initializeHeadless()) {
+            if(scalingReport)
+                runScaling(headlessTicks, headlessRate);
+            else if(collisionBench)
+                runCollisionBench(headlessTicks, headlessRate);
+            else if(simplifyBench)
+                runSimplifyBench(headlessTicks, headlessRate);
+            else if(clusterBench)
+                runClusterBench(headlessTicks, headlessRate);
+            else
+                runHeadless(headlessTicks, headlessRate, headlessScript);
+        }
+        cleanUp();
+        return 0;
+    }
+
+    // Initialize glut
+#ifdef __linux__
+    XInitThreads();//the shader reload thread makes GLX calls of its own
+#endif
     glutInit(&argc, argv);
     glutInitDisplayMode(GLUT_DOUBLE | GLUT_DEPTH);
     glutInitWindowSize(windowWidth, windowHeight);
@@ -186,7 +818,7 @@ int main(int argc, char **argv) {
     // Set all of the callbacks to GLUT that we need
     glutDisplayFunc(render);// Called when its time to display
     glutReshapeFunc(reshape);// Called if the window is resized
-    glutIdleFunc(update);// Called if there is nothing else to do
+    scheduleTick();// Calls update() at the paced frame rate
     glutKeyboardFunc(keyboard);// Called if there is keyboard input
     glutMouseFunc(mouseClick);// Called if there is mouse input
     glutPassiveMotionFunc(mousePassive);
@@ -203,6 +835,10 @@ int main(int argc, char **argv) {
     glutAddMenuEntry("Camera: Top View", 9);
     glutAddMenuEntry("Camera: Follow the Ball", 10);
     glutAddMenuEntry("Change Texture", 11);
+    glutAddMenuEntry("Show GL Calls", 13);
+    glutAddMenuEntry("Multi-Marble Mode", 14);
+    glutAddMenuEntry("Show Profiler", 15);
+    glutAddMenuEntry("Toggle Level of Detail", 16);
     glutAddMenuEntry("Quit", 12);
     glutAttachMenu(GLUT_RIGHT_BUTTON);        
 
@@ -211,6 +847,9 @@ int main(int argc, char **argv) {
     if(init)
     {
         t1 = std::chrono::high_resolution_clock::now();
+        atexit(quitPhysicsThread);//ESC and Quit leave through exit()
+        atexit(stopShaderWatcher);
+        atexit(reportPacing);
         glutMainLoop();
     }
 
@@ -221,48 +860,71 @@ int main(int argc, char **argv) {
 
 //--Implementations
 void render() {
+    glCalls = 0;
+    swapReloadedShaders();
+    //a menu toggle changed, switch to the program built for the new set
+    unsigned int features = toggleFeatures();
+    if(features != activeFeatures)
+        useShaderVariant(features);
     //clear the screen
     if(toggles[3]==1) {
         int tmp = rand() % 3;
         switch(tmp) {
             case 1:
-                glClearColor(1.0, 0.0, 0.0, 1.0);
+                GL(glClearColor(1.0, 0.0, 0.0, 1.0));
                 break;
             case 2:
-                glClearColor(0.0, 1.0, 0.0, 1.0);
+                GL(glClearColor(0.0, 1.0, 0.0, 1.0));
                 break;
             case 3:
-                glClearColor(0.0, 0.0, 1.0, 1.0);
+                GL(glClearColor(0.0, 0.0, 1.0, 1.0));
                 break;
         }
     }
     else
-        glClearColor(0.0, 0.0, 0.2, 1.0);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        GL(glClearColor(0.0, 0.0, 0.2, 1.0));
+    GL(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
     
-    //enable the shader program
-    glUseProgram(program);
+    //everything the frame shares goes up in one go
+    FrameData frame;
+    frame.view = view;
+    frame.projection = projection;
+    for(int i = 0; i < 3; i++)
+        frame.RAVEMODE[i] = RAVEMODE[i];
+    frame.RAVEMODE[3] = 0.0;
+    frame.clusterScale[0] = float(CLUSTER_TILES_X) / windowWidth;
+    frame.clusterScale[1] = float(CLUSTER_TILES_Y) / windowHeight;
+    frame.clusterScale[2] = clusters.depthScale();
+    frame.clusterScale[3] = clusters.depthBias();
+    GL(glBindBuffer(GL_UNIFORM_BUFFER, frameUbo));
+    GL(glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(frame), &frame));
+    uploadLights();
 
-    //enable
-    glUniform1i(gSampler, 0);
-    glEnableVertexAttribArray(loc_position);
-    glEnableVertexAttribArray(loc_normal);
-    glEnableVertexAttribArray(loc_uv);
+    {
+        ProfileScope scope(PHASE_RENDER);
+        beginGpuTimer(PHASE_RENDER);
 
-    // render table
-    if(mode == 1 || 2){
-        renderOBJ(mazeDEMO);
-        renderOBJ(ballDEMO);
-    }
-    if(mode == 2){
-        renderOBJ(maze01);
-        renderOBJ(ball01);
+        //anything outside the view is skipped by queueOBJ
+        cullScene();
+
+        // queue table
+        if(mode == 1 || 2){
+            queueOBJ(mazeDEMO);
+            queueOBJ(ballDEMO);
+        }
+        if(mode == 2){
+            queueOBJ(maze01);
+            queueOBJ(ball01);
+            if(multiMarble)
+                queueMarbles();
+        }
+        flushRenderQueue();
+        endGpuTimer(PHASE_RENDER);
     }
 
     //clean up
-    glDisableVertexAttribArray(loc_position);
-    glDisableVertexAttribArray(loc_normal);
-    glDisableVertexAttribArray(loc_uv);
+    GL(glBindVertexArray(0));
+    glCallsLastFrame = glCalls;
     
     // update timer
     if(mode == 2){
@@ -282,62 +944,365 @@ void render() {
         else
             sprintf(buff, "Time:   %d:%f\n", minutes, seconds);
         printText(-0.95f, 0.9f, buff);
+        if(multiMarble) {
+            sprintf(buff, "Marbles home: %d / %d", marblesHome, (int)marbles.size());
+            printText(-0.95f, 0.82f, buff);
+        }
+    }
+    if(showGLCalls) {
+        char buff[48];
+        sprintf(buff, "State changes: %d (%d avoided)", stateChanges, stateChangesAvoided);
+        printText(-0.95f, -0.81f, buff);
+        sprintf(buff, "GL calls/frame: %d", glCallsLastFrame);
+        printText(-0.95f, -0.95f, buff);
+        sprintf(buff, "Culled: %d objects, %d marbles", objectsCulled, marblesCulled);
+        printText(-0.95f, -0.88f, buff);
+        sprintf(buff, "Triangles: %d (LOD %s)", trianglesDrawn, lodEnabled ? "on" : "off");
+        printText(-0.95f, -0.74f, buff);
     }
+    if(showProfiler)
+        renderProfiler();
 
-    glutSwapBuffers();
+    {
+        ProfileScope scope(PHASE_SWAP);
+        glutSwapBuffers();
+    }
+    endProfileFrame();
 }
 
-void renderOBJ(Object &obj) {
-    // //send to shader
+//puts an object's meshes in the render queue, nothing is drawn until flushRenderQueue()
+void queueOBJ(Object &obj) {
+    if(!obj.visible)
+        return;
 
+    //the model matrix only goes up when the object has moved
+    if(obj.modelDirty) {
+        GL(glBindBuffer(GL_UNIFORM_BUFFER, obj.ubo));
+        GL(glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4), glm::value_ptr(obj.modelMatrix)));
+        obj.modelDirty = false;
+    }
+
+    //distance to the center of its box, so nearer objects draw first within the same state
+    btVector3 center = obj.cullNode->volume.Center();
+    glm::vec4 eye = view * glm::vec4(center.x(), center.y(), center.z(), 1.0);
+    float radius = obj.cullNode->volume.Extents().length();
+    obj.lod = lodEnabled ? pickLod(projectedPixels(eye, radius), obj.lod) : 0;
+    lightObject(obj.ubo, obj.cullNode->volume.Mins(), obj.cullNode->volume.Maxs(), obj.lit);
+    GLuint texture = textureToggle == 0 ? obj.texture : obj._texture;
     for(unsigned int i=0; i<obj.numMeshes; i++) {
+        unsigned int level = std::min(obj.lod, obj.mesh[i].numLods - 1);
+        queueDraw(program, texture, obj.mesh[i].vao, obj.ubo, obj.mesh[i].lodFirst[level],
+                  obj.mesh[i].lodCount[level], 0, -eye.z / 100.0);
+    }
+}
 
-        mvp = projection * view * obj.modelMatrix;
-        modelView = view * obj.modelMatrix;
-        glUniformMatrix4fv(loc_mvpmat, 1, GL_FALSE, glm::value_ptr(mvp));
-        glUniformMatrix4fv(loc_modelviewmat, 1, GL_FALSE, glm::value_ptr(modelView));
-        glUniform4i(loc_bools, toggles[0], toggles[1], toggles[2], toggles[3]);
-        glUniform3f(loc_RAVEMODE, RAVEMODE[0], RAVEMODE[1], RAVEMODE[2]);
-        // glUniformMatrix4fv(loc_projmat, 1, GL_FALSE, glm::value_ptr(projection));
-        //set up the Vertex Buffer Object so it can be drawn
+//the board lights, and the strobes' radius. Their places and colours come from updateRaveLights()
+void initLights() {
+    PointLight board = {{0.0, 10.0, -5.0}, 40.0, {0.8, 0.8, 0.8}};
+    sceneLights.push_back(board);
+    board.position[0] = 50.0;
+    sceneLights.push_back(board);
+    PointLight strobe = {{0.0, 0.0, 0.0}, 1.5, {0.0, 0.0, 0.0}};
+    raveLights.assign(RAVE_LIGHTS, strobe);
+    updateRaveLights(0.0, true);
+}
 
-        glBindBuffer(GL_ARRAY_BUFFER, obj.mesh[i].vbo_geometry);
-        //set pointers into the vbo for each of the attributes(position and color)
-        glVertexAttribPointer( loc_position,//location of attribute
-                               3,//number of elements
-                               GL_FLOAT,//type
-                               GL_FALSE,//normalized?
-                               sizeof(Vertex),//stride
-                               0);//offset
-        // load in uv texture stuff
-        glVertexAttribPointer(loc_normal, 3, GL_FLOAT, GL_TRUE, sizeof(Vertex), (void*)offsetof(Vertex,normal));
-        glVertexAttribPointer(loc_uv, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex,uv));
-        glActiveTexture(GL_TEXTURE0);
-        if(textureToggle == 0)
-            glBindTexture(GL_TEXTURE_2D, obj.texture);
+//the strobes alternate between the boards, circling each in rings of 32 that
+//turn opposite ways. However many there are, they all move and get colours
+void updateRaveLights(float seconds, bool recolor) {
+    for(unsigned int i = 0; i < raveLights.size(); i++) {
+        PointLight &light = raveLights[i];
+        int ring = i / 64;
+        float angle = 2.0 * M_PI * (i / 2 % 32) / 32.0 + seconds * (ring % 2 == 0 ? 1.0 : -1.5);
+        float across = 1.0 + 1.2 * ring;
+        light.position[0] = (i % 2 == 0 ? 0.0 : 50.0) + across * cos(angle);
+        light.position[1] = 1.0;
+        light.position[2] = across * sin(angle);
+        if(recolor) {
+            int channel = rand() % 3;
+            for(int k = 0; k < 3; k++)
+                light.color[k] = k == channel ? 1.0 : 0.0;
+        }
+    }
+}
+
+const std::vector<PointLight>& frameLights() {
+    return toggles[3] == 1 ? raveLights : sceneLights;
+}
+
+//the lights as LightData lays them out, returns how many fit
+unsigned int eyeLights(const std::vector<PointLight> &lights, const glm::mat4 &toEye, LightData &data) {
+    unsigned int count = std::min((unsigned int)lights.size(), MAX_LIGHTS);
+    for(unsigned int i = 0; i < count; i++) {
+        glm::vec4 eye = toEye * glm::vec4(lights[i].position[0], lights[i].position[1], lights[i].position[2], 1.0);
+        for(int k = 0; k < 3; k++) {
+            data.position[i][k] = eye[k];
+            data.color[i][k] = lights[i].color[k];
+        }
+        data.position[i][3] = lights[i].radius;
+        data.color[i][3] = 0.0;
+    }
+    return count;
+}
+
+//every light into eye space, once for the whole frame. In Rave Mode they are binned too
+void uploadLights() {
+    static LightData data;
+    unsigned int count = eyeLights(frameLights(), view, data);
+    GL(glBindBuffer(GL_UNIFORM_BUFFER, lightUbo));
+    GL(glBufferSubData(GL_UNIFORM_BUFFER, 0, count * sizeof(data.position[0]), data.position));
+    GL(glBufferSubData(GL_UNIFORM_BUFFER, offsetof(LightData, color), count * sizeof(data.color[0]), data.color));
+    if(toggles[3] == 1) {
+        clusters.bin(&data.position[0][0], count);
+        uploadClusters();
+    }
+}
+
+//the grid every frame, the index texture only grows
+void uploadClusters() {
+    static std::vector<unsigned short> indices;//padded out to whole rows
+    indices.assign(clusters.lightIndices().begin(), clusters.lightIndices().end());
+    int rows = std::max((int)(indices.size() + CLUSTER_INDEX_WIDTH - 1) / CLUSTER_INDEX_WIDTH, 1);
+    indices.resize(rows * CLUSTER_INDEX_WIDTH, 0);
+    GL(glActiveTexture(GL_TEXTURE0 + CLUSTER_CELLS_UNIT));
+    GL(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, CLUSTER_TILES_X * CLUSTER_TILES_Y, CLUSTER_SLICES,
+                       GL_RG_INTEGER, GL_UNSIGNED_INT, &clusters.clusterCells()[0]));
+    GL(glActiveTexture(GL_TEXTURE0 + CLUSTER_INDICES_UNIT));
+    if(rows > clusterIndexRows) {
+        clusterIndexRows = rows;
+        GL(glTexImage2D(GL_TEXTURE_2D, 0, GL_R16UI, CLUSTER_INDEX_WIDTH, rows, 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, &indices[0]));
+    }
+    else
+        GL(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, CLUSTER_INDEX_WIDTH, rows, GL_RED_INTEGER, GL_UNSIGNED_SHORT, &indices[0]));
+    GL(glActiveTexture(GL_TEXTURE0));
+}
+
+//picks the lights touching a world-space box, the ubo is only written when they changed
+void lightObject(GLuint ubo, const btVector3 &boxMin, const btVector3 &boxMax, LightList &lit) {
+    //Rave Mode's lights come from the clusters instead
+    if(toggles[3] == 1)
+        return;
+    float mins[3] = {(float)boxMin.x(), (float)boxMin.y(), (float)boxMin.z()};
+    float maxs[3] = {(float)boxMax.x(), (float)boxMax.y(), (float)boxMax.z()};
+    LightList picked;
+    picked.count = selectLights(frameLights(), mins, maxs, picked.lights);
+    if(picked.count == lit.count && std::equal(picked.lights, picked.lights + picked.count, lit.lights))
+        return;
+    lit = picked;
+
+    GLint lights[4 + MAX_OBJECT_LIGHTS] = {(GLint)lit.count};
+    std::copy(lit.lights, lit.lights + lit.count, lights + 4);
+    GL(glBindBuffer(GL_UNIFORM_BUFFER, ubo));
+    GL(glBufferSubData(GL_UNIFORM_BUFFER, offsetof(ObjectData, lightCount), (4 + lit.count) * sizeof(GLint), lights));
+}
+
+//how many pixels tall a sphere at eye would be on screen
+float projectedPixels(const glm::vec4 &eye, float radius) {
+    if(-eye.z <= radius)
+        return FLT_MAX;//the camera is inside it
+    return radius * projection[1][1] * windowHeight / -eye.z;
+}
+
+//the level for a size, only leaving the current one once the size is well past its boundary
+unsigned int pickLod(float pixels, unsigned int current) {
+    unsigned int coarser = 0, finer = 0;
+    while(coarser + 1 < MAX_LODS && pixels * (1.0 + LOD_HYSTERESIS) < LOD_PIXELS[coarser])
+        coarser++;
+    while(finer + 1 < MAX_LODS && pixels / (1.0 + LOD_HYSTERESIS) < LOD_PIXELS[finer])
+        finer++;
+    if(coarser > current)
+        return coarser;
+    if(finer < current)
+        return finer;
+    return current;
+}
+
+//key bits: 63-56 program, 55-40 texture, 39-24 vertex array, 23-0 depth (0 to 1 of the far plane)
+void queueDraw(GLuint program, GLuint texture, GLuint vao, GLuint ubo, GLuint first, GLsizei count, GLsizei instances, float depth) {
+    DrawPacket packet;
+    unsigned long long depthBits = (unsigned long long)(std::min(std::max(depth, 0.0f), 1.0f) * 0xffffff);
+    packet.key = ((unsigned long long)(program & 0xff) << 56) |
+                 ((unsigned long long)(texture & 0xffff) << 40) |
+                 ((unsigned long long)(vao & 0xffff) << 24) |
+                 depthBits;
+    packet.program = program;
+    packet.texture = texture;
+    packet.vao = vao;
+    packet.ubo = ubo;
+    packet.first = first;
+    packet.count = count;
+    packet.instances = instances;
+    renderQueue.push_back(packet);
+}
+
+bool drawPacketLess(const DrawPacket &a, const DrawPacket &b) {
+    return a.key < b.key;
+}
+
+//sorts the frame's packets and draws them, binding only what differs from the packet before
+void flushRenderQueue() {
+    std::sort(renderQueue.begin(), renderQueue.end(), drawPacketLess);
+    stateChanges = 0;
+    stateChangesAvoided = 0;
+    trianglesDrawn = 0;
+    GLuint currentProgram = 0, currentTexture = 0, currentVao = 0, currentUbo = 0;
+    for(unsigned int i = 0; i < renderQueue.size(); i++) {
+        const DrawPacket &packet = renderQueue[i];
+        //the first packet always binds everything, the state left by the last frame is unknown
+        if(i == 0 || packet.program != currentProgram) {
+            GL(glUseProgram(packet.program));
+            currentProgram = packet.program;
+            stateChanges++;
+        }
         else
-            glBindTexture(GL_TEXTURE_2D, obj._texture);
-        glDrawArrays(GL_TRIANGLES, 0, obj.mesh[i].numFaces * 3);
+            stateChangesAvoided++;
+        if(i == 0 || packet.texture != currentTexture) {
+            GL(glBindTexture(GL_TEXTURE_2D, packet.texture));
+            currentTexture = packet.texture;
+            stateChanges++;
+        }
+        else
+            stateChangesAvoided++;
+        if(i == 0 || packet.vao != currentVao) {
+            GL(glBindVertexArray(packet.vao));
+            currentVao = packet.vao;
+            stateChanges++;
+        }
+        else
+            stateChangesAvoided++;
+        if(packet.ubo != 0) {
+            if(packet.ubo != currentUbo) {
+                GL(glBindBufferBase(GL_UNIFORM_BUFFER, OBJECT_BINDING, packet.ubo));
+                currentUbo = packet.ubo;
+                stateChanges++;
+            }
+            else
+                stateChangesAvoided++;
+        }
+
+        void* offset = (void*)(packet.first * sizeof(GLuint));
+        if(packet.instances > 0)
+            GL(glDrawElementsInstanced(GL_TRIANGLES, packet.count, GL_UNSIGNED_INT, offset, packet.instances));
+        else
+            GL(glDrawElements(GL_TRIANGLES, packet.count, GL_UNSIGNED_INT, offset));
+        trianglesDrawn += packet.count / 3 * std::max(packet.instances, 1);
+    }
+    renderQueue.clear();
+}
+
+//queues every marble as one instanced draw per ball mesh
+void queueMarbles() {
+    //the instance matrices come from the physics snapshot, blended like update(Object&) does
+    const PhysicsSnapshot &snapshot = physicsSnapshots.readBuffer();
+    unsigned int count = std::min(marbles.size(), snapshot.marbleCurrent.size());
+    if(count == 0)
+        return;
+
+    //each level has its own run of marbles.size() matrices, floats whatever precision Bullet uses
+    GLfloat* matrices;
+    GL(glBindBuffer(GL_ARRAY_BUFFER, marbleInstances));
+    GL(matrices = (GLfloat*)glMapBufferRange(GL_ARRAY_BUFFER, 0, MAX_LODS * marbles.size() * 16 * sizeof(GLfloat),
+                                              GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+    if(matrices == NULL)
+        return;
+    btTransform trans;
+    btScalar transMatrix[16];
+    GLfloat matrix[16];
+    GLfloat worldMin[3], worldMax[3];
+    btVector3 visibleMin(FLT_MAX, FLT_MAX, FLT_MAX);
+    btVector3 visibleMax = -visibleMin;
+    int visible = 0;
+    int levelCounts[MAX_LODS] = {0};
+    marbleLods.resize(count, 0);
+    float radius = 0.0;
+    for(unsigned int j = 0; j < ball01.numMeshes; j++) {
+        for(int k = 0; k < 3; k++)
+            radius = std::max(radius, std::max(std::fabs(ball01.mesh[j].boundsMin[k]), std::fabs(ball01.mesh[j].boundsMax[k])));
+    }
+    radius *= std::sqrt(3.0f);
+    for(unsigned int i = 0; i < count; i++) {
+        const btTransform &previous = snapshot.marblePrevious[i];
+        const btTransform &current = snapshot.marbleCurrent[i];
+        trans.setOrigin(previous.getOrigin().lerp(current.getOrigin(), physicsAlpha));
+        trans.setRotation(previous.getRotation().slerp(current.getRotation(), physicsAlpha));
+        trans.getOpenGLMatrix(transMatrix);
+        std::copy(transMatrix, transMatrix + 16, matrix);
+
+        //too many and too small to be worth a tree, each one is tested directly
+        transformAabb(matrix, ball01.mesh[0].boundsMin, ball01.mesh[0].boundsMax, worldMin, worldMax);
+        for(unsigned int j = 1; j < ball01.numMeshes; j++) {
+            GLfloat meshMin[3], meshMax[3];
+            transformAabb(matrix, ball01.mesh[j].boundsMin, ball01.mesh[j].boundsMax, meshMin, meshMax);
+            for(int k = 0; k < 3; k++) {
+                worldMin[k] = std::min(worldMin[k], meshMin[k]);
+                worldMax[k] = std::max(worldMax[k], meshMax[k]);
+            }
+        }
+        if(cullAabb(viewFrustum, worldMin, worldMax) == CULL_OUTSIDE)
+            continue;
+        visibleMin.setMin(btVector3(worldMin[0], worldMin[1], worldMin[2]));
+        visibleMax.setMax(btVector3(worldMax[0], worldMax[1], worldMax[2]));
+        glm::vec4 eye = view * glm::vec4(matrix[12], matrix[13], matrix[14], 1.0);
+        marbleLods[i] = lodEnabled ? pickLod(projectedPixels(eye, radius), marbleLods[i]) : 0;
+        unsigned int level = marbleLods[i];
+        memcpy(matrices + 16 * (level * marbles.size() + levelCounts[level]), matrix, sizeof(matrix));
+        levelCounts[level]++;
+        visible++;
+    }
+    GL(glUnmapBuffer(GL_ARRAY_BUFFER));
+    marblesCulled = count - visible;
+    if(visible == 0)
+        return;
 
+    //one instanced draw shares one light list, picked for the box around every visible marble
+    lightObject(marbleUbo, visibleMin, visibleMax, marblesLit);
+
+    //they cover the whole board, so there is no one depth to sort them by
+    GLuint texture = textureToggle == 0 ? ball01.texture : ball01._texture;
+    for(unsigned int i = 0; i < ball01.numMeshes; i++) {
+        for(unsigned int level = 0; level < MAX_LODS; level++) {
+            if(levelCounts[level] == 0)
+                continue;
+            unsigned int meshLevel = std::min(level, ball01.mesh[i].numLods - 1);
+            queueDraw(instancedProgram, texture, marbleVaos[i * MAX_LODS + level], marbleUbo, ball01.mesh[i].lodFirst[meshLevel],
+                      ball01.mesh[i].lodCount[meshLevel], levelCounts[level], 0.0);
+        }
     }
 }
 
 void update() {
 
     //update physics stuff
-    float dt = getDT();
     float high = .99;
     float low = .25;
     int tmp = rand() % 3;
 
-    if(!paused) {
-        dynamicsWorld->stepSimulation(dt,10);
+    //the newest step the physics thread has published, never waiting on it
+    physicsSnapshots.update();
+    const PhysicsSnapshot &snapshot = physicsSnapshots.readBuffer();
+    float sinceStep = std::chrono::duration_cast< std::chrono::duration<float> >(
+                          std::chrono::high_resolution_clock::now() - snapshot.time).count();
+    physicsAlpha = std::min(std::max(sinceStep / PHYSICS_STEP, 0.0f), 1.0f);
+    Object* physicsObjects[PHYSICS_OBJECTS] = {&ball01, &maze01, &ballDEMO, &mazeDEMO};
+    for(int i = 0; i < PHYSICS_OBJECTS; i++) {
+        physicsObjects[i]->prevTransform = snapshot.previous[i];
+        physicsObjects[i]->currTransform = snapshot.current[i];
     }
+    if(snapshot.ballHome)
+        gameWon = true;
+    marblesHome = snapshot.marblesHome;
+    if(showProfiler)
+        profile[PHASE_PHYSICS].cpuFrame += snapshot.stepMs - physicsStepMsSeen;
+    physicsStepMsSeen = snapshot.stepMs;
 
-    update(ball01);
-    update(maze01);
-    update(ballDEMO);
-    update(mazeDEMO);
+    {
+        ProfileScope scope(PHASE_UPDATE);
+        sceneMoved = false;
+        update(ball01);
+        update(maze01);
+        update(ballDEMO);
+        update(mazeDEMO);
+    }
 
     // IMPORTANT RAVEMODE THINGS
     counter++;
@@ -359,77 +1324,387 @@ void update() {
             RAVEMODE[2] = high;
         }
     }
-    btTransform trans;
-    trans.setIdentity();
-    btQuaternion quat;
-    quat.setEuler(yaw, pitch, roll);
-    trans.setRotation(quat);
-    maze01.rigidBody->setCenterOfMassTransform(trans);
-
-    btTransform transform;
-    ball01.rigidBody->getMotionState()->getWorldTransform(transform);
-    btVector3 pos = transform.getOrigin();
+    //the strobes keep circling and change colour with it
+    if(toggles[3] == 1) {
+        static std::chrono::time_point<std::chrono::high_resolution_clock> raveStart = std::chrono::high_resolution_clock::now();
+        float seconds = std::chrono::duration_cast< std::chrono::duration<float> >(
+                            std::chrono::high_resolution_clock::now() - raveStart).count();
+        updateRaveLights(seconds, counter == 0);
+    }
 
     if(followBall) {
+        glm::vec4 pos = ball01.modelMatrix[3];
         view = glm::lookAt( glm::vec3(0.0, 15.0, 0.0 ), //Eye Position
-                            glm::vec3(pos.x(), pos.y(), pos.z()), //Focus point
+                            glm::vec3(pos.x, pos.y, pos.z), //Focus point
                             glm::vec3(0.0, 0.0, 1.0)); //y is up
     }
 
-    //YOU WIN FUNCTION
-    if(pos.x() < -4.2 && pos.z() > 4.2) {
-        gameWon = true;
-    }
+    //redraw only if something on screen moved, the game clock alone gets the idle rate
+    bool changed = sceneMoved || (multiMarble && !paused) || toggles[3] == 1;
+    pacer.frameDone(changed);
+    if(changed || mode == 2)
+        glutPostRedisplay();//call the display callback
+}
+
+//runs a frame once the pacer says it is due, then books the next one
+void tick(int generation) {
+    if(generation != tickGeneration)
+        return;
+    pacer.waitForFrame();
+    update();
+    scheduleTick();
+}
+
+void scheduleTick() {
+    glutTimerFunc(pacer.delayMs(), tick, ++tickGeneration);
+}
+
+//input arrived, don't leave it waiting on an idle-rate frame
+void wakeFrames() {
+    if(pacer.isActive())
+        return;
+    pacer.wake();
+    scheduleTick();
+}
+
+//steps the world and tilts the boards, true once ball01 is home
+//no GL in here so the physics thread and headless mode can use it
+bool updatePhysics(float dt, int maxSubSteps, const PhysicsControls &controls) {
+    //the boards are tilted before the step so bullet can work out how fast they moved
+    btQuaternion quat;
+    quat.setEuler(controls.yaw, controls.pitch, controls.roll);
+    tiltBoard(maze01, btVector3(0.0,0.0,0.0), quat, controls.paused);
 
-    btTransform transDEMO;
-    transDEMO.setIdentity();
     btQuaternion quatDEMO;
-    quatDEMO.setEuler(0.0,pitchDEMO, rollDEMO);
-    transDEMO.setRotation(quatDEMO);
-    transDEMO.setOrigin(btVector3(50.0,0.0,0.0));
-    mazeDEMO.rigidBody->setCenterOfMassTransform(transDEMO);
+    quatDEMO.setEuler(0.0, controls.pitchDEMO, controls.rollDEMO);
+    tiltBoard(mazeDEMO, btVector3(50.0,0.0,0.0), quatDEMO, controls.paused);
+
+    if(!controls.paused) {
+        dynamicsWorld->stepSimulation(dt, maxSubSteps);
+    }
+
+    btTransform transform;
+    ball01.rigidBody->getMotionState()->getWorldTransform(transform);
+    btVector3 pos = transform.getOrigin();
 
-    glutPostRedisplay();//call the display callback
+    //YOU WIN FUNCTION
+    return atGoal(pos);
 }
 
-void update(Object &obj) {
-    btTransform trans;
-    btScalar buffer[16];
-    trans = obj.rigidBody -> getCenterOfMassTransform();
-    trans.getOpenGLMatrix(buffer);
-    glm::mat4 modelPosition = glm::make_mat4(buffer);
-    obj.modelMatrix = modelPosition;
+//boards are kinematic, bullet reads their motion state every step and turns the
+//change into a velocity so the balls get pushed instead of teleported through
+//a board that isn't tilting sleeps, which skips its AABB and velocity updates
+void tiltBoard(Object &board, const btVector3 &origin, const btQuaternion &rotation, bool paused) {
+    btRigidBody* body = board.rigidBody;
+    if(rotation == board.tilt) {
+        if(body->getActivationState() != ISLAND_SLEEPING && !paused) {
+            //it moved last step, now it has stopped
+            body->setLinearVelocity(btVector3(0.0,0.0,0.0));
+            body->setAngularVelocity(btVector3(0.0,0.0,0.0));
+            body->forceActivationState(ISLAND_SLEEPING);
+        }
+        return;
+    }
+
+    board.tilt = rotation;
+    btTransform trans(rotation, origin);
+    body->getMotionState()->setWorldTransform(trans);
+    if(paused) {
+        //nothing moves while paused, so the board can just be put there
+        body->setWorldTransform(trans);
+        body->setInterpolationWorldTransform(trans);
+        dynamicsWorld->updateSingleAabb(body);
+    }
+    else
+        body->forceActivationState(DISABLE_DEACTIVATION);
 }
 
-void reshape(int n_w, int n_h) {
-    windowWidth = n_w;
-    windowHeight = n_h;
-    //Change the viewport to be correct
-    glViewport( 0, 0, windowWidth, windowHeight);
-    //Update the projection matrix as well
-    //See the init function for an explaination
-    projection = glm::perspective(45.0f, float(windowWidth)/float(windowHeight), 0.01f, 100.0f);
+//takes the body's transform as both ends of the interpolation, only while the physics thread is stopped
+void savePhysicsState(Object &obj) {
+    obj.prevTransform = obj.rigidBody->getCenterOfMassTransform();
+    obj.currTransform = obj.prevTransform;
+}
 
+PhysicsControls currentControls() {
+    PhysicsControls controls;
+    controls.yaw = yaw;
+    controls.pitch = pitch;
+    controls.roll = roll;
+    controls.pitchDEMO = pitchDEMO;
+    controls.rollDEMO = rollDEMO;
+    controls.paused = paused;
+    return controls;
 }
 
-void mouseClick(int button, int state, int x, int y) {
+//input callbacks call this after changing the tilt or pause state
+void sendControls() {
+    if(!physicsInput.push(currentControls()))
+        cout << "Physics: input queue full, dropped a tilt update" << endl;
+    wakePhysicsThread();
 }
 
-void keyboard(unsigned char key, int x_pos, int y_pos) {
-    // Handle keyboard input
-    if(key == 27)//ESC
+//taking the lock means a thread about to sleep either sees the change or gets the notify
+void wakePhysicsThread() {
     {
-        exit(0);
+        std::lock_guard<std::mutex> lock(physicsWakeMutex);
     }
-    //for main maze
-    if(key == 119 && !paused && mode == 2) { // W
-        pitch += 0.005;
+    physicsWake.notify_all();
+}
+
+//copies the bodies into a snapshot, previous picks which end of the step
+void fillSnapshot(PhysicsSnapshot &snapshot, bool previous) {
+    Object* physicsObjects[PHYSICS_OBJECTS] = {&ball01, &maze01, &ballDEMO, &mazeDEMO};
+    btTransform* transforms = previous ? snapshot.previous : snapshot.current;
+    std::vector<btTransform> &marbleTransforms = previous ? snapshot.marblePrevious : snapshot.marbleCurrent;
+    for(int i = 0; i < PHYSICS_OBJECTS; i++)
+        transforms[i] = physicsObjects[i]->rigidBody->getCenterOfMassTransform();
+    marbleTransforms.resize(marbles.size());
+    for(unsigned int i = 0; i < marbles.size(); i++)
+        marbleTransforms[i] = marbles[i]->getCenterOfMassTransform();
+}
+
+//The physics thread. There is only ever one, so bullet hands out one thread index
+//for it however often the game restarts, and with --physics-threads it installs
+//the job system itself as bullet's main thread. Between startPhysicsThread() and
+//stopPhysicsThread() it steps the world, the rest of the time it sleeps
+void physicsLoop() {
+    if(physicsThreads > 1)
+        startPhysicsJobs();
+    std::unique_lock<std::mutex> lock(physicsWakeMutex);
+    while(true) {
+        physicsParked = true;
+        physicsWake.notify_all();
+        physicsWake.wait(lock, [] { return physicsRunning.load(std::memory_order_acquire) || physicsQuit; });
+        if(physicsQuit)
+            break;
+        physicsParked = false;
+        lock.unlock();
+        stepPhysics();
+        lock.lock();
     }
-    if(key == 115 && !paused && mode == 2) { // A
-        pitch -= 0.005;
+    if(physicsThreads > 1)
+        btSetTaskScheduler(NULL);//bullet only takes it from the thread that installed it
+}
+
+//steps at PHYSICS_STEP and publishes a snapshot after each one until stopped
+void stepPhysics() {
+    typedef std::chrono::high_resolution_clock Clock;
+    Clock::duration step = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(PHYSICS_STEP));
+    Clock::time_point next = Clock::now();
+    double stepMs = 0.0;
+    PhysicsControls controls;
+
+    while(physicsRunning.load(std::memory_order_acquire)) {
+        //only the newest input matters, each one is the whole state
+        while(physicsInput.pop(controls))
+            physicsControls = controls;
+
+        PhysicsSnapshot &snapshot = physicsSnapshots.writeBuffer();
+        Clock::time_point stepStart = Clock::now();
+        fillSnapshot(snapshot, true);
+        snapshot.ballHome = updatePhysics(PHYSICS_STEP, 0, physicsControls);
+        fillSnapshot(snapshot, false);
+        snapshot.marblesHome = 0;
+        for(unsigned int i = 0; i < snapshot.marbleCurrent.size(); i++) {
+            if(atGoal(snapshot.marbleCurrent[i].getOrigin()))
+                snapshot.marblesHome++;
+        }
+        snapshot.time = Clock::now();
+        stepMs += std::chrono::duration_cast< std::chrono::duration<double, std::milli> >(snapshot.time - stepStart).count();
+        snapshot.stepMs = stepMs;
+        physicsSnapshots.publish();
+
+        //paused there is nothing to step, the boards were just put where the controls say
+        if(physicsControls.paused) {
+            std::unique_lock<std::mutex> lock(physicsWakeMutex);
+            physicsWake.wait(lock, [] { return !physicsInput.empty() || !physicsRunning.load(std::memory_order_acquire); });
+            next = Clock::now();
+            continue;
+        }
+
+        //too far behind to catch up, drop the backlog instead of spiraling
+        next += step;
+        if(snapshot.time - next > MAX_PHYSICS_LAG * step) {
+            droppedSteps += (snapshot.time - next) / step;
+            next = snapshot.time;
+        }
+        std::this_thread::sleep_until(next);
     }
-    if(key == 97 && !paused && mode == 2) { // S
-        roll -= 0.005;
+}
+
+//hands the world to the physics thread, starting from where the bodies are now
+void startPhysicsThread() {
+    if(physicsRunning)
+        return;
+    PhysicsSnapshot &snapshot = physicsSnapshots.writeBuffer();
+    fillSnapshot(snapshot, true);
+    fillSnapshot(snapshot, false);
+    snapshot.marblesHome = 0;
+    snapshot.ballHome = false;
+    snapshot.time = std::chrono::high_resolution_clock::now();
+    snapshot.stepMs = physicsStepMsSeen = 0.0;
+    physicsSnapshots.publish();
+
+    PhysicsControls stale;
+    while(physicsInput.pop(stale));
+    physicsControls = currentControls();
+    if(!physicsThread.joinable())
+        launchPhysicsThread();
+    {
+        std::lock_guard<std::mutex> lock(physicsWakeMutex);
+        physicsRunning = true;
+    }
+    physicsWake.notify_all();
+}
+
+//waits for the step in progress, after this the GLUT thread may touch the world
+void stopPhysicsThread() {
+    if(!physicsRunning)
+        return;
+    std::unique_lock<std::mutex> lock(physicsWakeMutex);
+    physicsRunning = false;
+    physicsWake.notify_all();
+    physicsWake.wait(lock, [] { return physicsParked; });
+}
+
+//starts the physics thread stopped, once this returns any job system is installed
+void launchPhysicsThread() {
+    std::unique_lock<std::mutex> lock(physicsWakeMutex);
+    physicsThread = std::thread(physicsLoop);
+    physicsWake.wait(lock, [] { return physicsParked; });
+}
+
+//ends the physics thread for good at exit
+void quitPhysicsThread() {
+    if(!physicsThread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(physicsWakeMutex);
+        physicsRunning = false;
+        physicsQuit = true;
+    }
+    physicsWake.notify_all();
+    physicsThread.join();
+}
+
+//the far corner of maze01
+bool atGoal(const btVector3 &pos) {
+    return pos.x() < -4.2 && pos.z() > 4.2;
+}
+
+void update(Object &obj) {
+    //blend between the last two physics steps so motion is smooth at any frame rate
+    btTransform trans;
+    btScalar buffer[16];
+    trans.setOrigin(obj.prevTransform.getOrigin().lerp(obj.currTransform.getOrigin(), physicsAlpha));
+    trans.setRotation(obj.prevTransform.getRotation().slerp(obj.currTransform.getRotation(), physicsAlpha));
+    trans.getOpenGLMatrix(buffer);
+    glm::mat4 modelPosition = glm::make_mat4(buffer);
+    if(modelPosition != obj.modelMatrix) {
+        obj.modelMatrix = modelPosition;
+        obj.modelDirty = true;
+        sceneMoved = true;
+        //the box follows the body, the tree only restructures if it left its fattened volume
+        if(obj.cullNode != NULL) {
+            btDbvtVolume volume;
+            objectBounds(obj, volume);
+            btVector3 velocity = obj.currTransform.getOrigin() - obj.prevTransform.getOrigin();
+            cullTree.update(obj.cullNode, volume, velocity, CULL_MARGIN);
+        }
+    }
+}
+
+//world-space box around every mesh of an object at its current model matrix
+void objectBounds(const Object &obj, btDbvtVolume &volume) {
+    GLfloat worldMin[3], worldMax[3], meshMin[3], meshMax[3];
+    const GLfloat* matrix = glm::value_ptr(obj.modelMatrix);
+    transformAabb(matrix, obj.mesh[0].boundsMin, obj.mesh[0].boundsMax, worldMin, worldMax);
+    for(unsigned int i = 1; i < obj.numMeshes; i++) {
+        transformAabb(matrix, obj.mesh[i].boundsMin, obj.mesh[i].boundsMax, meshMin, meshMax);
+        for(int j = 0; j < 3; j++) {
+            worldMin[j] = std::min(worldMin[j], meshMin[j]);
+            worldMax[j] = std::max(worldMax[j], meshMax[j]);
+        }
+    }
+    volume = btDbvtVolume::FromMM(btVector3(worldMin[0], worldMin[1], worldMin[2]),
+                                  btVector3(worldMax[0], worldMax[1], worldMax[2]));
+}
+
+//marks what the camera can see, whole subtrees go at once when their box is in or out
+void cullScene() {
+    glm::mat4 viewProjection = projection * view;
+    extractFrustum(glm::value_ptr(viewProjection), viewFrustum);
+    objectsCulled = 0;
+    maze01.visible = ball01.visible = mazeDEMO.visible = ballDEMO.visible = false;
+    if(cullTree.m_root != NULL)
+        cullNode(cullTree.m_root, false);
+    //only the objects of the current mode count towards what was saved
+    Object* drawn[] = {&mazeDEMO, &ballDEMO, &maze01, &ball01};
+    int numDrawn = mode == 2 ? 4 : 2;
+    for(int i = 0; i < numDrawn; i++) {
+        if(!drawn[i]->visible)
+            objectsCulled++;
+    }
+    marblesCulled = 0;
+}
+
+void cullNode(const btDbvtNode* node, bool inside) {
+    if(!inside) {
+        const btVector3 &boxMin = node->volume.Mins();
+        const btVector3 &boxMax = node->volume.Maxs();
+        GLfloat min[3] = {(GLfloat)boxMin.x(), (GLfloat)boxMin.y(), (GLfloat)boxMin.z()};
+        GLfloat max[3] = {(GLfloat)boxMax.x(), (GLfloat)boxMax.y(), (GLfloat)boxMax.z()};
+        CullResult result = cullAabb(viewFrustum, min, max);
+        if(result == CULL_OUTSIDE)
+            return;
+        inside = result == CULL_INSIDE;
+    }
+    if(node->isleaf()) {
+        ((Object*)node->data)->visible = true;
+        return;
+    }
+    cullNode(node->childs[0], inside);
+    cullNode(node->childs[1], inside);
+}
+
+void reshape(int n_w, int n_h) {
+    windowWidth = n_w;
+    windowHeight = n_h;
+    //Change the viewport to be correct
+    glViewport( 0, 0, windowWidth, windowHeight);
+    //Update the projection matrix as well
+    //See the init function for an explaination
+    setProjection();
+    wakeFrames();
+}
+
+//the clusters are cut from the same frustum
+void setProjection() {
+    projection = glm::perspective( 45.0f, //the FoV typically 90 degrees is good which is what this is set to
+                                   float(windowWidth)/float(windowHeight), //Aspect Ratio, so Circles stay Circular
+                                   NEAR_PLANE, //Distance to the near plane, normally a small value like this
+                                   FAR_PLANE); //Distance to the far plane, 
+    clusters.setProjection(projection[0][0], projection[1][1], NEAR_PLANE, FAR_PLANE);
+}
+
+void mouseClick(int button, int state, int x, int y) {
+}
+
+void keyboard(unsigned char key, int x_pos, int y_pos) {
+    // Handle keyboard input
+    if(key == 27)//ESC
+    {
+        exit(0);
+    }
+    //for main maze
+    if(key == 119 && !paused && mode == 2) { // W
+        pitch += 0.005;
+    }
+    if(key == 115 && !paused && mode == 2) { // A
+        pitch -= 0.005;
+    }
+    if(key == 97 && !paused && mode == 2) { // S
+        roll -= 0.005;
     }
     if(key == 100 && !paused && mode == 2) { // D
         roll += 0.005;
@@ -447,6 +1722,8 @@ void keyboard(unsigned char key, int x_pos, int y_pos) {
     if(key == 100 && !paused && mode == 1) { // D
         rollDEMO += 0.005;
     }
+    sendControls();
+    wakeFrames();
 }
 
 void mousePassive(int x, int y) {
@@ -462,6 +1739,8 @@ void mousePassive(int x, int y) {
 
         oldMousePos.x = xNorm;
         oldMousePos.y = yNorm;
+        sendControls();
+        wakeFrames();
     }
 }
 
@@ -479,331 +1758,1979 @@ bool initialize() {
 
     //initialize devil-based image loading
     ilInit();
+    compressedTextures = GLEW_EXT_texture_compression_s3tc;
 
     //initialize lighting toggles
     for(int i = 0; i < 3; i++)
         toggles[i] = 1;
     toggles[3] = 0; 
+    initLights();
+
+    //geometry, textures, collision shapes and shaders all load together
+    if(!loadAssets()){
+      cout << "Asset loading failed. Aborting" << endl;
+      return false;
+    }
+    initObjectData(maze01);
+    initObjectData(ball01);
+    initObjectData(mazeDEMO);
+    initObjectData(ballDEMO);
+    if(multiMarble)
+        multiMarble = spawnMarbles(marbleCount);
+    initProfiler();
+    initText(hudText, GLUT_BITMAP_TIMES_ROMAN_24);
+
+    //--Init the view and projection matrices
+    //  if you will be having a moving camera the view matrix will need to more dynamic
+    //  ...Like you should update it before you render more dynamic 
+    //  for this project having them static will be fine
+    view = glm::lookAt( glm::vec3(0, 10.0, -10.0), //Eye Position
+                        glm::vec3(0.0, 0.0, 0.0), //Focus point
+                        glm::vec3(0.0, 1.0, 0.0)); //Positive Y is up
+
+    setProjection();
+
+    //enable depth testing
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+    glEnable(GL_CULL_FACE);
+
+    //from here on only the physics thread touches the world
+    startPhysicsThread();
+
+    //and its done
+    return true;
+}
+
+//gives an object its ObjectData buffer, written again whenever it moves, and its place in cullTree
+void initObjectData(Object &obj) {
+    update(obj);
+    ObjectData data;
+    data.model = obj.modelMatrix;
+    data.lightCount[0] = 0;//lightObject() fills them in once it's drawn
+    obj.lit.count = 0;
+    glGenBuffers(1, &obj.ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, obj.ubo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(data), &data, GL_DYNAMIC_DRAW);
+    obj.modelDirty = false;
+    btDbvtVolume volume;
+    objectBounds(obj, volume);
+    obj.cullNode = cullTree.insert(volume, &obj);
+}
+
+//builds the programs for the starting toggles, GL thread only
+bool initShaders() {
+    if(!useShaderVariant(toggleFeatures()))
+        return false;
+    glUseProgram(program);
+    glActiveTexture(GL_TEXTURE0);
+
+    //per-frame data lives in one buffer shared by both programs
+    glGenBuffers(1, &frameUbo);
+    glBindBuffer(GL_UNIFORM_BUFFER, frameUbo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameData), NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_BINDING, frameUbo);
+    glGenBuffers(1, &lightUbo);
+    glBindBuffer(GL_UNIFORM_BUFFER, lightUbo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(LightData), NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, LIGHT_BINDING, lightUbo);
+
+    //the marbles' matrices come per instance, their block only carries lights
+    ObjectData marbleData;
+    marbleData.lightCount[0] = 0;
+    marblesLit.count = 0;
+    glGenBuffers(1, &marbleUbo);
+    glBindBuffer(GL_UNIFORM_BUFFER, marbleUbo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(marbleData), &marbleData, GL_DYNAMIC_DRAW);
+
+    //the Rave Mode cluster textures stay bound on their own units
+    GLuint* clusterTextures[2] = {&clusterCells, &clusterIndices};
+    GLuint units[2] = {CLUSTER_CELLS_UNIT, CLUSTER_INDICES_UNIT};
+    for(int i = 0; i < 2; i++) {
+        glGenTextures(1, clusterTextures[i]);
+        glActiveTexture(GL_TEXTURE0 + units[i]);
+        glBindTexture(GL_TEXTURE_2D, *clusterTextures[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R16UI, CLUSTER_INDEX_WIDTH, 1, 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, NULL);
+    clusterIndexRows = 1;
+    glActiveTexture(GL_TEXTURE0 + CLUSTER_CELLS_UNIT);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32UI, CLUSTER_TILES_X * CLUSTER_TILES_Y, CLUSTER_SLICES, 0, GL_RG_INTEGER, GL_UNSIGNED_INT, NULL);
+    glActiveTexture(GL_TEXTURE0);
+    startShaderWatcher();
+    return true;
+}
+
+//the lighting the toggles ask for, rave mode on its own
+unsigned int toggleFeatures() {
+    if(toggles[3] == 1)
+        return FEATURE_RAVE;
+    unsigned int features = 0;
+    for(int i = 0; i < SHADER_FEATURES; i++) {
+        if(toggles[i] == 1)
+            features |= 1 << i;
+    }
+    return features;
+}
+
+//the regular program and the same shaders taking the model matrix per instance
+//for the marbles, false if either fails. Safe on any thread with a context
+bool buildVariant(unsigned int features, ShaderVariant &variant) {
+    variant.program = buildProgram(false, features);
+    variant.instancedProgram = variant.program != 0 ? buildProgram(true, features) : 0;
+    if(variant.instancedProgram == 0) {
+        glDeleteProgram(variant.program);
+        variant.program = 0;
+        return false;
+    }
+    return true;
+}
+
+//makes program and instancedProgram the ones built for these features, building
+//them the first time. Keeps the current ones if that fails, GL thread only
+bool useShaderVariant(unsigned int features) {
+    std::map<unsigned int, ShaderVariant>::iterator found = shaderVariants.find(features);
+    if(found == shaderVariants.end()) {
+        ShaderVariant variant;
+        buildVariant(features, variant);
+        found = shaderVariants.insert(std::make_pair(features, variant)).first;
+    }
+    if(found->second.program == 0)
+        return false;
+    program = found->second.program;
+    instancedProgram = found->second.instancedProgram;
+    activeFeatures = features;
+    return true;
+}
+
+void clearShaderVariants() {
+    std::map<unsigned int, ShaderVariant>::iterator i;
+    for(i = shaderVariants.begin(); i != shaderVariants.end(); i++) {
+        glDeleteProgram(i->second.program);
+        glDeleteProgram(i->second.instancedProgram);
+    }
+    shaderVariants.clear();
+}
+
+//the program from the cache when these sources were linked by this driver before,
+//compiled and cached otherwise. Returns 0 if anything fails, safe on any thread with a context
+GLuint buildProgram(bool instanced, unsigned int features) {
+    std::chrono::time_point<std::chrono::high_resolution_clock> start, end;
+    start = std::chrono::high_resolution_clock::now();
+    //array sizes from lights.h, then the features
+    char sizes[64];
+    snprintf(sizes, sizeof(sizes), "#define MAX_LIGHTS %u\n#define MAX_OBJECT_LIGHTS %u\n", MAX_LIGHTS, MAX_OBJECT_LIGHTS);
+    char grid[160];
+    snprintf(grid, sizeof(grid), "#define CLUSTER_TILES_X %d\n#define CLUSTER_SLICES %d\n#define CLUSTER_INDEX_WIDTH %d\n",
+             CLUSTER_TILES_X, CLUSTER_SLICES, CLUSTER_INDEX_WIDTH);
+    std::string defines = std::string(sizes) + grid;
+    if(instanced)
+        defines += "#define INSTANCED\n";
+    std::string names;
+    for(int i = 0; i < SHADER_FEATURES; i++) {
+        if(features & (1 << i)) {
+            defines += std::string("#define ") + FEATURE_DEFINES[i] + "\n";
+            names += std::string(" ") + FEATURE_DEFINES[i];
+        }
+    }
+    char* vs = loadShader(VERTEX_SHADER);
+    char* fs = loadShader(FRAGMENT_SHADER);
+    unsigned long long hash = programHash(vs, fs, defines);
+    GLuint linked = loadProgramCache(hash);
+    bool cached = linked != 0;
+    if(!cached) {
+        linked = compileProgram(vs, fs, defines, instanced);
+        if(linked != 0)
+            saveProgramCache(hash, linked);
+    }
+    delete[] vs;
+    delete[] fs;
+    if(linked == 0)
+        return 0;
+
+    //a binary comes back with its attribute locations but not the block bindings or uniforms
+    if(!setupProgram(linked, instanced)) {
+        glDeleteProgram(linked);
+        return 0;
+    }
+    end = std::chrono::high_resolution_clock::now();
+    cout << "Shaders: " << (instanced ? "instanced" : "regular") << " program (" << (names.empty() ? " unlit" : names)
+         << " ) " << (cached ? "loaded" : "compiled")
+         << " in " << std::chrono::duration_cast< std::chrono::duration<float, std::milli> >(end-start).count() << " ms" << endl;
+    return linked;
+}
+
+//compiles and links the shaders, returns 0 if anything fails
+GLuint compileProgram(const char* vs, const char* fs, const std::string &defines, bool instanced) {
+    GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+    GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+
+    //compile the shaders
+    GLint shader_status;
+
+    // Vertex shader first
+    shaderSource(vertex_shader, vs, defines);
+    glCompileShader(vertex_shader);
+    //check the compile status
+    glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &shader_status);
+    if(!shader_status)
+    {
+        std::cerr << "[F] FAILED TO COMPILE VERTEX SHADER!" << std::endl;
+        glDeleteShader(vertex_shader);
+        glDeleteShader(fragment_shader);
+        return 0;
+    }
+
+    // Now the Fragment shader
+    shaderSource(fragment_shader, fs, defines);
+    glCompileShader(fragment_shader);
+    //check the compile status
+    glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &shader_status);
+    if(!shader_status)
+    {
+        std::cerr << "[F] FAILED TO COMPILE FRAGMENT SHADER!" << std::endl;
+        glDeleteShader(vertex_shader);
+        glDeleteShader(fragment_shader);
+        return 0;
+    }
+
+    //Now we link the 2 shader objects into a program
+    //This program is what is run on the GPU
+    GLuint linked = glCreateProgram();
+    glAttachShader(linked, vertex_shader);
+    glAttachShader(linked, fragment_shader);
+    //fixed attribute locations so the VAOs don't depend on the program
+    glBindAttribLocation(linked, ATTRIB_POSITION, "v_position");
+    glBindAttribLocation(linked, ATTRIB_UV, "v_uv");
+    glBindAttribLocation(linked, ATTRIB_NORMAL, "v_normal");
+    if(instanced)
+        glBindAttribLocation(linked, ATTRIB_MODEL, "v_model");
+    if(GLEW_ARB_get_program_binary)
+        glProgramParameteri(linked, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(linked);
+    glDeleteShader(vertex_shader);
+    glDeleteShader(fragment_shader);
+    //check if everything linked ok
+    glGetProgramiv(linked, GL_LINK_STATUS, &shader_status);
+    if(!shader_status)
+    {
+        std::cerr << "[F] THE SHADER PROGRAM FAILED TO LINK" << std::endl;
+        glDeleteProgram(linked);
+        return 0;
+    }
+    return linked;
+}
+
+//defines go right after the #version line, which has to come first
+void shaderSource(GLuint shader, const char* source, const std::string &defines) {
+    const char* body = strchr(source, '\n');
+    body = body != NULL ? body + 1 : source + strlen(source);
+    const char* parts[3] = {source, defines.c_str(), body};
+    GLint lengths[3] = {(GLint)(body - source), (GLint)defines.size(), -1};
+    glShaderSource(shader, 3, parts, lengths);
+}
+
+//points a linked program at the shared binding points and texture unit, so
+//every program the shaders are built into is used the same way
+bool setupProgram(GLuint linked, bool instanced) {
+    //Now we hook the uniform blocks up to their binding points
+    //this allows us to swap buffers in without touching the program
+    GLuint frameBlock = glGetUniformBlockIndex(linked, "FrameData");
+    if(frameBlock == GL_INVALID_INDEX)
+    {
+        std::cerr << "[F] FRAMEDATA BLOCK NOT FOUND" << std::endl;
+        return false;
+    }
+    glUniformBlockBinding(linked, frameBlock, FRAME_BINDING);
+
+    //instances bring their own model matrix
+    GLuint objectBlock = glGetUniformBlockIndex(linked, "ObjectData");
+    if(objectBlock == GL_INVALID_INDEX && !instanced)
+    {
+        std::cerr << "[F] OBJECTDATA BLOCK NOT FOUND" << std::endl;
+        return false;
+    }
+    if(objectBlock != GL_INVALID_INDEX)
+        glUniformBlockBinding(linked, objectBlock, OBJECT_BINDING);
+
+    //only there when some point lights are compiled in
+    GLuint lightBlock = glGetUniformBlockIndex(linked, "LightData");
+    if(lightBlock != GL_INVALID_INDEX)
+        glUniformBlockBinding(linked, lightBlock, LIGHT_BINDING);
+
+    GLint gSampler = glGetUniformLocation(linked, const_cast<const char*>("gSampler"));
+    if(gSampler == -1){
+        std::cerr << "[F] LMAG NOT FOUND" << std::endl;
+        return false;
+    }
+    //every object samples unit 0
+    glUseProgram(linked);
+    glUniform1i(gSampler, 0);
+
+    //and Rave Mode finds its lights on the units the clusters stay bound to
+    GLint cells = glGetUniformLocation(linked, "clusterCells");
+    GLint indices = glGetUniformLocation(linked, "clusterIndices");
+    if(cells != -1)
+        glUniform1i(cells, CLUSTER_CELLS_UNIT);
+    if(indices != -1)
+        glUniform1i(indices, CLUSTER_INDICES_UNIT);
+    return true;
+}
+
+//the same sources give a different binary on another driver, or after it updates
+unsigned long long programHash(const char* vs, const char* fs, const std::string &defines) {
+    unsigned long long hash = hashBytes(vs, strlen(vs), FNV_OFFSET);
+    hash = hashBytes(fs, strlen(fs), hash);
+    hash = hashBytes(defines.c_str(), defines.size(), hash);
+    GLenum names[3] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+    for(int i = 0; i < 3; i++) {
+        const char* driver = (const char*)glGetString(names[i]);
+        if(driver != NULL)
+            hash = hashBytes(driver, strlen(driver), hash);
+    }
+    return hash;
+}
+
+std::string programCachePath(unsigned long long hash) {
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.bin", hash);
+    return std::string(PROGRAM_CACHE_DIR) + name;
+}
+
+//0 when there is no usable binary, the driver is free to turn down its own old ones
+GLuint loadProgramCache(unsigned long long hash) {
+    if(!GLEW_ARB_get_program_binary)
+        return 0;
+    std::ifstream input(programCachePath(hash).c_str(), std::ios::binary);
+    if(!input.is_open())
+        return 0;
+    ProgramCacheHeader header;
+    if(!input.read((char*)&header, sizeof(header)) || header.magic != PROGRAM_CACHE_MAGIC ||
+       header.version != PROGRAM_CACHE_VERSION || header.sourceHash != hash)
+        return 0;
+    std::vector<char> binary(header.length);
+    if(header.length == 0 || !input.read(&binary[0], header.length))
+        return 0;
+
+    GLuint linked = glCreateProgram();
+    glProgramBinary(linked, header.format, &binary[0], header.length);
+    GLint status;
+    glGetProgramiv(linked, GL_LINK_STATUS, &status);
+    if(!status) {
+        glDeleteProgram(linked);
+        return 0;
+    }
+    return linked;
+}
+
+void saveProgramCache(unsigned long long hash, GLuint linked) {
+    if(!GLEW_ARB_get_program_binary)
+        return;
+    GLint length = 0;
+    glGetProgramiv(linked, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(length <= 0)
+        return;
+    std::vector<char> binary(length);
+    GLenum format;
+    glGetProgramBinary(linked, length, NULL, &format, &binary[0]);
+
+    ProgramCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = PROGRAM_CACHE_MAGIC;
+    header.version = PROGRAM_CACHE_VERSION;
+    header.sourceHash = hash;
+    header.format = format;
+    header.length = length;
+
+    mkdir(PROGRAM_CACHE_DIR, 0755);
+    std::string cachePath = programCachePath(hash);
+    std::string tempPath = cachePath + ".tmp";
+    std::ofstream output(tempPath.c_str(), std::ios::binary);
+    output.write((const char*)&header, sizeof(header));
+    output.write(&binary[0], length);
+    output.close();
+    //rename so a half written cache is never picked up
+    if(!output || rename(tempPath.c_str(), cachePath.c_str()) != 0) {
+        cout << "Warning: Unable to write " << cachePath << endl;
+        remove(tempPath.c_str());
+    }
+}
+
+//watches the shader folder, and makes the reload thread's context while GLUT's is current
+void startShaderWatcher() {
+#ifdef __linux__
+    std::string folder(VERTEX_SHADER, strrchr(VERTEX_SHADER, '/') - VERTEX_SHADER);
+    shaderNotify = inotify_init1(IN_NONBLOCK);
+    //editors either write the file or rename a new one over it
+    if(shaderNotify < 0 || inotify_add_watch(shaderNotify, folder.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        cout << "Warning: Unable to watch " << folder << ", shaders won't reload" << endl;
+        if(shaderNotify >= 0)
+            close(shaderNotify);
+        shaderNotify = -1;
+        return;
+    }
+
+    //a 1x1 pbuffer is all the context needs to be made current
+    reloadDisplay = glXGetCurrentDisplay();
+    int configAttribs[] = {GLX_DRAWABLE_TYPE, GLX_PBUFFER_BIT, GLX_RENDER_TYPE, GLX_RGBA_BIT, None};
+    int numConfigs = 0;
+    GLXFBConfig* configs = reloadDisplay != NULL ?
+        glXChooseFBConfig(reloadDisplay, DefaultScreen(reloadDisplay), configAttribs, &numConfigs) : NULL;
+    if(configs != NULL && numConfigs > 0) {
+        reloadContext = glXCreateNewContext(reloadDisplay, configs[0], GLX_RGBA_TYPE, glXGetCurrentContext(), True);
+        int surfaceAttribs[] = {GLX_PBUFFER_WIDTH, 1, GLX_PBUFFER_HEIGHT, 1, None};
+        if(reloadContext != NULL)
+            reloadSurface = glXCreatePbuffer(reloadDisplay, configs[0], surfaceAttribs);
+    }
+    if(configs != NULL)
+        XFree(configs);
+    if(reloadContext == NULL || reloadSurface == 0)
+        cout << "Warning: No background GL context, shaders will rebuild on the render thread" << endl;
+
+    shaderWatching = true;
+    shaderWatcher = std::thread(watchShaders);
+#endif
+}
+
+void stopShaderWatcher() {
+    if(!shaderWatcher.joinable())
+        return;
+    shaderWatching = false;
+    shaderWatcher.join();
+#ifdef __linux__
+    close(shaderNotify);
+    shaderNotify = -1;
+    if(reloadSurface != 0)
+        glXDestroyPbuffer(reloadDisplay, reloadSurface);
+    if(reloadContext != NULL)
+        glXDestroyContext(reloadDisplay, reloadContext);
+    reloadSurface = 0;
+    reloadContext = NULL;
+#endif
+    //built but never swapped in
+    if(reloaded.ready) {
+        glDeleteProgram(reloaded.variant.program);
+        glDeleteProgram(reloaded.variant.instancedProgram);
+        reloaded.ready = false;
+    }
+}
+
+//the reload thread, polls so it notices stopShaderWatcher()
+void watchShaders() {
+#ifdef __linux__
+    bool current = reloadSurface != 0 && glXMakeContextCurrent(reloadDisplay, reloadSurface, reloadSurface, reloadContext);
+    const char* names[2] = {strrchr(VERTEX_SHADER, '/') + 1, strrchr(FRAGMENT_SHADER, '/') + 1};
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while(shaderWatching) {
+        pollfd watch = {shaderNotify, POLLIN, 0};
+        if(poll(&watch, 1, 200) <= 0)
+            continue;
+
+        //an editor's save can come as several events, let them land then take them all
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        bool changed = false;
+        ssize_t length;
+        while((length = read(shaderNotify, events, sizeof(events))) > 0) {
+            for(char* next = events; next < events + length; ) {
+                const inotify_event* event = (const inotify_event*)next;
+                if(event->len > 0 && (strcmp(event->name, names[0]) == 0 || strcmp(event->name, names[1]) == 0))
+                    changed = true;
+                next += sizeof(inotify_event) + event->len;
+            }
+        }
+        if(!changed)
+            continue;
+        if(!current) {
+            shadersChanged = true;
+            continue;
+        }
+
+        //only what is on screen now, other variants rebuild when they're next used
+        ReloadedShaders built;
+        built.features = activeFeatures;
+        if(!buildVariant(built.features, built.variant)) {
+            std::cerr << "Shaders: reload failed, keeping the old ones" << std::endl;
+            continue;
+        }
+        //finished here before the render thread's context touches them
+        glUseProgram(0);
+        glFinish();
+        built.ready = true;
+        std::lock_guard<std::mutex> lock(reloadLock);
+        if(reloaded.ready) {
+            glDeleteProgram(reloaded.variant.program);
+            glDeleteProgram(reloaded.variant.instancedProgram);
+        }
+        reloaded = built;
+    }
+    if(current)
+        glXMakeContextCurrent(reloadDisplay, None, None, NULL);
+#endif
+}
+
+//between frames, so a frame never mixes old and new programs
+void swapReloadedShaders() {
+    ReloadedShaders built;
+    {
+        std::lock_guard<std::mutex> lock(reloadLock);
+        built = reloaded;
+        reloaded.ready = false;
+    }
+    if(!built.ready && shadersChanged.exchange(false)) {
+        built.features = activeFeatures;
+        built.ready = buildVariant(built.features, built.variant);
+        if(!built.ready) {
+            std::cerr << "Shaders: reload failed, keeping the old ones" << std::endl;
+            return;
+        }
+    }
+    if(!built.ready)
+        return;
+    //the other variants came from the old sources
+    clearShaderVariants();
+    shaderVariants[built.features] = built.variant;
+    //a menu toggle changed while it was building. It is still from the new
+    //sources so it stays cached, but the set on screen is built now too
+    unsigned int features = toggleFeatures();
+    if(built.features != features)
+        cout << "Shaders: the lights changed during the reload, building those too" << endl;
+    if(!useShaderVariant(features))
+        useShaderVariant(built.features);
+    cout << "Shaders: reloaded" << endl;
+}
+
+//loads just the geometry and physics, there is no GL context to upload to
+bool initializeHeadless() {
+    yaw = 0.0;
+    pitch = 0.0;
+    roll = 0.0;
+    paused = false;
+    mode = 2;
+
+    //no textures or shaders without GL, just the meshes and physics
+    if(!loadAssets()){
+      cout << "Asset loading failed. Aborting" << endl;
+      return false;
+    }
+    if(multiMarble)
+        spawnMarbles(marbleCount);
+    return true;
+}
+
+//steps the world at a fixed rate and reports the throughput
+//the script file holds one "tick pitch roll" per line, otherwise the board sways on its own
+void runHeadless(int ticks, float rate, const char* scriptPath) {
+    std::vector<TiltKey> script;
+    if(scriptPath != NULL) {
+        std::ifstream input(scriptPath);
+        if(!input.is_open()) {
+            cout << "Error: Unable to read tilt script " << scriptPath << endl;
+            return;
+        }
+        TiltKey key;
+        while(input >> key.tick >> key.pitch >> key.roll)
+            script.push_back(key);
+    }
+
+    float step = 1.0 / rate;
+    unsigned int nextKey = 0;
+    std::chrono::time_point<std::chrono::high_resolution_clock> start, end;
+    start = std::chrono::high_resolution_clock::now();
+
+    for(int i = 0; i < ticks; i++) {
+        if(scriptPath == NULL) {
+            pitch = 0.1 * sin(0.7 * i * step);
+            roll = 0.1 * sin(1.3 * i * step);
+        }
+        while(nextKey < script.size() && script[nextKey].tick <= i) {
+            pitch = script[nextKey].pitch;
+            roll = script[nextKey].roll;
+            nextKey++;
+        }
+        pitchDEMO = pitch;
+        rollDEMO = roll;
+        if(updatePhysics(step, 0, currentControls()))
+            gameWon = true;
+    }
+
+    end = std::chrono::high_resolution_clock::now();
+    float seconds = std::chrono::duration_cast< std::chrono::duration<float> >(end-start).count();
+
+    btTransform transform;
+    ball01.rigidBody->getMotionState()->getWorldTransform(transform);
+    btVector3 pos = transform.getOrigin();
+
+    cout << "Ticks: " << ticks << " @ " << rate << " Hz (" << ticks * step << "s simulated)" << endl;
+    cout << "Wall time: " << seconds << "s" << endl;
+    cout << "Ticks/sec: " << ticks / seconds << " (" << ticks * step / seconds << "x realtime)" << endl;
+    cout << "Ball: <" << pos.x() << ", " << pos.y() << ", " << pos.z() << ">" << (gameWon ? " WON" : "") << endl;
+    if(multiMarble) {
+        marblesHome = 0;
+        for(unsigned int i = 0; i < marbles.size(); i++) {
+            if(atGoal(marbles[i]->getCenterOfMassTransform().getOrigin()))
+                marblesHome++;
+        }
+        cout << "Marbles: " << marbles.size() << " (" << marblesHome << " home)" << endl;
+    }
+}
+
+//steps the same scene with 1 to N physics threads and reports the speedup
+void runScaling(int ticks, float rate) {
+    float step = 1.0 / rate;
+    float baseline = 0.0;
+    std::chrono::time_point<std::chrono::high_resolution_clock> start, end;
+
+    cout << "Scaling: " << ticks << " ticks @ " << rate << " Hz with " << marbles.size() << " marbles" << endl;
+    cout << "Threads\tTicks/sec\tSpeedup\tEfficiency\tStolen jobs" << endl;
+    for(unsigned int threads = 1; threads <= physicsJobs->maxThreads(); threads++) {
+        physicsScheduler->setNumThreads(threads);
+        resetPhysicsScene();
+        unsigned long stolen = physicsJobs->stolenJobs();
+
+        start = std::chrono::high_resolution_clock::now();
+        for(int i = 0; i < ticks; i++) {
+            pitch = pitchDEMO = 0.1 * sin(0.7 * i * step);
+            roll = rollDEMO = 0.1 * sin(1.3 * i * step);
+            updatePhysics(step, 0, currentControls());
+        }
+        end = std::chrono::high_resolution_clock::now();
+
+        float ticksPerSecond = ticks / std::chrono::duration_cast< std::chrono::duration<float> >(end-start).count();
+        if(threads == 1)
+            baseline = ticksPerSecond;
+        cout << threads << "\t" << ticksPerSecond << "\t\t" << ticksPerSecond / baseline << "x\t"
+             << (int)(100.0 * ticksPerSecond / baseline / threads + 0.5) << "%\t\t"
+             << physicsJobs->stolenJobs() - stolen << endl;
+    }
+    if(physicsJobs->parallelLoops() == 0)
+        cout << "Bullet never ran a loop in parallel, it has to be built with BT_THREADSAFE" << endl;
+}
+
+//runs the same tilting with the mazes as triangles and then as convex pieces
+void runCollisionBench(int ticks, float rate) {
+    const char* names[2] = {"triangles", "convex"};
+    float step = 1.0 / rate;
+    std::chrono::time_point<std::chrono::high_resolution_clock> start;
+
+    cout << "Collision: " << ticks << " ticks @ " << rate << " Hz with " << marbles.size() << " marbles" << endl;
+    cout << "Shape\t\tms/step\tContacts/step\tDeepest\tFell through" << endl;
+    for(int mode = COLLISION_TRIANGLES; mode <= COLLISION_CONVEX; mode++) {
+        setMeshCollision(maze01, (CollisionMode)mode);
+        setMeshCollision(mazeDEMO, (CollisionMode)mode);
+        resetPhysicsScene();
+
+        float seconds = 0.0;
+        double contacts = 0.0;
+        float deepest = 0.0;
+        for(int i = 0; i < ticks; i++) {
+            pitch = pitchDEMO = 0.1 * sin(0.7 * i * step);
+            roll = rollDEMO = 0.1 * sin(1.3 * i * step);
+            start = std::chrono::high_resolution_clock::now();
+            updatePhysics(step, 0, currentControls());
+            seconds += std::chrono::duration_cast< std::chrono::duration<float> >(
+                           std::chrono::high_resolution_clock::now() - start).count();
+
+            //only the step is timed, not this
+            for(int m = 0; m < dispatcher->getNumManifolds(); m++) {
+                btPersistentManifold* manifold = dispatcher->getManifoldByIndexInternal(m);
+                contacts += manifold->getNumContacts();
+                for(int c = 0; c < manifold->getNumContacts(); c++)
+                    deepest = std::min(deepest, manifold->getContactPoint(c).getDistance());
+            }
+        }
+
+        //anything well under the boards went through them
+        int fell = 0;
+        if(ball01.rigidBody->getCenterOfMassTransform().getOrigin().y() < -2.0)
+            fell++;
+        if(ballDEMO.rigidBody->getCenterOfMassTransform().getOrigin().y() < -2.0)
+            fell++;
+        for(unsigned int i = 0; i < marbles.size(); i++) {
+            if(marbles[i]->getCenterOfMassTransform().getOrigin().y() < -2.0)
+                fell++;
+        }
+        cout << names[mode] << "\t" << seconds * 1000.0 / ticks << "\t" << contacts / ticks << "\t\t"
+             << -deepest << "\t" << fell << endl;
+    }
+}
+
+//swaps each board's collision triangles in under both mazes, all of them and
+//then simplified, and times the same tilting on each
+void runSimplifyBench(int ticks, float rate) {
+    const char* paths[3] = {"../bin/assets/maze.obj", "../bin/assets/maze1.obj", "../bin/assets/table.obj"};
+    float step = 1.0 / rate;
+    std::chrono::time_point<std::chrono::high_resolution_clock> start;
+    btCollisionShape* originals[2] = {maze01.rigidBody->getCollisionShape(), mazeDEMO.rigidBody->getCollisionShape()};
+
+    cout << "Simplify: " << ticks << " ticks @ " << rate << " Hz with " << marbles.size()
+         << " marbles, tolerance " << physicsTolerance << endl;
+    cout << "Board		Triangles	ms/step	Simplified	ms/step	Delta" << endl;
+    for(int p = 0; p < 3; p++) {
+        Object board = Object();
+        if(!readMesh(paths[p], board)) {
+            cout << "Simplify: skipping " << paths[p] << endl;
+            continue;
+        }
+
+        int triangles[2];
+        float ms[2];
+        for(int simplified = 0; simplified < 2; simplified++) {
+            btTriangleMesh* btMesh = buildPhysicsMesh(board, simplified ? physicsTolerance : -1.0f);
+            btBvhTriangleMeshShape* shape = new btBvhTriangleMeshShape(btMesh, true);
+            setBoardShape(maze01, shape);
+            setBoardShape(mazeDEMO, shape);
+            resetPhysicsScene();
+
+            float seconds = 0.0;
+            for(int i = 0; i < ticks; i++) {
+                pitch = pitchDEMO = 0.1 * sin(0.7 * i * step);
+                roll = rollDEMO = 0.1 * sin(1.3 * i * step);
+                start = std::chrono::high_resolution_clock::now();
+                updatePhysics(step, 0, currentControls());
+                seconds += std::chrono::duration_cast< std::chrono::duration<float> >(
+                               std::chrono::high_resolution_clock::now() - start).count();
+            }
+            triangles[simplified] = btMesh->getNumTriangles();
+            ms[simplified] = seconds * 1000.0 / ticks;
+
+            setBoardShape(maze01, originals[0]);
+            setBoardShape(mazeDEMO, originals[1]);
+            delete shape;
+            delete btMesh;
+        }
+        const char* name = strrchr(paths[p], '/') + 1;
+        cout << name << "\t" << triangles[0] << "\t\t" << ms[0] << "\t" << triangles[1] << "\t\t"
+             << ms[1] << "\t" << ms[1] - ms[0] << endl;
+        releaseObject(board);
+    }
+    resetPhysicsScene();
+}
+
+//bins the Rave Mode strobes each tick as seen from the front view, without and
+//with SSE, for a few light counts. Nothing here touches GL
+void runClusterBench(int ticks, float rate) {
+    const int counts[4] = {64, 128, 256, 512};
+    float step = 1.0 / rate;
+    std::chrono::time_point<std::chrono::high_resolution_clock> start;
+    glm::mat4 frontView = glm::lookAt(glm::vec3(0, 10.0, -10.0), glm::vec3(0.0, 0.0, 0.0), glm::vec3(0.0, 1.0, 0.0));
+    setProjection();
+    ClusterGrid plain;
+    plain.setProjection(projection[0][0], projection[1][1], NEAR_PLANE, FAR_PLANE);
+    plain.useSimd(false);
+    static LightData data;
+    initLights();//initializeHeadless() has no use for them otherwise
+
+    cout << "Clusters: " << CLUSTER_TILES_X << "x" << CLUSTER_TILES_Y << "x" << CLUSTER_SLICES << ", "
+         << ticks << " ticks @ " << rate << " Hz" << endl;
+    cout << "Lights	Plain ms	SSE ms	Speedup	Lights/cluster" << endl;
+    std::vector<PointLight> saved = raveLights;
+    for(int c = 0; c < 4; c++) {
+        raveLights.resize(counts[c], saved[0]);
+        float seconds[2] = {0.0, 0.0};
+        unsigned long binned = 0;
+        bool same = true;
+        for(int i = 0; i < ticks; i++) {
+            updateRaveLights(i * step, i % 5 == 0);
+            unsigned int count = eyeLights(raveLights, frontView, data);
+            ClusterGrid* grids[2] = {&plain, &clusters};
+            for(int g = 0; g < 2; g++) {
+                start = std::chrono::high_resolution_clock::now();
+                grids[g]->bin(&data.position[0][0], count);
+                seconds[g] += std::chrono::duration_cast< std::chrono::duration<float> >(
+                                  std::chrono::high_resolution_clock::now() - start).count();
+            }
+            same = same && plain.clusterCells() == clusters.clusterCells() && plain.lightIndices() == clusters.lightIndices();
+            binned += clusters.lightIndices().size();
+        }
+        cout << counts[c] << "\t" << seconds[0] * 1000.0 / ticks << "\t\t" << seconds[1] * 1000.0 / ticks << "\t"
+             << seconds[0] / seconds[1] << "x\t" << (float)binned / ticks / CLUSTER_COUNT << endl;
+        if(!same)
+            cout << "ERROR: the SSE bins differ from the plain ones" << endl;
+    }
+    raveLights = saved;
+}
+
+//puts the balls and marbles back where they started
+void resetPhysicsScene() {
+    btVector3 starts[2] = {btVector3(4.5,5.0,-4.2), btVector3(50.0,5.0,0.0)};
+    Object* balls[2] = {&ball01, &ballDEMO};
+    for(int i = 0; i < 2; i++) {
+        balls[i]->rigidBody->setCenterOfMassTransform(btTransform(btQuaternion(0,0,0,1), starts[i]));
+        balls[i]->rigidBody->setLinearVelocity(btVector3(0.0,0.0,0.0));
+        balls[i]->rigidBody->setAngularVelocity(btVector3(0.0,0.0,0.0));
+    }
+    if(multiMarble) {
+        clearMarbles();
+        spawnMarbles(marbleCount);
+    }
+    pitch = roll = pitchDEMO = rollDEMO = 0.0;
+    gameWon = false;
+}
+
+//the worker pool bullet's parallel loops run on, the calling thread counts as one
+void startPhysicsJobs() {
+    physicsThreads = bulletThreadLimit(physicsThreads);
+    physicsJobs = new JobSystem(physicsThreads);
+    physicsScheduler = new JobScheduler(*physicsJobs);
+    btSetTaskScheduler(physicsScheduler);
+    cout << "Physics: multi-threaded world on " << physicsScheduler->getNumThreads() << " threads" << endl;
+}
+
+//how busy the timer kept the CPU, printed however the window closes
+void reportPacing() {
+    cout << "Frame pacing: " << (int)(pacer.averageUtilisation() * 100.0 + 0.5) << "% of a core on average" << endl;
+}
+
+void cleanUp() {
+    // Clean up, Clean up
+    if(!headless) {
+        stopShaderWatcher();
+        clearShaderVariants();
+        glDeleteBuffers(1, &frameUbo);
+        glDeleteBuffers(1, &lightUbo);
+        glDeleteBuffers(1, &marbleUbo);
+        glDeleteTextures(1, &clusterCells);
+        glDeleteTextures(1, &clusterIndices);
+        glDeleteBuffers(1, &maze01.ubo);
+        glDeleteBuffers(1, &ball01.ubo);
+        glDeleteBuffers(1, &mazeDEMO.ubo);
+        glDeleteBuffers(1, &ballDEMO.ubo);
+        glDeleteBuffers(1, &marbleInstances);
+        if(!marbleVaos.empty())
+            glDeleteVertexArrays(marbleVaos.size(), &marbleVaos[0]);
+        if(gpuTimers) {
+            for(int i = 0; i < PHASE_COUNT; i++)
+                glDeleteQueries(GPU_QUERIES, profile[i].queries);
+        }
+        freeText(hudText);
+    }
+
+    // Clean up Bullet Stuff
+    quitPhysicsThread();
+    if(droppedSteps > 0)
+        cout << "Physics: dropped " << droppedSteps << " steps the thread could not catch up on" << endl;
+    cullTree.clear();
+    clearMarbles();
+    delete dynamicsWorld;
+    delete solver;
+    delete solverMt;
+    delete dispatcher;
+    delete collisionConfiguration;
+    delete broadphase;
+    if(physicsScheduler != NULL) {
+        if(headless)
+            btSetTaskScheduler(NULL);//otherwise the physics thread took it out on its way out
+        delete physicsScheduler;
+        delete physicsJobs;
+    }
+
+    // Shared meshes, textures and shapes go with their last object
+    releaseObject(maze01);
+    releaseObject(ball01);
+    releaseObject(mazeDEMO);
+    releaseObject(ballDEMO);
+}
+
+//returns the time delta
+float getDT() {
+    float ret;
+    t2 = std::chrono::high_resolution_clock::now();
+    ret = std::chrono::duration_cast< std::chrono::duration<float> >(t2-t1).count();
+    t1 = std::chrono::high_resolution_clock::now();
+    return ret;
+}  
+
+char* loadShader( const char* filename ) {
+    //declare temporary variables
+    char* temp;
+    std::ifstream input;
+    int length;
+
+    //return the loaded temporary file
+    input.open(filename); //open the file
+    input.seekg(0, input.end); //go to end 9of file
+    length = input.tellg(); //get end of file
+    input.seekg(0, input.beg); //go to beginning
+    temp = new char[length + 1]; //allocate memory, with room for the terminator
+    input.read(temp, length); //read into memory
+    input.close(); //close file
+    temp[length] = '\0'; //add null terminator
+    return temp; //return
+}
+
+
+//loads everything the game needs through a task graph, file reads, decodes and
+//BVH builds spread over the cores while anything touching GL runs on this thread
+bool loadAssets() {
+    std::chrono::time_point<std::chrono::high_resolution_clock> start, end;
+    start = std::chrono::high_resolution_clock::now();
+
+    Object* objects[4] = {&maze01, &ball01, &mazeDEMO, &ballDEMO};
+    const char* meshPaths[4] = {"../bin/assets/maze1.obj", "../bin/assets/ball1.obj",
+                                "../bin/assets/maze2.obj", "../bin/assets/ball1.obj"};
+    const char* texturePaths[4] = {"../bin/assets/wood.jpg", "../bin/assets/marble.jpg",
+                                   "../bin/assets/wood.jpg", "../bin/assets/marble.jpg"};
+    const char* texturePaths2[4] = {"../bin/assets/neonBoard.jpg", "../bin/assets/neonBall.jpg",
+                                    "../bin/assets/neonBoard.jpg", "../bin/assets/neonBall.jpg"};
+    const bool hasMeshShape[4] = {true, false, true, false};//the balls collide as spheres
+
+    //group the objects by file so each one is read once
+    std::map<std::string, MeshLoad> meshLoads;
+    std::map<std::string, TextureLoad> textureLoads;
+    for(int i = 0; i < 4; i++) {
+        MeshLoad &mesh = meshLoads[meshPaths[i]];
+        mesh.path = meshPaths[i];
+        mesh.objects.push_back(objects[i]);
+
+        //there is nothing to upload textures to when headless
+        if(headless)
+            continue;
+        TextureLoad &texture = textureLoads[texturePaths[i]];
+        texture.path = texturePaths[i];
+        texture.texture = 0;
+        texture.textures.push_back(&objects[i]->texture);
+        texture.keys.push_back(&objects[i]->textureKey);
+        TextureLoad &texture2 = textureLoads[texturePaths2[i]];
+        texture2.path = texturePaths2[i];
+        texture2.texture = 0;
+        texture2.textures.push_back(&objects[i]->_texture);
+        texture2.keys.push_back(&objects[i]->_textureKey);
+    }
+
+    //leave a core for this thread, it does the GL work
+    unsigned int cores = std::thread::hardware_concurrency();
+    TaskGraph graph(cores > 1 ? cores - 1 : 1);
+
+    //read mesh -> upload buffers
+    std::map<std::string, MeshLoad>::iterator mesh;
+    for(mesh = meshLoads.begin(); mesh != meshLoads.end(); mesh++) {
+        MeshLoad* load = &mesh->second;
+        load->task = graph.add(TaskGraph::CPU, [load]() { return readMeshes(*load); });
+        if(!headless) {
+            int upload = graph.add(TaskGraph::GL, [load]() { uploadMesh(*load->objects[0]); return true; });
+            graph.depend(upload, load->task);
+        }
+    }
+
+    //decode image -> upload texture
+    std::map<std::string, TextureLoad>::iterator texture;
+    for(texture = textureLoads.begin(); texture != textureLoads.end(); texture++) {
+        TextureLoad* load = &texture->second;
+        int decode = graph.add(TaskGraph::CPU, [load]() { return decodeTexture(*load); });
+        int upload = graph.add(TaskGraph::GL, [load]() { uploadTexture(*load); return true; });
+        graph.depend(upload, decode);
+    }
+
+    //read mesh -> build BVH -> create the world, the BVHs are the slowest part of startup
+    int physics = graph.add(TaskGraph::CPU, []() { initPhysics(); return true; });
+    for(int i = 0; i < 4; i++) {
+        if(!hasMeshShape[i])
+            continue;
+        Object* obj = objects[i];
+        int shape = graph.add(TaskGraph::CPU, [obj]() { acquireMeshShape(*obj); return true; });
+        graph.depend(shape, meshLoads[meshPaths[i]].task);
+        graph.depend(physics, shape);
+    }
+
+    //the shaders don't wait on anything
+    if(!headless)
+        graph.add(TaskGraph::GL, []() { return initShaders(); });
+
+    bool success = graph.run();
+
+    end = std::chrono::high_resolution_clock::now();
+    float seconds = std::chrono::duration_cast< std::chrono::duration<float> >(end-start).count();
+    cout << "Startup: " << seconds * 1000.0 << " ms with " << graph.workers() << " worker threads" << endl;
+    if(success)
+        cout << "Resources: " << resourceHits << " hits, " << resourceMisses << " misses, "
+             << resourceBytesSaved / 1024 << " KB not loaded twice" << endl;
+    return success;
+}
+
+//reads a file's mesh for the first object and hands it to the rest
+bool readMeshes(MeshLoad &load) {
+    if(!readMesh(load.path, *load.objects[0]))
+        return false;
+
+    std::lock_guard<std::mutex> lock(resourceMutex);
+    for(unsigned int i = 1; i < load.objects.size(); i++) {
+        Object &obj = *load.objects[i];
+        obj.meshKey = load.objects[0]->meshKey;
+        shareMesh(*findResource(obj.meshKey), obj);
+    }
+    return true;
+}
+
+//reads an .obj and builds its collision mesh, safe on any thread
+bool readMesh(const char* filePathOBJ, Object &obj) {
+    // Get mesh, shared with any object already using a file with the same contents
+    unsigned long long hash;
+    if(!meshSourceHash(filePathOBJ, hash)) {
+        cout << "Error: Unable to read in " << filePathOBJ << endl;
+        return false;
+    }
+    obj.meshKey = resourceKey(RESOURCE_MESH, hash);
+    {
+        std::lock_guard<std::mutex> lock(resourceMutex);
+        Resource* shared = findResource(obj.meshKey);
+        if(shared != NULL) {
+            shareMesh(*shared, obj);
+            return true;
+        }
+    }
+
+    // straight from the binary cache when it is still fresh, LODs and collision triangles included
+    void* mapping = NULL;
+    size_t mappingSize = 0;
+    const float* triangles = NULL;
+    unsigned int numTriangles = 0;
+    bool cached = loadMeshCache(filePathOBJ, obj, mapping, mappingSize, triangles, numTriangles);
+    if(!cached && !importOBJ(filePathOBJ, obj))
+        return false;
+
+    size_t bytes = 0;
+    for( unsigned int i=0; i<obj.numMeshes; i++ ) {
+        Vertex *geometry = obj.mesh[i].geometry;
+        //bounds for culling
+        for( int k=0; k<3; k++ ) {
+            obj.mesh[i].boundsMin[k] = obj.mesh[i].numVertices > 0 ? geometry[0].position[k] : 0.0f;
+            obj.mesh[i].boundsMax[k] = obj.mesh[i].boundsMin[k];
+        }
+        for( unsigned int j=1; j<obj.mesh[i].numVertices; j++ ) {
+            for( int k=0; k<3; k++ ) {
+                obj.mesh[i].boundsMin[k] = std::min(obj.mesh[i].boundsMin[k], geometry[j].position[k]);
+                obj.mesh[i].boundsMax[k] = std::max(obj.mesh[i].boundsMax[k], geometry[j].position[k]);
+            }
+        }
+        if(!cached)
+            buildLods(obj.mesh[i]);
+        //geometry lives once on the CPU and once on the GPU
+        bytes += 2 * (obj.mesh[i].numVertices * sizeof(Vertex) + (obj.mesh[i].numIndices + obj.mesh[i].numLodIndices) * sizeof(GLuint));
+    }
+
+    // Create bullet mesh for collision, plus the bullet copy. The cache is
+    // rewritten when it's new or its triangles were simplified with another tolerance
+    std::vector<float> simplified;
+    if(triangles == NULL) {
+        physicsTriangles(obj, physicsTolerance, simplified);
+        saveMeshCache(filePathOBJ, obj, simplified);
+        triangles = simplified.empty() ? NULL : &simplified[0];
+        numTriangles = simplified.size() / 9;
+    }
+    obj.btMesh = makePhysicsMesh(triangles, numTriangles);
+    bytes += obj.btMesh->getNumTriangles() * (3 * sizeof(btVector3) + 3 * sizeof(unsigned int));
+
+    std::lock_guard<std::mutex> lock(resourceMutex);
+    //a file with the same contents finished loading while we did, keep theirs
+    std::map<unsigned long long, Resource>::iterator it = resources.find(obj.meshKey);
+    if(it != resources.end()) {
+        it->second.refCount++;
+        freeMesh(obj.mesh, obj.numMeshes, obj.btMesh, mapping, mappingSize);
+        shareMesh(it->second, obj);
+        return true;
+    }
+
+    Resource &resource = addResource(obj.meshKey, RESOURCE_MESH, bytes);
+    resource.mesh = obj.mesh;
+    resource.numMeshes = obj.numMeshes;
+    resource.btMesh = obj.btMesh;
+    resource.mapping = mapping;
+    resource.mappingSize = mappingSize;
+    return true;
+}
 
-    //Create a Vertex Buffer object to store this vertex info on the GPU
-    bool ModelSuccess = loadOBJ("../bin/assets/maze1.obj", "../bin/assets/wood.jpg",
-                                         "../bin/assets/neonBoard.jpg", maze01);
-    if(ModelSuccess == false){
-      cout << "Object Loader failed. Aborting" << endl;
-      return 0;
-    }
-    ModelSuccess = loadOBJ("../bin/assets/ball1.obj", "../bin/assets/marble.jpg",
-                                        "../bin/assets/neonBall.jpg", ball01);
-    if(ModelSuccess == false){
-      cout << "Object Loader failed. Aborting" << endl;
-      return 0;
-    }    
-    //Create a Vertex Buffer object to store this vertex info on the GPU
-    ModelSuccess = loadOBJ("../bin/assets/maze2.obj", "../bin/assets/wood.jpg",
-                                         "../bin/assets/neonBoard.jpg", mazeDEMO);
-    if(ModelSuccess == false){
-      cout << "Object Loader failed. Aborting" << endl;
-      return 0;
-    }
-    ModelSuccess = loadOBJ("../bin/assets/ball1.obj", "../bin/assets/marble.jpg",
-                                        "../bin/assets/neonBall.jpg", ballDEMO);
-    if(ModelSuccess == false){
-      cout << "Object Loader failed. Aborting" << endl;
-      return 0;
-    }
-    //--Geometry done
-
-    //initialize physics
-    initPhysics();
+//decimates the mesh by half per level into lodIndices, stopping once a level
+//would be tiny or decimation stops paying. The vertices are shared by every level
+void buildLods(Mesh &mesh) {
+    mesh.numLods = 1;
+    mesh.lodFirst[0] = 0;
+    mesh.lodCount[0] = mesh.numIndices;
+    mesh.lodIndices = NULL;
+    mesh.numLodIndices = 0;
+    if(mesh.numFaces >> 1 < LOD_MIN_FACES)
+        return;
+
+    //the tolerance is the whole mesh, the face counts are what stop it.
+    //Each corner keeps the vertex whose normal suits its new face, uvs follow along
+    GLfloat size = 0.0;
+    for(int k = 0; k < 3; k++)
+        size = std::max(size, mesh.boundsMax[k] - mesh.boundsMin[k]);
+    int normalOffset = mesh.hasNormals ? (offsetof(Vertex, normal) - offsetof(Vertex, position)) / sizeof(GLfloat) : -1;
+    simplify::Decimator decimator(mesh.geometry[0].position, sizeof(Vertex) / sizeof(GLfloat), mesh.numVertices,
+                                  mesh.indices, mesh.numIndices, normalOffset);
+    std::vector<GLuint> levels, level;
+    unsigned int faces = mesh.numFaces;
+    for(unsigned int i = 1; i < MAX_LODS; i++) {
+        unsigned int target = mesh.numFaces >> i;
+        if(target < LOD_MIN_FACES)
+            break;
+        decimator.run(size, target);
+        if(decimator.faceCount() > faces * 3 / 4)
+            break;
+        faces = decimator.faceCount();
+        decimator.outputIndices(level);
+        mesh.lodFirst[i] = mesh.numIndices + levels.size();
+        mesh.lodCount[i] = level.size();
+        levels.insert(levels.end(), level.begin(), level.end());
+        mesh.numLods++;
+    }
+    if(levels.empty())
+        return;
+    mesh.numLodIndices = levels.size();
+    mesh.lodIndices = new GLuint[levels.size()];
+    std::copy(levels.begin(), levels.end(), mesh.lodIndices);
+}
+
+//collision triangles for an object, simplified unless tolerance is negative.
+//The render meshes keep every triangle either way
+btTriangleMesh* buildPhysicsMesh(const Object &obj, float tolerance) {
+    std::vector<float> triangles;
+    physicsTriangles(obj, tolerance, triangles);
+    return makePhysicsMesh(triangles.empty() ? NULL : &triangles[0], triangles.size() / 9);
+}
+
+//an object's collision triangles, 9 floats each, simplified unless tolerance is negative
+void physicsTriangles(const Object &obj, float tolerance, std::vector<float> &triangles) {
+    triangles.clear();
+    for(unsigned int i = 0; i < obj.numMeshes; i++) {
+        for(unsigned int j = 0; j < 3 * obj.mesh[i].numFaces; j++) {
+            const GLfloat* position = obj.mesh[i].geometry[obj.mesh[i].indices[j]].position;
+            triangles.insert(triangles.end(), position, position + 3);
+        }
+    }
+    if(tolerance >= 0.0) {
+        std::vector<float> simplified;
+        simplifyMesh(triangles, tolerance, simplified);
+        cout << "Physics mesh: " << triangles.size() / 9 << " triangles -> " << simplified.size() / 9 << endl;
+        triangles.swap(simplified);
+    }
+}
+
+btTriangleMesh* makePhysicsMesh(const float* triangles, unsigned int numTriangles) {
+    btTriangleMesh* btMesh = new btTriangleMesh();
+    for(unsigned int i = 0; i < 9 * numTriangles; i += 9) {
+        btMesh->addTriangle(btVector3(triangles[i+0], triangles[i+1], triangles[i+2]),
+                            btVector3(triangles[i+3], triangles[i+4], triangles[i+5]),
+                            btVector3(triangles[i+6], triangles[i+7], triangles[i+8]), false);
+    }
+    return btMesh;
+}
+
+//puts an object's meshes on the GPU unless whoever shares them already did, GL thread only
+void uploadMesh(Object &obj) {
+    for(unsigned int i=0; i<obj.numMeshes; i++ ) {
+        if(obj.mesh[i].vbo_geometry != 0)
+            continue;
+        glGenBuffers(1, &(obj.mesh[i].vbo_geometry));
+        glBindBuffer(GL_ARRAY_BUFFER, obj.mesh[i].vbo_geometry);
+        glBufferData(GL_ARRAY_BUFFER, obj.mesh[i].numVertices * sizeof(Vertex), &(obj.mesh[i].geometry[0]), GL_STATIC_DRAW);
+
+        glGenBuffers(1, &(obj.mesh[i].ibo_geometry));
+
+        //record the layout once, drawing only has to bind the VAO
+        glGenVertexArrays(1, &(obj.mesh[i].vao));
+        glBindVertexArray(obj.mesh[i].vao);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj.mesh[i].ibo_geometry);
+        //the mesh's own indices, then its coarser levels
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, (obj.mesh[i].numIndices + obj.mesh[i].numLodIndices) * sizeof(GLuint), NULL, GL_STATIC_DRAW);
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, obj.mesh[i].numIndices * sizeof(GLuint), &(obj.mesh[i].indices[0]));
+        if(obj.mesh[i].numLodIndices > 0)
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, obj.mesh[i].numIndices * sizeof(GLuint),
+                            obj.mesh[i].numLodIndices * sizeof(GLuint), obj.mesh[i].lodIndices);
+        setVertexLayout();
+        glBindVertexArray(0);
+    }
+}
+
+//points the bound VAO at the Vertex layout in the bound GL_ARRAY_BUFFER
+void setVertexLayout() {
+    glEnableVertexAttribArray(ATTRIB_POSITION);
+    glEnableVertexAttribArray(ATTRIB_UV);
+    glEnableVertexAttribArray(ATTRIB_NORMAL);
+    glVertexAttribPointer(ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex,position));
+    glVertexAttribPointer(ATTRIB_UV, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex,uv));
+    glVertexAttribPointer(ATTRIB_NORMAL, 3, GL_FLOAT, GL_TRUE, sizeof(Vertex), (void*)offsetof(Vertex,normal));
+}
+
+void shareMesh(const Resource &resource, Object &obj) {
+    obj.mesh = resource.mesh;
+    obj.numMeshes = resource.numMeshes;
+    obj.btMesh = resource.btMesh;
+}
+
+//frees the CPU side of a mesh, the geometry either sits in the cache mapping or was allocated
+void freeMesh(Mesh* mesh, unsigned int numMeshes, btTriangleMesh* btMesh, void* mapping, size_t mappingSize) {
+    for(unsigned int i = 0; i < numMeshes; i++) {
+        if(mapping == NULL) {
+            delete[] mesh[i].lodIndices;
+            delete[] mesh[i].geometry;
+            delete[] mesh[i].indices;
+        }
+    }
+    if(mapping != NULL)
+        munmap(mapping, mappingSize);
+    delete[] mesh;
+    delete btMesh;
+}
+
+//reads the meshes out of an .obj with assimp
+bool importOBJ(const char* filePathOBJ, Object &obj) {
+    Assimp::Importer importer;
+    const aiScene *scene = importer.ReadFile(filePathOBJ, aiProcess_Triangulate |
+                                                 aiProcess_JoinIdenticalVertices | //share vertices between faces
+                                                 aiProcess_ImproveCacheLocality); //reorder faces for the post-transform cache
+    //return false if there is a scene error
+    if(scene == NULL){
+        cout << "Error: Unable to read in " << filePathOBJ << endl;
+        const char* msg = importer.GetErrorString();
+        cout << msg << endl;
+        return false;
+    }
+
+    obj.numMeshes = scene->mNumMeshes;
+    obj.mesh = new Mesh[obj.numMeshes]();//zeroed, no buffers yet
+
+    unsigned int oldVertices = 0;
+    unsigned int newVertices = 0;
+    unsigned int newIndices = 0;
+
+    for( unsigned int i=0; i<scene->mNumMeshes; i++ ) {
+        aiMesh *tmpMesh = scene->mMeshes[i]; //aiMesh temporary to give to struct
+        obj.mesh[i].geometry = new Vertex[tmpMesh->mNumVertices]; //one per unique vertex
+        obj.mesh[i].numVertices = tmpMesh->mNumVertices;
+        obj.mesh[i].numFaces = tmpMesh->mNumFaces;
+        obj.mesh[i].numIndices = tmpMesh->mNumFaces * 3;
+        obj.mesh[i].indices = new GLuint[obj.mesh[i].numIndices];
+        obj.mesh[i].hasNormals = tmpMesh->HasNormals();
+
+        for( unsigned int j=0; j<tmpMesh->mNumVertices; j++ ) {
+            //load vertex positions
+            obj.mesh[i].geometry[j].position[0] = tmpMesh->mVertices[j].x;
+            obj.mesh[i].geometry[j].position[1] = tmpMesh->mVertices[j].y;
+            obj.mesh[i].geometry[j].position[2] = tmpMesh->mVertices[j].z;
+            //load vertex uv
+            obj.mesh[i].geometry[j].uv[0] = tmpMesh->mTextureCoords[0][j].x;
+            obj.mesh[i].geometry[j].uv[1] = tmpMesh->mTextureCoords[0][j].y;
+            //load vertex normal
+            if(tmpMesh->HasNormals()) {
+                obj.mesh[i].geometry[j].normal[0] = tmpMesh->mNormals[j].x;
+                obj.mesh[i].geometry[j].normal[1] = tmpMesh->mNormals[j].y;
+                obj.mesh[i].geometry[j].normal[2] = tmpMesh->mNormals[j].z;
+            }
+        }
+
+        //faces stay in the order assimp optimized them for
+        for( unsigned int j=0; j<tmpMesh->mNumFaces; j++ ) {
+            aiFace &tmpFace = tmpMesh->mFaces[j];
+            for( unsigned int k=0; k<3; k++ ) {
+                obj.mesh[i].indices[3*j+k] = tmpFace.mIndices[k];
+            }
+        }
 
-    GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-    GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+        oldVertices += obj.mesh[i].numFaces * 3;
+        newVertices += obj.mesh[i].numVertices;
+        newIndices += obj.mesh[i].numIndices;
+    }
 
-    //Shader Sources
-    // Put these into files and write a loader in the future
-    // Note the added uniform!
+    cout << filePathOBJ << ": " << oldVertices << " vertices (" << oldVertices * sizeof(Vertex) << " bytes) -> "
+         << newVertices << " vertices + " << newIndices << " indices ("
+         << newVertices * sizeof(Vertex) + newIndices * sizeof(GLuint) << " bytes)" << endl;
 
-    //Load Vertex Shader
-    const char* vs = loadShader(VERTEX_SHADER);
-    const char* fs = loadShader(FRAGMENT_SHADER);
+    return true;
+}
 
-    //compile the shaders
-    GLint shader_status;
+//64 bit FNV-1a, good enough to tell files apart
+unsigned long long hashBytes(const void* data, size_t length, unsigned long long hash) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    for(size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
 
-    // Vertex shader first
-    glShaderSource(vertex_shader, 1, &vs, NULL);
-    glCompileShader(vertex_shader);
-    //check the compile status
-    glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &shader_status);
-    if(!shader_status)
-    {
-        std::cerr << "[F] FAILED TO COMPILE VERTEX SHADER!" << std::endl;
+//hashes a whole file, returns false if it can't be read
+bool hashFile(const char* filePath, unsigned long long &hash) {
+    int fd = open(filePath, O_RDONLY);
+    if(fd < 0)
         return false;
+    struct stat info;
+    if(fstat(fd, &info) != 0) {
+        close(fd);
+        return false;
+    }
+    hash = FNV_OFFSET;
+    if(info.st_size > 0) {
+        void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        hash = hashBytes(data, info.st_size, hash);
+        munmap(data, info.st_size);
     }
+    close(fd);
+    return true;
+}
 
-    // Now the Fragment shader
-    glShaderSource(fragment_shader, 1, &fs, NULL);
-    glCompileShader(fragment_shader);
-    //check the compile status
-    glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &shader_status);
-    if(!shader_status)
-    {
-        std::cerr << "[F] FAILED TO COMPILE FRAGMENT SHADER!" << std::endl;
+//content hash of an .obj, read from its mesh cache header when that is
+//still fresh so warm starts don't have to touch the .obj at all
+bool meshSourceHash(const char* filePathOBJ, unsigned long long &hash) {
+    std::string cachePath = std::string(filePathOBJ) + ".mesh";
+    struct stat source;
+    if(stat(filePathOBJ, &source) != 0)
         return false;
+
+    MeshCacheHeader header;
+    std::ifstream input(cachePath.c_str(), std::ios::binary);
+    if(input.read((char*)&header, sizeof(header)) &&
+       header.magic == MESH_CACHE_MAGIC &&
+       header.version == MESH_CACHE_VERSION &&
+       header.sourceSize == (unsigned long long)source.st_size &&
+       header.sourceMtime == (long long)source.st_mtime) {
+        hash = header.sourceHash;
+        return true;
     }
+    return hashFile(filePathOBJ, hash);
+}
 
-    //Now we link the 2 shader objects into a program
-    //This program is what is run on the GPU
-    program = glCreateProgram();
-    glAttachShader(program, vertex_shader);
-    glAttachShader(program, fragment_shader);
-    glLinkProgram(program);
-    //check if everything linked ok
-    glGetProgramiv(program, GL_LINK_STATUS, &shader_status);
-    if(!shader_status)
-    {
-        std::cerr << "[F] THE SHADER PROGRAM FAILED TO LINK" << std::endl;
+//maps "<obj>.mesh" and points the meshes straight at it
+//the cache is trusted if the .obj size and mtime match, or its contents hash the same.
+//triangles stays NULL if the collision triangles were simplified with another tolerance
+bool loadMeshCache(const char* filePathOBJ, Object &obj, void* &mapping, size_t &mappingSize,
+                   const float* &triangles, unsigned int &numTriangles) {
+    std::string cachePath = std::string(filePathOBJ) + ".mesh";
+    struct stat source;
+    if(stat(filePathOBJ, &source) != 0)
         return false;
-    }
 
-    //Now we set the locations of the attributes and uniforms
-    //this allows us to access them easily while rendering
-    loc_position = glGetAttribLocation(program, const_cast<const char*>("v_position"));
-    if(loc_position == -1)
-    {
-        std::cerr << "[F] POSITION NOT FOUND" << std::endl;
+    int fd = open(cachePath.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+    struct stat info;
+    if(fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(MeshCacheHeader)) {
+        close(fd);
         return false;
     }
-
-    loc_uv = glGetAttribLocation(program, const_cast<const char*>("v_uv"));
-    if(loc_uv == -1)
-    {
-        std::cerr << "[F] V_UV NOT FOUND" << std::endl;
+    char* data = (char*)mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(data == MAP_FAILED) {
+        close(fd);
         return false;
     }
 
-    loc_normal = glGetAttribLocation(program, const_cast<const char*>("v_normal"));
-    if(loc_normal == -1)
-    {
-        std::cerr << "[F] NORMAL NOT FOUND" << std::endl;
-        return false;
+    MeshCacheHeader header;
+    memcpy(&header, data, sizeof(header));
+    bool valid = header.magic == MESH_CACHE_MAGIC &&
+                 header.version == MESH_CACHE_VERSION &&
+                 header.vertexSize == sizeof(Vertex) &&
+                 header.sourceSize == (unsigned long long)source.st_size;
+    if(valid && header.sourceMtime != (long long)source.st_mtime) {
+        //touched but maybe not changed (a fresh checkout), check the contents
+        unsigned long long hash;
+        valid = hashFile(filePathOBJ, hash) && hash == header.sourceHash;
+        int writeFd = valid ? open(cachePath.c_str(), O_WRONLY) : -1;
+        if(writeFd >= 0) {
+            header.sourceMtime = source.st_mtime;
+            if(pwrite(writeFd, &header, sizeof(header), 0) != sizeof(header))
+                cout << "Warning: Unable to refresh " << cachePath << endl;
+            close(writeFd);
+        }
     }
+    close(fd);
 
-    loc_bools = glGetUniformLocation(program, const_cast<const char*>("toggles"));
-    if(loc_bools == -1)
-    {
-        std::cerr << "[F] TOGGLES NOT FOUND" << std::endl;
+    //make sure every range lies inside the file before trusting it
+    size_t offset = sizeof(MeshCacheHeader) + header.numMeshes * sizeof(MeshCacheEntry);
+    if(valid && offset <= (size_t)info.st_size) {
+        MeshCacheEntry* entries = (MeshCacheEntry*)(data + sizeof(MeshCacheHeader));
+        for(unsigned int i = 0; i < header.numMeshes && valid; i++) {
+            offset += (size_t)entries[i].numVertices * sizeof(Vertex) +
+                      ((size_t)entries[i].numIndices + entries[i].numLodIndices) * sizeof(GLuint);
+            valid = offset <= (size_t)info.st_size && entries[i].numIndices % 3 == 0 &&
+                    entries[i].numLods >= 1 && entries[i].numLods <= MAX_LODS;
+            for(unsigned int k = 0; k < entries[i].numLods && valid; k++)
+                valid = (size_t)entries[i].lodFirst[k] + entries[i].lodCount[k] <=
+                        (size_t)entries[i].numIndices + entries[i].numLodIndices;
+        }
+        valid = valid && offset + (size_t)header.numPhysicsTriangles * 9 * sizeof(float) <= (size_t)info.st_size;
+    }
+    else
+        valid = false;
+    if(!valid) {
+        munmap(data, info.st_size);
         return false;
     }
 
-    loc_mvpmat = glGetUniformLocation(program, "mvpMatrix");
-    if(loc_mvpmat == -1)
-    {
-        std::cerr << "[F] MVPMATRIX NOT FOUND" << std::endl;
+    //the mapping stays alive for as long as the meshes do
+    mapping = data;
+    mappingSize = info.st_size;
+    MeshCacheEntry* entries = (MeshCacheEntry*)(data + sizeof(MeshCacheHeader));
+    offset = sizeof(MeshCacheHeader) + header.numMeshes * sizeof(MeshCacheEntry);
+    obj.numMeshes = header.numMeshes;
+    obj.mesh = new Mesh[obj.numMeshes]();//zeroed, no buffers yet
+    for(unsigned int i = 0; i < obj.numMeshes; i++) {
+        obj.mesh[i].numVertices = entries[i].numVertices;
+        obj.mesh[i].numIndices = entries[i].numIndices;
+        obj.mesh[i].numFaces = entries[i].numIndices / 3;
+        obj.mesh[i].hasNormals = entries[i].hasNormals;
+        obj.mesh[i].geometry = (Vertex*)(data + offset);
+        offset += entries[i].numVertices * sizeof(Vertex);
+        obj.mesh[i].indices = (GLuint*)(data + offset);
+        offset += entries[i].numIndices * sizeof(GLuint);
+        obj.mesh[i].numLods = entries[i].numLods;
+        for(unsigned int k = 0; k < entries[i].numLods; k++) {
+            obj.mesh[i].lodFirst[k] = entries[i].lodFirst[k];
+            obj.mesh[i].lodCount[k] = entries[i].lodCount[k];
+        }
+        obj.mesh[i].numLodIndices = entries[i].numLodIndices;
+        obj.mesh[i].lodIndices = entries[i].numLodIndices > 0 ? (GLuint*)(data + offset) : NULL;
+        offset += entries[i].numLodIndices * sizeof(GLuint);
+    }
+    triangles = NULL;
+    numTriangles = 0;
+    if(header.physicsTolerance == physicsTolerance) {
+        triangles = (const float*)(data + offset);
+        numTriangles = header.numPhysicsTriangles;
+    }
+    return true;
+}
+
+//writes "<obj>.mesh" for the next launch, a failure here only costs startup time
+void saveMeshCache(const char* filePathOBJ, const Object &obj, const std::vector<float> &triangles) {
+    std::string cachePath = std::string(filePathOBJ) + ".mesh";
+    std::string tempPath = cachePath + ".tmp";
+    struct stat source;
+    MeshCacheHeader header;
+    if(stat(filePathOBJ, &source) != 0 || !hashFile(filePathOBJ, header.sourceHash)) {
+        cout << "Warning: Unable to cache " << filePathOBJ << endl;
+        return;
+    }
+    header.magic = MESH_CACHE_MAGIC;
+    header.version = MESH_CACHE_VERSION;
+    header.vertexSize = sizeof(Vertex);
+    header.numMeshes = obj.numMeshes;
+    header.sourceSize = source.st_size;
+    header.sourceMtime = source.st_mtime;
+    header.physicsTolerance = physicsTolerance;
+    header.numPhysicsTriangles = triangles.size() / 9;
+
+    std::ofstream output(tempPath.c_str(), std::ios::binary);
+    output.write((const char*)&header, sizeof(header));
+    for(unsigned int i = 0; i < obj.numMeshes; i++) {
+        MeshCacheEntry entry;
+        entry.numVertices = obj.mesh[i].numVertices;
+        entry.numIndices = obj.mesh[i].numIndices;
+        entry.hasNormals = obj.mesh[i].hasNormals;
+        entry.numLods = obj.mesh[i].numLods;
+        entry.numLodIndices = obj.mesh[i].numLodIndices;
+        for(unsigned int k = 0; k < MAX_LODS; k++) {
+            entry.lodFirst[k] = k < obj.mesh[i].numLods ? obj.mesh[i].lodFirst[k] : 0;
+            entry.lodCount[k] = k < obj.mesh[i].numLods ? obj.mesh[i].lodCount[k] : 0;
+        }
+        output.write((const char*)&entry, sizeof(entry));
+    }
+    for(unsigned int i = 0; i < obj.numMeshes; i++) {
+        output.write((const char*)obj.mesh[i].geometry, obj.mesh[i].numVertices * sizeof(Vertex));
+        output.write((const char*)obj.mesh[i].indices, obj.mesh[i].numIndices * sizeof(GLuint));
+        output.write((const char*)obj.mesh[i].lodIndices, obj.mesh[i].numLodIndices * sizeof(GLuint));
+    }
+    if(!triangles.empty())
+        output.write((const char*)&triangles[0], triangles.size() * sizeof(float));
+    output.close();
+
+    //rename so a half written cache is never picked up
+    if(!output || rename(tempPath.c_str(), cachePath.c_str()) != 0) {
+        cout << "Warning: Unable to write " << cachePath << endl;
+        remove(tempPath.c_str());
+    }
+}
+
+//decodes an image into memory for uploadTexture, safe on any thread
+//textures are shared by content too, ball01 and ballDEMO use the same images
+bool decodeTexture(TextureLoad &load) {
+    unsigned long long hash;
+    if(!hashFile(load.path, hash)) {
+        cout << "Error: Unable to load texture " << load.path << endl;
         return false;
     }
-    loc_modelviewmat = glGetUniformLocation(program, const_cast<const char*>("modelViewMatrix"));
-    if(loc_modelviewmat == -1)
+    load.key = resourceKey(RESOURCE_TEXTURE, hash);
+    load.cooked = false;
     {
-        std::cerr << "[F] MODELVIEW MATRIX NOT FOUND" << std::endl;
-        return false;
+        std::lock_guard<std::mutex> lock(resourceMutex);
+        Resource* shared = findResource(load.key);
+        if(shared != NULL) {
+            load.texture = shared->texture;
+            return true;
+        }
     }
-    // loc_projmat = glGetUniformLocation(program, const_cast<const char*>("projectionMatrix"));
-    // if(loc_projmat == -1)
-    // {
-    //     std::cerr << "[F] PROJECTION MATRIX NOT FOUND" << std::endl;
-    //     return false;
-    // }
-    gSampler = glGetUniformLocation(program, const_cast<const char*>("gSampler"));
-    if(gSampler == -1){
-        std::cerr << "[F] LMAG NOT FOUND" << std::endl;
+
+    //the mip chain texcook left next to the image beats decoding it, as long as
+    //it was cooked from this version of the image
+    std::string cookedPath = std::string(load.path) + ".dds";
+    if(compressedTextures && readDDS(cookedPath.c_str(), load.dds)) {
+        if(load.dds.sourceHash == hash) {
+            load.cooked = true;
+            return true;
+        }
+        cout << "Warning: " << cookedPath << " is out of date, using " << load.path << endl;
+    }
+
+    std::lock_guard<std::mutex> lock(ilMutex);
+    ILuint image;
+    ilGenImages(1, &image);
+    ilBindImage(image);
+    bool success;
+    success = ilLoadImage((const ILstring)load.path);
+    if(!success) {
+        cout << "Error: Unable to load texture " << load.path << endl;
+        ilDeleteImages(1, &image);
         return false;
     }
-    loc_RAVEMODE = glGetUniformLocation(program, const_cast<const char*>("RAVEMODE"));
-    if(loc_RAVEMODE == -1){
-        std::cerr << "[F] ERROR WITH RAVEMODE!!!!" << std::endl;
+    success = ilConvertImage(IL_RGB, IL_UNSIGNED_BYTE);
+    if(!success) {
+        cout << "Error: Unable to convert image " << load.path << endl;
+        ilDeleteImages(1, &image);
         return false;
     }
-    //--Init the view and projection matrices
-    //  if you will be having a moving camera the view matrix will need to more dynamic
-    //  ...Like you should update it before you render more dynamic 
-    //  for this project having them static will be fine
-    view = glm::lookAt( glm::vec3(0, 10.0, -10.0), //Eye Position
-                        glm::vec3(0.0, 0.0, 0.0), //Focus point
-                        glm::vec3(0.0, 1.0, 0.0)); //Positive Y is up
+    load.width = ilGetInteger(IL_IMAGE_WIDTH);
+    load.height = ilGetInteger(IL_IMAGE_HEIGHT);
+    load.bpp = ilGetInteger(IL_IMAGE_BPP);
+    load.format = ilGetInteger(IL_IMAGE_FORMAT);
+    ILubyte* data = ilGetData();
+    load.pixels.assign(data, data + load.width * load.height * load.bpp);
+    ilDeleteImages(1, &image);
+    return true;
+}
 
-    projection = glm::perspective( 45.0f, //the FoV typically 90 degrees is good which is what this is set to
-                                   float(windowWidth)/float(windowHeight), //Aspect Ratio, so Circles stay Circular
-                                   0.01f, //Distance to the near plane, normally a small value like this
-                                   100.0f); //Distance to the far plane, 
+//uploads a decoded image and gives it to every object using it, GL thread only
+void uploadTexture(TextureLoad &load) {
+    if(load.texture == 0) {
+        //only this thread adds textures, so a file with the same contents may have beaten us here
+        std::unique_lock<std::mutex> lock(resourceMutex);
+        std::map<unsigned long long, Resource>::iterator it = resources.find(load.key);
+        if(it != resources.end()) {
+            it->second.refCount++;
+            load.texture = it->second.texture;
+        }
+        lock.unlock();
+    }
+    if(load.texture == 0) {
+        size_t bytes;
+        glGenTextures(1, &load.texture);
+        glBindTexture(GL_TEXTURE_2D, load.texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        if(load.cooked) {
+            //already compressed, every level goes up as is
+            GLenum format = load.dds.fourCC == DDS_FOURCC_DXT1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+                                                               : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, load.dds.levels - 1);
+            size_t offset = 0;
+            for(unsigned int i = 0; i < load.dds.levels; i++) {
+                unsigned int width = ddsLevelDimension(load.dds.width, i);
+                unsigned int height = ddsLevelDimension(load.dds.height, i);
+                size_t size = ddsLevelSize(width, height, load.dds.fourCC);
+                glCompressedTexImage2D(GL_TEXTURE_2D, i, format, width, height, 0, size, &load.dds.data[offset]);
+                offset += size;
+            }
+            bytes = load.dds.data.size();
+        }
+        else {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexImage2D(GL_TEXTURE_2D, 0, load.bpp, load.width, load.height, 0, load.format, GL_UNSIGNED_BYTE,
+                &load.pixels[0]);
+            bytes = load.pixels.size();
+        }
 
-    //enable depth testing
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LESS);
-    glEnable(GL_CULL_FACE);
+        std::lock_guard<std::mutex> lock(resourceMutex);
+        addResource(load.key, RESOURCE_TEXTURE, bytes).texture = load.texture;
+    }
+    load.pixels.clear();
+    load.dds.data.clear();
 
-    //and its done
-    return true;
+    //the first object has the reference taken above, the rest take their own
+    std::lock_guard<std::mutex> lock(resourceMutex);
+    for(unsigned int i = 0; i < load.textures.size(); i++) {
+        if(i > 0)
+            findResource(load.key);
+        *load.textures[i] = load.texture;
+        *load.keys[i] = load.key;
+    }
 }
 
-void cleanUp() {
-    // Clean up, Clean up
-    glDeleteProgram(program);
+//keys never collide across types even if the contents hash the same
+unsigned long long resourceKey(ResourceType type, unsigned long long hash) {
+    return hashBytes(&type, sizeof(type), hash);
+}
 
-    // Clean up Bullet Stuff
-    delete dynamicsWorld;
-    delete solver;
-    delete dispatcher;
-    delete collisionConfiguration;
-    delete broadphase;
+//takes another reference to a loaded resource, NULL if it still needs loading
+//this and addResource expect resourceMutex to be held
+Resource* findResource(unsigned long long key) {
+    std::map<unsigned long long, Resource>::iterator it = resources.find(key);
+    if(it == resources.end()) {
+        resourceMisses++;
+        return NULL;
+    }
+    it->second.refCount++;
+    resourceHits++;
+    resourceBytesSaved += it->second.bytes;
+    return &it->second;
 }
 
-//returns the time delta
-float getDT() {
-    float ret;
-    t2 = std::chrono::high_resolution_clock::now();
-    ret = std::chrono::duration_cast< std::chrono::duration<float> >(t2-t1).count();
-    t1 = std::chrono::high_resolution_clock::now();
-    return ret;
-}  
+//registers a freshly loaded resource with one reference, the caller fills it in
+Resource& addResource(unsigned long long key, ResourceType type, size_t bytes) {
+    Resource &resource = resources[key];
+    memset(&resource, 0, sizeof(resource));
+    resource.type = type;
+    resource.refCount = 1;
+    resource.bytes = bytes;
+    return resource;
+}
 
-char* loadShader( const char* filename ) {
-    //declare temporary variables
-    char* temp;
-    std::ifstream input;
-    int length;
+//drops a reference and frees the resource with the last one
+void releaseResource(unsigned long long key) {
+    std::map<unsigned long long, Resource>::iterator it = resources.find(key);
+    if(it == resources.end() || --it->second.refCount > 0)
+        return;
 
-    //return the loaded temporary file
-    input.open(filename); //open the file
-    input.seekg(0, input.end); //go to end 9of file
-    length = input.tellg(); //get end of file
-    input.seekg(0, input.beg); //go to beginning
-    temp = new char[length]; //allocate memory
-    input.read(temp, length); //read into memory
-    input.close(); //close file
-    temp[length] = '\0'; //add null terminator
-    return temp; //return
+    Resource &resource = it->second;
+    switch(resource.type) {
+    case RESOURCE_MESH:
+        for(unsigned int i = 0; i < resource.numMeshes && !headless; i++) {
+            glDeleteVertexArrays(1, &resource.mesh[i].vao);
+            glDeleteBuffers(1, &resource.mesh[i].vbo_geometry);
+            glDeleteBuffers(1, &resource.mesh[i].ibo_geometry);
+        }
+        freeMesh(resource.mesh, resource.numMeshes, resource.btMesh, resource.mapping, resource.mappingSize);
+        break;
+    case RESOURCE_TEXTURE:
+        glDeleteTextures(1, &resource.texture);
+        break;
+    case RESOURCE_SHAPE:
+        //a compound doesn't own its pieces
+        if(resource.shape->isCompound()) {
+            btCompoundShape* compound = static_cast<btCompoundShape*>(resource.shape);
+            for(int i = 0; i < compound->getNumChildShapes(); i++)
+                delete compound->getChildShape(i);
+        }
+        delete resource.shape;
+        btAlignedFree(resource.bvhBuffer);
+        break;
+    }
+    resources.erase(it);
 }
 
+void releaseObject(Object &obj) {
+    releaseResource(obj.shapeKey);
+    releaseResource(obj.meshKey);
+    releaseResource(obj.textureKey);
+    releaseResource(obj._textureKey);
+}
 
-bool loadOBJ(const char* filePathOBJ, const char* filePathTex,const char* filePathTex2, Object &obj) {
-    //read file
-    srand(time(NULL));
-    Assimp::Importer importer;
-    const aiScene *scene = importer.ReadFile(filePathOBJ, aiProcess_Triangulate);
-    //return false if there is a scene error
-    if(scene == NULL){
-        cout << "Error: Unable to read in " << filePathOBJ << endl;
-        const char* msg = importer.GetErrorString();
-        cout << msg << endl;
-        return false;
+//one shape per distinct mesh and collision mode, mazes built from the same file share it
+//safe on any thread, and calling it again for the same object takes no new reference
+btCollisionShape* acquireMeshShape(Object &obj) {
+    const char tag[] = "convex";
+    unsigned long long key = resourceKey(RESOURCE_SHAPE, obj.collision == COLLISION_CONVEX ?
+                                         hashBytes(tag, sizeof(tag), obj.meshKey) : obj.meshKey);
+    {
+        std::lock_guard<std::mutex> lock(resourceMutex);
+        if(obj.shapeKey == key)
+            return resources[key].shape;
+        obj.shapeKey = key;
+        Resource* shared = findResource(key);
+        if(shared != NULL)
+            return shared->shape;
     }
 
-    // Get Materials (textures)
-    bool success;
-    success = ilLoadImage((const ILstring)filePathTex);
-    if(!success) {
-        cout << "Error: Unable to load texture " << filePathTex << endl;
-        return false;
+    //built outside the lock so the mazes build side by side
+    btCollisionShape* shape = NULL;
+    void* bvhBuffer = NULL;
+    size_t bytes = 0;
+    if(obj.collision == COLLISION_CONVEX)
+        shape = buildConvexShape(obj, bytes);
+    if(shape == NULL) {
+        btBvhTriangleMeshShape* triangles = buildTriangleShape(obj, bvhBuffer);
+        bytes = sizeof(btBvhTriangleMeshShape) + triangles->getOptimizedBvh()->calculateSerializeBufferSize();
+        shape = triangles;
     }
-    else {
-        success = ilConvertImage(IL_RGB, IL_UNSIGNED_BYTE);
-        if(!success) {
-            cout << "Error: Unable to convert image " << filePathTex << endl;
-            return false;
-        }
-        glGenTextures(1, &obj.texture);
-        glBindTexture(GL_TEXTURE_2D, obj.texture);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexImage2D(GL_TEXTURE_2D, 0, ilGetInteger(IL_IMAGE_BPP), ilGetInteger(IL_IMAGE_WIDTH),
-            ilGetInteger(IL_IMAGE_HEIGHT), 0, ilGetInteger(IL_IMAGE_FORMAT), GL_UNSIGNED_BYTE,
-            ilGetData());
+
+    std::lock_guard<std::mutex> lock(resourceMutex);
+    std::map<unsigned long long, Resource>::iterator it = resources.find(key);
+    if(it != resources.end()) {
+        it->second.refCount++;
+        delete shape;
+        btAlignedFree(bvhBuffer);
+        return it->second.shape;
     }
+    Resource &resource = addResource(key, RESOURCE_SHAPE, bytes);
+    resource.shape = shape;
+    resource.bvhBuffer = bvhBuffer;
+    return shape;
+}
 
-    // Get Materials (textures)
-    success = ilLoadImage((const ILstring)filePathTex2);
-    if(!success) {
-        cout << "Error: Unable to load _texture " << filePathTex2 << endl;
-        return false;
+//the triangle BVH from the cache when one was saved for these exact triangles,
+//otherwise built and saved for next time. buffer is set when the BVH lives in it
+btBvhTriangleMeshShape* buildTriangleShape(Object &obj, void* &buffer) {
+    std::chrono::time_point<std::chrono::high_resolution_clock> start, end;
+    start = std::chrono::high_resolution_clock::now();
+    unsigned long long hash = triangleHash(obj);
+    btBvhTriangleMeshShape* shape = loadBvhCache(obj, hash, buffer);
+    end = std::chrono::high_resolution_clock::now();
+    float ms = std::chrono::duration_cast< std::chrono::duration<float, std::milli> >(end-start).count();
+    if(shape != NULL) {
+        const BvhCacheHeader* header = (const BvhCacheHeader*)buffer;
+        cout << "BVH: " << obj.btMesh->getNumTriangles() << " triangles loaded in " << ms
+             << " ms, building took " << header->buildMs << " ms" << endl;
+        return shape;
     }
-    else {
-        success = ilConvertImage(IL_RGB, IL_UNSIGNED_BYTE);
-        if(!success) {
-            cout << "Error: Unable to convert image " << filePathTex << endl;
-            return false;
-        }
-        glGenTextures(1, &obj._texture);
-        glBindTexture(GL_TEXTURE_2D, obj._texture);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexImage2D(GL_TEXTURE_2D, 0, ilGetInteger(IL_IMAGE_BPP), ilGetInteger(IL_IMAGE_WIDTH),
-            ilGetInteger(IL_IMAGE_HEIGHT), 0, ilGetInteger(IL_IMAGE_FORMAT), GL_UNSIGNED_BYTE,
-            ilGetData());
+
+    start = std::chrono::high_resolution_clock::now();
+    shape = new btBvhTriangleMeshShape(obj.btMesh, true);
+    end = std::chrono::high_resolution_clock::now();
+    ms = std::chrono::duration_cast< std::chrono::duration<float, std::milli> >(end-start).count();
+    cout << "BVH: " << obj.btMesh->getNumTriangles() << " triangles built in " << ms << " ms" << endl;
+    saveBvhCache(hash, obj, shape->getOptimizedBvh(), ms);
+    return shape;
+}
+
+//the BVH depends on nothing but the collision triangles, in the order they were added
+unsigned long long triangleHash(const Object &obj) {
+    unsigned long long hash = FNV_OFFSET;
+    for(int part = 0; part < obj.btMesh->getNumSubParts(); part++) {
+        const unsigned char* vertices;
+        const unsigned char* indices;
+        int numVertices, vertexStride, indexStride, numFaces;
+        PHY_ScalarType vertexType, indexType;
+        obj.btMesh->getLockedReadOnlyVertexIndexBase(&vertices, numVertices, vertexType, vertexStride,
+                                                     &indices, indexStride, numFaces, indexType, part);
+        hash = hashBytes(vertices, numVertices * vertexStride, hash);
+        hash = hashBytes(indices, numFaces * indexStride, hash);
+        obj.btMesh->unLockReadOnlyVertexBase(part);
     }
+    return hash;
+}
 
-    // Create bullet mesh for collision
-    obj.btMesh = new btTriangleMesh();
-    btVector3 v0, v1, v2;
+std::string bvhCachePath(unsigned long long hash) {
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.bvh", hash);
+    return std::string(BVH_CACHE_DIR) + name;
+}
 
-    // Get mesh
-    obj.numMeshes = scene->mNumMeshes;
-    obj.mesh = new Mesh[obj.numMeshes];
+//the header and BVH go in one aligned buffer, the BVH is used in place
+btBvhTriangleMeshShape* loadBvhCache(Object &obj, unsigned long long hash, void* &buffer) {
+    std::ifstream input(bvhCachePath(hash).c_str(), std::ios::binary);
+    if(!input.is_open())
+        return NULL;
+    BvhCacheHeader header;
+    if(!input.read((char*)&header, sizeof(header)))
+        return NULL;
+    if(header.magic != BVH_CACHE_MAGIC || header.version != BVH_CACHE_VERSION ||
+       header.bulletVersion != BT_BULLET_VERSION || header.pointerSize != sizeof(void*) ||
+       header.scalarSize != sizeof(btScalar) || header.meshHash != hash ||
+       header.numTriangles != (unsigned int)obj.btMesh->getNumTriangles())
+        return NULL;
 
-    for( unsigned int i=0; i<scene->mNumMeshes; i++ ) {
-        aiMesh *tmpMesh = scene->mMeshes[i]; //aiMesh temporary to give to struct
-        tmpMesh = scene->mMeshes[i];
-        obj.mesh[i].geometry = new Vertex[tmpMesh->mNumVertices]; //3 vertex for each face
-        obj.mesh[i].numVertices = tmpMesh->mNumVertices;
-        obj.mesh[i].numFaces = tmpMesh->mNumFaces;
+    //bullet wants the BVH 16 byte aligned, the header is padded to keep it so
+    size_t offset = (sizeof(BvhCacheHeader) + 15) & ~(size_t)15;
+    buffer = btAlignedAlloc(offset + header.bufferSize, 16);
+    memcpy(buffer, &header, sizeof(header));
+    input.seekg(offset);
+    btOptimizedBvh* bvh = NULL;
+    if(input.read((char*)buffer + offset, header.bufferSize))
+        bvh = btOptimizedBvh::deSerializeInPlace((char*)buffer + offset, header.bufferSize, false);
+    if(bvh == NULL) {
+        cout << "Warning: Unable to read " << bvhCachePath(hash) << ", rebuilding it" << endl;
+        btAlignedFree(buffer);
+        buffer = NULL;
+        return NULL;
+    }
 
-        for( unsigned int j=0; j<tmpMesh->mNumFaces; j++ ) {
-            aiFace &tmpFace = tmpMesh->mFaces[j];
-            for( unsigned int k=0; k<3; k++ ) {
-                unsigned int tmpVertex = tmpFace.mIndices[k];
-                //load vertex positions
-                obj.mesh[i].geometry[3*j+k].position[0] = tmpMesh->mVertices[tmpVertex].x;
-                obj.mesh[i].geometry[3*j+k].position[1] = tmpMesh->mVertices[tmpVertex].y;
-                obj.mesh[i].geometry[3*j+k].position[2] = tmpMesh->mVertices[tmpVertex].z;
-                //load vertex uv
-                obj.mesh[i].geometry[3*j+k].uv[0] = tmpMesh->mTextureCoords[0][tmpVertex].x;
-                obj.mesh[i].geometry[3*j+k].uv[1] = tmpMesh->mTextureCoords[0][tmpVertex].y;
-                //load vertex normal
-                obj.mesh[i].hasNormals = tmpMesh->HasNormals();
-                if(tmpMesh->HasNormals()) {
-                    obj.mesh[i].geometry[3*j+k].normal[0] = tmpMesh->mNormals[tmpVertex].x;
-                    obj.mesh[i].geometry[3*j+k].normal[1] = tmpMesh->mNormals[tmpVertex].y;
-                    obj.mesh[i].geometry[3*j+k].normal[2] = tmpMesh->mNormals[tmpVertex].z;
-                    // cout << "<" << obj.mesh[i].geometry[3*j+k].normal[0] << ", " <<
-                    //     obj.mesh[i].geometry[3*j+k].normal[1] << ", " <<
-                    //     obj.mesh[i].geometry[3*j+k].normal[2] << ">" << endl;
-                }
-            }
-            //make position vectors for each vertex on face.
-            v0 = btVector3(obj.mesh[i].geometry[3*j+0].position[0],
-                           obj.mesh[i].geometry[3*j+0].position[1],
-                           obj.mesh[i].geometry[3*j+0].position[2]);
-            v1 = btVector3(obj.mesh[i].geometry[3*j+1].position[0],
-                           obj.mesh[i].geometry[3*j+1].position[1],
-                           obj.mesh[i].geometry[3*j+1].position[2]);
-            v2 = btVector3(obj.mesh[i].geometry[3*j+2].position[0],
-                           obj.mesh[i].geometry[3*j+2].position[1],
-                           obj.mesh[i].geometry[3*j+2].position[2]);
+    btBvhTriangleMeshShape* shape = new btBvhTriangleMeshShape(obj.btMesh, true, false);
+    shape->setOptimizedBvh(bvh);
+    return shape;
+}
+
+void saveBvhCache(unsigned long long hash, const Object &obj, btOptimizedBvh* bvh, float buildMs) {
+    BvhCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = BVH_CACHE_MAGIC;
+    header.version = BVH_CACHE_VERSION;
+    header.bulletVersion = BT_BULLET_VERSION;
+    header.pointerSize = sizeof(void*);
+    header.scalarSize = sizeof(btScalar);
+    header.numTriangles = obj.btMesh->getNumTriangles();
+    header.meshHash = hash;
+    header.bufferSize = bvh->calculateSerializeBufferSize();
+    header.buildMs = buildMs;
+
+    void* data = btAlignedAlloc(header.bufferSize, 16);
+    bool serialized = bvh->serializeInPlace(data, header.bufferSize, false);
+
+    mkdir(BVH_CACHE_DIR, 0755);
+    std::string cachePath = bvhCachePath(hash);
+    std::string tempPath = cachePath + ".tmp";
+    std::ofstream output(tempPath.c_str(), std::ios::binary);
+    size_t offset = (sizeof(BvhCacheHeader) + 15) & ~(size_t)15;
+    char padding[16] = {0};
+    output.write((const char*)&header, sizeof(header));
+    output.write(padding, offset - sizeof(header));
+    output.write((const char*)data, header.bufferSize);
+    output.close();
+    btAlignedFree(data);
+
+    //rename so a half written cache is never picked up
+    if(!serialized || !output || rename(tempPath.c_str(), cachePath.c_str()) != 0) {
+        cout << "Warning: Unable to write " << cachePath << endl;
+        remove(tempPath.c_str());
+    }
+}
+
+//cuts the mesh into convex prisms, boxes where they line up with the axes
+//NULL if the mesh isn't an extrusion, the caller falls back to its triangles
+btCollisionShape* buildConvexShape(Object &obj, size_t &bytes) {
+    std::vector<float> triangles;
+    for(unsigned int i = 0; i < obj.numMeshes; i++) {
+        for(unsigned int j = 0; j < 3 * obj.mesh[i].numFaces; j++) {
+            const GLfloat* position = obj.mesh[i].geometry[obj.mesh[i].indices[j]].position;
+            triangles.insert(triangles.end(), position, position + 3);
+        }
+    }
+    std::vector<ConvexPrism> prisms;
+    if(!decomposePrisms(triangles, prisms)) {
+        cout << "Collision: mesh has sloped or open faces, keeping its " << triangles.size() / 9 << " triangles" << endl;
+        return NULL;
+    }
 
-            //add face to btmesh
-            obj.btMesh->addTriangle(v0, v1, v2, false);
+    //the compound keeps its own AABB tree over the pieces
+    btCompoundShape* compound = new btCompoundShape(true, prisms.size());
+    bytes = sizeof(btCompoundShape);
+    int boxes = 0;
+    float center[3], halfExtents[3];
+    for(unsigned int i = 0; i < prisms.size(); i++) {
+        btTransform local;
+        local.setIdentity();
+        if(prismIsBox(prisms[i], center, halfExtents)) {
+            local.setOrigin(btVector3(center[0], center[1], center[2]));
+            compound->addChildShape(local, new btBoxShape(btVector3(halfExtents[0], halfExtents[1], halfExtents[2])));
+            bytes += sizeof(btBoxShape);
+            boxes++;
+            continue;
+        }
+        btConvexHullShape* hull = new btConvexHullShape();
+        const std::vector<float> &outline = prisms[i].outline;
+        for(unsigned int k = 0; k < outline.size(); k += 2) {
+            hull->addPoint(btVector3(outline[k], prisms[i].bottom, outline[k+1]), false);
+            hull->addPoint(btVector3(outline[k], prisms[i].top, outline[k+1]), false);
         }
+        hull->setMargin(HULL_MARGIN);
+        hull->recalcLocalAabb();
+        compound->addChildShape(local, hull);
+        bytes += sizeof(btConvexHullShape) + hull->getNumPoints() * sizeof(btVector3);
     }
+    cout << "Collision: " << triangles.size() / 9 << " triangles -> " << boxes << " boxes and "
+         << prisms.size() - boxes << " convex hulls" << endl;
+    return compound;
+}
 
-    //Create Vertex Array Object for each mesh
-    for(unsigned int i=0; i<scene->mNumMeshes; i++ ) {
-        glGenBuffers(1, &(obj.mesh[i].vbo_geometry));
-        glBindBuffer(GL_ARRAY_BUFFER, obj.mesh[i].vbo_geometry);
-        glBufferData(GL_ARRAY_BUFFER, obj.mesh[i].numFaces * 3 * sizeof(Vertex), &(obj.mesh[i].geometry[0]), GL_STATIC_DRAW);
+//swaps the object's collision shape for one built the other way
+void setMeshCollision(Object &obj, CollisionMode mode) {
+    unsigned long long old = obj.shapeKey;
+    obj.collision = mode;
+    btCollisionShape* shape = acquireMeshShape(obj);
+    if(obj.shapeKey == old)
+        return;
+    setBoardShape(obj, shape);
+    releaseResource(old);
+}
+
+//the broadphase only notices a new shape when the body goes back in
+void setBoardShape(Object &obj, btCollisionShape* shape) {
+    dynamicsWorld->removeRigidBody(obj.rigidBody);
+    obj.rigidBody->setCollisionShape(shape);
+    dynamicsWorld->addRigidBody(obj.rigidBody);
+}
+
+btCollisionShape* acquireSphereShape(btScalar radius, Object &obj) {
+    const char tag[] = "sphere";
+    obj.shapeKey = resourceKey(RESOURCE_SHAPE, hashBytes(&radius, sizeof(radius), hashBytes(tag, sizeof(tag), FNV_OFFSET)));
+    std::lock_guard<std::mutex> lock(resourceMutex);
+    Resource* shared = findResource(obj.shapeKey);
+    if(shared != NULL)
+        return shared->shape;
+
+    btSphereShape* shape = new btSphereShape(radius);
+    addResource(obj.shapeKey, RESOURCE_SHAPE, sizeof(btSphereShape)).shape = shape;
+    return shape;
+}
+
+//drops marbles onto maze01 in layers, they share ball01's mesh and shape
+bool spawnMarbles(int count) {
+    if(!headless && !GLEW_VERSION_3_3) {
+        cout << "Error: Multi-marble mode needs OpenGL 3.3 for instancing" << endl;
+        return false;
+    }
+
+    const int perRow = 24;
+    const float spacing = 0.36;//a little over a marble apart
+    btCollisionShape* shape = ball01.rigidBody->getCollisionShape();
+    for(int i = 0; i < count; i++) {
+        int layer = i / (perRow * perRow);
+        int row = (i / perRow) % perRow;
+        int column = i % perRow;
+        btVector3 pos(-4.14 + column * spacing, 2.0 + layer * spacing, -4.14 + row * spacing);
+        btDefaultMotionState* motionState = new btDefaultMotionState(btTransform(btQuaternion(0,0,0,1), pos));
+        btRigidBody::btRigidBodyConstructionInfo marbleRigidBodyCI(2, motionState, shape, btVector3(0,0,0));
+        marbleRigidBodyCI.m_friction = 0.01;
+        marbleRigidBodyCI.m_restitution = 1.0;
+        btRigidBody* marble = new btRigidBody(marbleRigidBodyCI);
+        //the board moves under them without waking anything, same as ball01
+        marble->setActivationState(DISABLE_DEACTIVATION);
+        dynamicsWorld->addRigidBody(marble);
+        marbles.push_back(marble);
     }
+    if(headless)
+        return true;
 
+    //the ball's own buffers plus a matrix per instance, a vertex array per level
+    //of detail each reading its own run of matrices
+    if(marbleVaos.empty()) {
+        glGenBuffers(1, &marbleInstances);
+        marbleVaos.resize(ball01.numMeshes * MAX_LODS);
+        glGenVertexArrays(marbleVaos.size(), &marbleVaos[0]);
+        for(unsigned int i = 0; i < marbleVaos.size(); i++) {
+            glBindVertexArray(marbleVaos[i]);
+            glBindBuffer(GL_ARRAY_BUFFER, ball01.mesh[i / MAX_LODS].vbo_geometry);
+            setVertexLayout();
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ball01.mesh[i / MAX_LODS].ibo_geometry);
+        }
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, marbleInstances);
+    glBufferData(GL_ARRAY_BUFFER, MAX_LODS * marbles.size() * 16 * sizeof(GLfloat), NULL, GL_STREAM_DRAW);
+    //the runs move with the marble count
+    for(unsigned int i = 0; i < marbleVaos.size(); i++) {
+        glBindVertexArray(marbleVaos[i]);
+        size_t run = (i % MAX_LODS) * marbles.size() * 16 * sizeof(GLfloat);
+        for(unsigned int column = 0; column < 4; column++) {
+            glEnableVertexAttribArray(ATTRIB_MODEL + column);
+            glVertexAttribPointer(ATTRIB_MODEL + column, 4, GL_FLOAT, GL_FALSE, 16 * sizeof(GLfloat),
+                                  (void*)(run + 4 * column * sizeof(GLfloat)));
+            glVertexAttribDivisor(ATTRIB_MODEL + column, 1);
+        }
+    }
+    glBindVertexArray(0);
     return true;
-}    
+}
+
+void clearMarbles() {
+    for(unsigned int i = 0; i < marbles.size(); i++) {
+        dynamicsWorld->removeRigidBody(marbles[i]);
+        delete marbles[i]->getMotionState();
+        delete marbles[i];
+    }
+    marbles.clear();
+    marblesHome = 0;
+}
 
 void menu(int selection) {
     //make decision based on menu choice ---------------------
@@ -830,18 +3757,26 @@ void menu(int selection) {
 
     //restart
     case 3:
+        //the world is ours until the thread starts again
+        stopPhysicsThread();
         //restart ball
         ball01.rigidBody->getMotionState()->getWorldTransform(transform);
         pos = btVector3(4.5,5.0,-4.2);
         transform.setOrigin(pos);
         ball01.rigidBody->setCenterOfMassTransform(transform);
         ball01.rigidBody->setLinearVelocity(btVector3(0.0,0.0,0.0));
+        savePhysicsState(ball01);//don't interpolate across the teleport
+        if(multiMarble) {
+            clearMarbles();
+            spawnMarbles(marbleCount);
+        }
         gameTime = std::chrono::high_resolution_clock::now();
         gameWon = false;
         
         //reset board
         pitch = 0.0;
         roll = 0.0;
+        startPhysicsThread();
         render();
         break;
 
@@ -853,6 +3788,7 @@ void menu(int selection) {
         else {
             paused = false;
         }
+        sendControls();
         break;
     // toggle distant
     case 5:
@@ -924,12 +3860,142 @@ void menu(int selection) {
     case 12:
         exit(0);
         break;
+
+    //GL calls per frame, for checking the render path stays lean
+    case 13:
+        showGLCalls = !showGLCalls;
+        break;
+
+    //fill the maze with marbles, or take them away again
+    case 14:
+        stopPhysicsThread();
+        if(multiMarble) {
+            clearMarbles();
+            multiMarble = false;
+        }
+        else
+            multiMarble = spawnMarbles(marbleCount);
+        startPhysicsThread();
+        break;
+
+    case 15:
+        showProfiler = !showProfiler;
+        break;
+
+    case 16:
+        lodEnabled = !lodEnabled;
+        break;
     }
 
+    wakeFrames();
     glutPostRedisplay();
 }
 
+//timer queries need GL 3.3 or ARB_timer_query, without them only CPU times show
+void initProfiler() {
+    gpuTimers = GLEW_ARB_timer_query;
+    for(int i = 0; i < PHASE_COUNT; i++) {
+        profile[i].activeQuery = -1;
+        for(int j = 0; j < GPU_QUERIES; j++)
+            profile[i].queryPending[j] = false;
+        if(gpuTimers)
+            glGenQueries(GPU_QUERIES, profile[i].queries);
+    }
+}
+
+//only one GL_TIME_ELAPSED query can run at a time, so GPU phases must not nest
+void beginGpuTimer(ProfilePhase phase) {
+    PhaseProfile &p = profile[phase];
+    int slot = profileFrame % GPU_QUERIES;
+    p.activeQuery = -1;
+    //a result still outstanding after GPU_QUERIES frames costs this frame its sample, never a stall
+    if(!showProfiler || !gpuTimers || p.queryPending[slot])
+        return;
+    GL(glBeginQuery(GL_TIME_ELAPSED, p.queries[slot]));
+    p.activeQuery = slot;
+}
+
+void endGpuTimer(ProfilePhase phase) {
+    PhaseProfile &p = profile[phase];
+    if(p.activeQuery < 0)
+        return;
+    GL(glEndQuery(GL_TIME_ELAPSED));
+    p.queryPending[p.activeQuery] = true;
+    p.activeQuery = -1;
+}
+
+//files this frame's CPU times and collects whichever GPU results have arrived
+void endProfileFrame() {
+    for(int i = 0; i < PHASE_COUNT; i++) {
+        PhaseProfile &p = profile[i];
+        if(showProfiler)
+            addSample(p.cpu, p.cpuFrame);
+        p.cpuFrame = 0.0;
+        for(int j = 0; j < GPU_QUERIES; j++) {
+            if(!p.queryPending[j])
+                continue;
+            GLint available = 0;
+            GL(glGetQueryObjectiv(p.queries[j], GL_QUERY_RESULT_AVAILABLE, &available));
+            if(!available)
+                continue;
+            GLuint64 elapsed;
+            GL(glGetQueryObjectui64v(p.queries[j], GL_QUERY_RESULT, &elapsed));
+            addSample(p.gpu, elapsed / 1000000.0);
+            p.queryPending[j] = false;
+        }
+    }
+    profileFrame++;
+}
+
+//average and worst frame of each phase, in the top right
+void renderProfiler() {
+    char buff[64];
+    float y = 0.9f;
+    sprintf(buff, "CPU %.0f%% at %.0f fps", pacer.cpuUtilisation() * 100.0, pacer.frameRate());
+    printText(0.3f, y, buff);
+    y -= 0.07f;
+    sprintf(buff, "ms over %d frames: avg / max", PROFILE_FRAMES);
+    printText(0.3f, y, buff);
+    for(int i = 0; i < PHASE_COUNT; i++) {
+        y -= 0.07f;
+        const PhaseProfile &p = profile[i];
+        if(p.gpu.count > 0)
+            sprintf(buff, "%s  cpu %.2f / %.2f  gpu %.2f / %.2f", PHASE_NAMES[i],
+                    historyAverage(p.cpu), historyMax(p.cpu), historyAverage(p.gpu), historyMax(p.gpu));
+        else
+            sprintf(buff, "%s  cpu %.2f / %.2f", PHASE_NAMES[i], historyAverage(p.cpu), historyMax(p.cpu));
+        printText(0.3f, y, buff);
+    }
+}
+
+//rolling window, the oldest sample goes once PROFILE_FRAMES are held
+void addSample(ProfileHistory &history, float sample) {
+    history.samples[history.next] = sample;
+    history.next = (history.next + 1) % PROFILE_FRAMES;
+    if(history.count < PROFILE_FRAMES)
+        history.count++;
+}
+
+float historyAverage(const ProfileHistory &history) {
+    float total = 0.0;
+    for(int i = 0; i < history.count; i++)
+        total += history.samples[i];
+    return history.count > 0 ? total / history.count : 0.0;
+}
+
+float historyMax(const ProfileHistory &history) {
+    float worst = 0.0;
+    for(int i = 0; i < history.count; i++)
+        worst = std::max(worst, history.samples[i]);
+    return worst;
+}
+
 void printText(float x, float y, char* text) {
+    //one cached draw call per string from the glyph atlas
+    if(drawText(hudText, x, y, text, windowWidth, windowHeight, 1.0, 0.5, 0.0))
+        return;
+
+    //no atlas, the bitmap font it was built from goes straight to the screen
     glUseProgram(0);
 
     float r,g,b;
@@ -963,39 +4029,54 @@ void initPhysics() {
     collisionConfiguration = new btDefaultCollisionConfiguration();
     collisionConfiguration->setConvexConvexMultipointIterations();
 
-    ///use the default collision dispatcher. For parallel processing you can use a diffent dispatcher (see Extras/BulletMultiThreaded)
-    dispatcher = new  btCollisionDispatcher(collisionConfiguration);
-
     broadphase = new btDbvtBroadphase();
 
-    ///the default constraint solver. For parallel processing you can use a different solver (see Extras/BulletMultiThreaded)
-    btSequentialImpulseConstraintSolver* sol = new btSequentialImpulseConstraintSolver;
-    solver = sol;
+    if(physicsScheduler != NULL) {
+        ///narrowphase, island solving and integration all go through the job system
+        dispatcher = new btCollisionDispatcherMt(collisionConfiguration);
+        btConstraintSolverPoolMt* pool = new btConstraintSolverPoolMt(physicsScheduler->getMaxNumThreads());
+        solver = pool;
+        solverMt = new btSequentialImpulseConstraintSolverMt;
+        dynamicsWorld = new btDiscreteDynamicsWorldMt(dispatcher,broadphase,pool,solverMt,collisionConfiguration);
+    }
+    else {
+        ///use the default collision dispatcher
+        dispatcher = new  btCollisionDispatcher(collisionConfiguration);
+
+        ///the default constraint solver
+        solver = new btSequentialImpulseConstraintSolver;
 
-    dynamicsWorld = new btDiscreteDynamicsWorld(dispatcher,broadphase,solver,collisionConfiguration);
+        dynamicsWorld = new btDiscreteDynamicsWorld(dispatcher,broadphase,solver,collisionConfiguration);
+    }
 
     dynamicsWorld->setGravity(btVector3(0,-5.0,0));
-    // dynamicsWorld->setForceUpdateAllAabbs(false);
+    //only awake bodies get new AABBs, a board at rest keeps its old one
+    dynamicsWorld->setForceUpdateAllAabbs(false);
 
     //maze01
-    btCollisionShape* maze01Shape = new btBvhTriangleMeshShape(maze01.btMesh, true);
+    btCollisionShape* maze01Shape = acquireMeshShape(maze01);
     btDefaultMotionState* maze01MotionShape = new btDefaultMotionState(btTransform(btQuaternion(0,0,0,1),btVector3(0,0,0)));
     btRigidBody::btRigidBodyConstructionInfo maze01RigidBodyCI(0,maze01MotionShape,maze01Shape,btVector3(0,0,0));
     maze01.rigidBody = new btRigidBody(maze01RigidBodyCI);
-    // maze01.rigidBody->setActivationState(DISABLE_DEACTIVATION);
+    //tilted through its motion state, asleep until the tilt first changes
+    maze01.rigidBody->setCollisionFlags(maze01.rigidBody->getCollisionFlags() | btCollisionObject::CF_KINEMATIC_OBJECT);
+    maze01.rigidBody->forceActivationState(ISLAND_SLEEPING);
+    maze01.tilt = btQuaternion(0,0,0,1);
     dynamicsWorld->addRigidBody(maze01.rigidBody);
 
     //maze02
-    btCollisionShape* mazeDEMOShape = new btBvhTriangleMeshShape(mazeDEMO.btMesh, true);
+    btCollisionShape* mazeDEMOShape = acquireMeshShape(mazeDEMO);
     btDefaultMotionState* mazeDEMOMotionShape = new btDefaultMotionState(btTransform(btQuaternion(0,0,0,1),btVector3(50,0.0,0.0)));
     btRigidBody::btRigidBodyConstructionInfo mazeDEMORigidBodyCI(0,mazeDEMOMotionShape,mazeDEMOShape,btVector3(0,0,0));
     mazeDEMO.rigidBody = new btRigidBody(mazeDEMORigidBodyCI);
-    // maze01.rigidBody->setActivationState(DISABLE_DEACTIVATION);
+    mazeDEMO.rigidBody->setCollisionFlags(mazeDEMO.rigidBody->getCollisionFlags() | btCollisionObject::CF_KINEMATIC_OBJECT);
+    mazeDEMO.rigidBody->forceActivationState(ISLAND_SLEEPING);
+    mazeDEMO.tilt = btQuaternion(0,0,0,1);
     dynamicsWorld->addRigidBody(mazeDEMO.rigidBody);
 
 
     //Ball01
-    btCollisionShape* ball01Shape = new btSphereShape(0.15);   
+    btCollisionShape* ball01Shape = acquireSphereShape(0.15, ball01);
     btDefaultMotionState* ball01MotionState = new btDefaultMotionState(btTransform(btQuaternion(0,0,0,1),btVector3(4.5,5.0,-4.2 )));
     btRigidBody::btRigidBodyConstructionInfo ball01RigidBodyCI(2,ball01MotionState,ball01Shape,btVector3(0,0,0) );
     ball01RigidBodyCI.m_friction = 0.01;
@@ -1005,7 +4086,7 @@ void initPhysics() {
     dynamicsWorld->addRigidBody(ball01.rigidBody);
 
     //ballDEMO
-    btCollisionShape* ballDEMOShape = new btSphereShape(0.15);   
+    btCollisionShape* ballDEMOShape = acquireSphereShape(0.15, ballDEMO);
     btDefaultMotionState* ballDEMOMotionState = new btDefaultMotionState(btTransform(btQuaternion(0,0,0,1),btVector3(50.0,5.0,0.0)));
     btRigidBody::btRigidBodyConstructionInfo ballDEMORigidBodyCI(2,ballDEMOMotionState,ballDEMOShape,btVector3(0,0,0) );
     ballDEMORigidBodyCI.m_friction = 0.01;
@@ -1013,4 +4094,10 @@ void initPhysics() {
     ballDEMO.rigidBody = new btRigidBody(ballDEMORigidBodyCI);
     ballDEMO.rigidBody->setActivationState(DISABLE_DEACTIVATION);
     dynamicsWorld->addRigidBody(ballDEMO.rigidBody);
+
+    //nothing to interpolate from until the first step
+    savePhysicsState(maze01);
+    savePhysicsState(mazeDEMO);
+    savePhysicsState(ball01);
+    savePhysicsState(ballDEMO);
 }
\ No newline at end of file
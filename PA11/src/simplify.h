@@ -0,0 +1,427 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include <vector>
+#include <map>
+#include <queue>
+#include <cmath>
+#include <algorithm>
+#include <cfloat>
+
+//Quadric error decimation, plain floats like decompose.h. Corners are welded
+//by position, so the seams a render mesh has for normals and uvs go away. For
+//render meshes each corner is pointed back at one of the vertices it was welded
+//from afterwards, so every level can share the mesh's vertex buffer. Each vertex
+//then keeps the planes of the faces it started on, plus one standing up along
+//every open edge, and edges are collapsed onto one of their ends cheapest
+//first. A collapse costs the summed squared distance from where the vertex ends
+//up to all of those planes. Inside a flat region, and along a straight edge or
+//outline, a collapse costs nothing, so planar regions merge down to their
+//corners before anything is approximated. Nothing is collapsed past the
+//tolerance, or if it would fold a face over.
+namespace simplify
+{
+    //symmetric 4x4 as aa ab ac ad bb bc bd cc cd dd
+    struct Quadric
+    {
+        double q[10];
+    };
+
+    inline void addPlane(Quadric &quadric, double a, double b, double c, double d, double weight)
+    {
+        double p[4] = {a, b, c, d};
+        int k = 0;
+        for(int i = 0; i < 4; i++) {
+            for(int j = i; j < 4; j++)
+                quadric.q[k++] += weight * p[i] * p[j];
+        }
+    }
+
+    inline double error(const Quadric &quadric, const float* v)
+    {
+        const double* q = quadric.q;
+        double x = v[0], y = v[1], z = v[2];
+        return q[0]*x*x + 2.0*q[1]*x*y + 2.0*q[2]*x*z + 2.0*q[3]*x
+             + q[4]*y*y + 2.0*q[5]*y*z + 2.0*q[6]*y
+             + q[7]*z*z + 2.0*q[8]*z
+             + q[9];
+    }
+
+    inline void cross(const float* a, const float* b, const float* c, double* n)
+    {
+        double u[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+        double w[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+        n[0] = u[1] * w[2] - u[2] * w[1];
+        n[1] = u[2] * w[0] - u[0] * w[2];
+        n[2] = u[0] * w[1] - u[1] * w[0];
+    }
+
+    struct Collapse
+    {
+        double cost;
+        int from, to;
+        unsigned int fromStamp, toStamp;//both ends unchanged since this was worked out
+
+        bool operator<(const Collapse &other) const
+        {
+            return cost > other.cost;//cheapest on top
+        }
+    };
+
+    class Decimator
+    {
+    public:
+        //9 floats per triangle
+        explicit Decimator(const std::vector<float> &triangles)
+        {
+            const float* vertices = triangles.empty() ? NULL : &triangles[0];
+            measure(vertices, 3, triangles.size() / 3);
+            for(unsigned int i = 0; i + 8 < triangles.size(); i += 9) {
+                unsigned int corners[3] = {i / 3, i / 3 + 1, i / 3 + 2};
+                addFace(vertices, 3, corners);
+            }
+            build();
+        }
+
+        //an indexed mesh, each position stride floats after the last. Unless
+        //normalOffset is negative, outputIndices() gives each corner the vertex
+        //whose normal, normalOffset floats after its position, best fits its face
+        Decimator(const float* vertices, unsigned int stride, unsigned int numVertices,
+                  const unsigned int* indices, unsigned int numIndices, int normalOffset)
+        {
+            measure(vertices, stride, numVertices);
+            for(unsigned int i = 0; i + 2 < numIndices; i += 3)
+                addFace(vertices, stride, &indices[i]);
+            for(unsigned int i = 0; i < numVertices && normalOffset >= 0; i++)
+                normals.insert(normals.end(), &vertices[i * stride + normalOffset], &vertices[i * stride + normalOffset] + 3);
+            build();
+        }
+
+        //collapses while the cheapest one is within tolerance and there are
+        //more than targetFaces left
+        void run(float tolerance, unsigned int targetFaces = 0)
+        {
+            double limit = std::max(tolerance, eps);
+            limit *= limit;
+            while(!heap.empty() && liveFaces > targetFaces) {
+                Collapse collapse = heap.top();
+                heap.pop();
+                if(removed[collapse.from] || removed[collapse.to] ||
+                   stamps[collapse.from] != collapse.fromStamp || stamps[collapse.to] != collapse.toStamp)
+                    continue;//stale, a fresher one was pushed
+                if(collapse.cost > limit) {
+                    heap.push(collapse);//still there for a later run with more tolerance
+                    break;
+                }
+                if(!canCollapse(collapse.from, collapse.to))
+                    continue;
+                apply(collapse.from, collapse.to);
+            }
+        }
+
+        unsigned int faceCount() const
+        {
+            return liveFaces;
+        }
+
+        //9 floats per triangle, winding kept
+        void output(std::vector<float> &triangles) const
+        {
+            triangles.clear();
+            for(unsigned int f = 0; f < alive.size(); f++) {
+                if(!alive[f])
+                    continue;
+                for(int c = 0; c < 3; c++)
+                    triangles.insert(triangles.end(), &positions[3*faces[3*f + c]], &positions[3*faces[3*f + c]] + 3);
+            }
+        }
+
+        //3 per triangle, into the vertices the decimator was made with
+        void outputIndices(std::vector<unsigned int> &indices) const
+        {
+            indices.clear();
+            for(unsigned int f = 0; f < alive.size(); f++) {
+                if(!alive[f])
+                    continue;
+                const int* face = &faces[3*f];
+                double n[3];
+                cross(&positions[3*face[0]], &positions[3*face[1]], &positions[3*face[2]], n);
+                for(int c = 0; c < 3; c++) {
+                    const std::vector<unsigned int> &candidates = sources[face[c]];
+                    unsigned int best = candidates[0];
+                    double bestFit = -DBL_MAX;
+                    for(unsigned int i = 0; i < candidates.size() && !normals.empty(); i++) {
+                        const float* normal = &normals[3 * candidates[i]];
+                        double fit = (normal[0]*n[0] + normal[1]*n[1] + normal[2]*n[2]) /
+                                     std::sqrt(normal[0]*normal[0] + normal[1]*normal[1] + normal[2]*normal[2] + 1e-30);
+                        if(fit > bestFit) {
+                            bestFit = fit;
+                            best = candidates[i];
+                        }
+                    }
+                    indices.push_back(best);
+                }
+            }
+        }
+
+    private:
+        //tolerances scale with the mesh
+        void measure(const float* vertices, unsigned int stride, unsigned int numVertices)
+        {
+            float lo[3] = {0.0f, 0.0f, 0.0f}, hi[3] = {0.0f, 0.0f, 0.0f};
+            for(unsigned int i = 0; i < numVertices; i++) {
+                for(int k = 0; k < 3; k++) {
+                    float x = vertices[i * stride + k];
+                    lo[k] = i == 0 ? x : std::min(lo[k], x);
+                    hi[k] = i == 0 ? x : std::max(hi[k], x);
+                }
+            }
+            float size = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2]));
+            eps = 1e-5f * size;
+        }
+
+        //welds the corners by position, render meshes split them along seams
+        void addFace(const float* vertices, unsigned int stride, const unsigned int* corners)
+        {
+            int face[3];
+            for(int c = 0; c < 3; c++) {
+                const float* v = &vertices[corners[c] * stride];
+                std::pair<long, std::pair<long, long> > key(std::lround(v[0] / eps / 8.0f),
+                    std::make_pair(std::lround(v[1] / eps / 8.0f), std::lround(v[2] / eps / 8.0f)));
+                std::map< std::pair<long, std::pair<long, long> >, int >::iterator it = weld.find(key);
+                if(it == weld.end()) {
+                    it = weld.insert(std::make_pair(key, (int)positions.size() / 3)).first;
+                    positions.insert(positions.end(), v, v + 3);
+                    sources.push_back(std::vector<unsigned int>());
+                }
+                face[c] = it->second;
+                std::vector<unsigned int> &welded = sources[face[c]];
+                if(std::find(welded.begin(), welded.end(), corners[c]) == welded.end())
+                    welded.push_back(corners[c]);
+            }
+            if(face[0] == face[1] || face[1] == face[2] || face[2] == face[0])
+                return;
+            double n[3];
+            cross(&positions[3*face[0]], &positions[3*face[1]], &positions[3*face[2]], n);
+            if(std::sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]) <= eps * eps)
+                return;//no area, contributes nothing
+            faces.insert(faces.end(), face, face + 3);
+        }
+
+        void build()
+        {
+            unsigned int numVertices = positions.size() / 3;
+            unsigned int numFaces = faces.size() / 3;
+            Quadric zero = {{0.0}};
+            quadrics.assign(numVertices, zero);
+            vertexFaces.resize(numVertices);
+            alive.assign(numFaces, true);
+            liveFaces = numFaces;
+            locked.assign(numVertices, false);
+            stamps.assign(numVertices, 0);
+            removed.assign(numVertices, false);
+
+            std::map< std::pair<int, int>, std::vector<int> > edges;//both ends, low first -> faces
+            for(unsigned int f = 0; f < numFaces; f++) {
+                const int* face = &faces[3*f];
+                double n[3];
+                cross(&positions[3*face[0]], &positions[3*face[1]], &positions[3*face[2]], n);
+                double length = std::sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+                n[0] /= length; n[1] /= length; n[2] /= length;
+                const float* p = &positions[3*face[0]];
+                double d = -(n[0]*p[0] + n[1]*p[1] + n[2]*p[2]);
+                for(int c = 0; c < 3; c++) {
+                    addPlane(quadrics[face[c]], n[0], n[1], n[2], d, 1.0);
+                    vertexFaces[face[c]].push_back(f);
+                    edges[std::make_pair(std::min(face[c], face[(c+1)%3]), std::max(face[c], face[(c+1)%3]))].push_back(f);
+                }
+            }
+
+            //open edges hold their place with a plane standing up along them,
+            //vertices where more than two faces meet on an edge stay put
+            std::map< std::pair<int, int>, std::vector<int> >::iterator edge;
+            for(edge = edges.begin(); edge != edges.end(); edge++) {
+                if(edge->second.size() > 2) {
+                    locked[edge->first.first] = locked[edge->first.second] = true;
+                    continue;
+                }
+                if(edge->second.size() == 2)
+                    continue;
+                const int* face = &faces[3 * edge->second[0]];
+                double n[3];
+                cross(&positions[3*face[0]], &positions[3*face[1]], &positions[3*face[2]], n);
+                const float* a = &positions[3 * edge->first.first];
+                const float* b = &positions[3 * edge->first.second];
+                double e[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+                double m[3] = {e[1]*n[2] - e[2]*n[1], e[2]*n[0] - e[0]*n[2], e[0]*n[1] - e[1]*n[0]};
+                double length = std::sqrt(m[0]*m[0] + m[1]*m[1] + m[2]*m[2]);
+                if(length <= 0.0)
+                    continue;
+                m[0] /= length; m[1] /= length; m[2] /= length;
+                double d = -(m[0]*a[0] + m[1]*a[1] + m[2]*a[2]);
+                addPlane(quadrics[edge->first.first], m[0], m[1], m[2], d, 1.0);
+                addPlane(quadrics[edge->first.second], m[0], m[1], m[2], d, 1.0);
+            }
+
+            for(edge = edges.begin(); edge != edges.end(); edge++)
+                push(edge->first.first, edge->first.second);
+        }
+
+        //the cheaper way to collapse an edge, either end onto the other
+        void push(int a, int b)
+        {
+            Quadric sum;
+            for(int k = 0; k < 10; k++)
+                sum.q[k] = quadrics[a].q[k] + quadrics[b].q[k];
+            Collapse collapse;
+            collapse.cost = -1.0;
+            if(!locked[a]) {
+                collapse.cost = error(sum, &positions[3*b]);
+                collapse.from = a;
+                collapse.to = b;
+            }
+            if(!locked[b]) {
+                double cost = error(sum, &positions[3*a]);
+                if(collapse.cost < 0.0 || cost < collapse.cost) {
+                    collapse.cost = cost;
+                    collapse.from = b;
+                    collapse.to = a;
+                }
+            }
+            if(collapse.cost < 0.0)
+                return;
+            collapse.cost = std::max(collapse.cost, 0.0);
+            collapse.fromStamp = stamps[collapse.from];
+            collapse.toStamp = stamps[collapse.to];
+            heap.push(collapse);
+        }
+
+        void neighbours(int v, std::vector<int> &out) const
+        {
+            out.clear();
+            for(unsigned int i = 0; i < vertexFaces[v].size(); i++) {
+                const int* face = &faces[3 * vertexFaces[v][i]];
+                for(int c = 0; c < 3; c++) {
+                    if(face[c] != v)
+                        out.push_back(face[c]);
+                }
+            }
+            std::sort(out.begin(), out.end());
+            out.erase(std::unique(out.begin(), out.end()), out.end());
+        }
+
+        //keeps the surface a manifold and every face facing the way it did
+        bool canCollapse(int from, int to)
+        {
+            //the only vertices both ends see are the ones across the faces being removed
+            std::vector<int> opposite;
+            for(unsigned int i = 0; i < vertexFaces[from].size(); i++) {
+                const int* face = &faces[3 * vertexFaces[from][i]];
+                if(face[0] != to && face[1] != to && face[2] != to)
+                    continue;
+                for(int c = 0; c < 3; c++) {
+                    if(face[c] != from && face[c] != to)
+                        opposite.push_back(face[c]);
+                }
+            }
+            if(opposite.empty())
+                return false;
+            std::sort(opposite.begin(), opposite.end());
+            neighbours(from, fromRing);
+            neighbours(to, toRing);
+            std::vector<int> shared;
+            std::set_intersection(fromRing.begin(), fromRing.end(), toRing.begin(), toRing.end(), std::back_inserter(shared));
+            if(shared != opposite)
+                return false;
+
+            for(unsigned int i = 0; i < vertexFaces[from].size(); i++) {
+                const int* face = &faces[3 * vertexFaces[from][i]];
+                if(face[0] == to || face[1] == to || face[2] == to)
+                    continue;
+                const float* before[3];
+                const float* after[3];
+                for(int c = 0; c < 3; c++) {
+                    before[c] = &positions[3*face[c]];
+                    after[c] = face[c] == from ? &positions[3*to] : before[c];
+                }
+                double n0[3], n1[3];
+                cross(before[0], before[1], before[2], n0);
+                cross(after[0], after[1], after[2], n1);
+                double l0 = std::sqrt(n0[0]*n0[0] + n0[1]*n0[1] + n0[2]*n0[2]);
+                double l1 = std::sqrt(n1[0]*n1[0] + n1[1]*n1[1] + n1[2]*n1[2]);
+                if(l1 <= eps * eps)
+                    return false;//would have no area
+                if(n0[0]*n1[0] + n0[1]*n1[1] + n0[2]*n1[2] < 0.5 * l0 * l1)
+                    return false;//turns by more than 60 degrees
+            }
+            return true;
+        }
+
+        void apply(int from, int to)
+        {
+            removed[from] = true;
+            for(int k = 0; k < 10; k++)
+                quadrics[to].q[k] += quadrics[from].q[k];
+            for(unsigned int i = 0; i < vertexFaces[from].size(); i++) {
+                int f = vertexFaces[from][i];
+                int* face = &faces[3*f];
+                if(face[0] == to || face[1] == to || face[2] == to) {
+                    alive[f] = false;
+                    liveFaces--;
+                    continue;
+                }
+                for(int c = 0; c < 3; c++) {
+                    if(face[c] == from)
+                        face[c] = to;
+                }
+                vertexFaces[to].push_back(f);
+            }
+            vertexFaces[from].clear();
+
+            //drop the removed faces from everyone around them
+            neighbours(to, toRing);
+            toRing.push_back(to);
+            for(unsigned int i = 0; i < toRing.size(); i++) {
+                std::vector<int> &list = vertexFaces[toRing[i]];
+                unsigned int kept = 0;
+                for(unsigned int j = 0; j < list.size(); j++) {
+                    if(alive[list[j]])
+                        list[kept++] = list[j];
+                }
+                list.resize(kept);
+            }
+            toRing.pop_back();
+
+            stamps[to]++;
+            for(unsigned int i = 0; i < toRing.size(); i++)
+                push(to, toRing[i]);
+        }
+
+        float eps;
+        std::map< std::pair<long, std::pair<long, long> >, int > weld;//snapped position -> vertex
+        std::vector<float> positions;//welded, 3 per vertex
+        std::vector< std::vector<unsigned int> > sources;//the vertices each welded one came from
+        std::vector<float> normals;//3 per source vertex, if given
+        std::vector<int> faces;//3 per face
+        std::vector<bool> alive;
+        unsigned int liveFaces;
+        std::vector<Quadric> quadrics;
+        std::vector< std::vector<int> > vertexFaces;
+        std::vector<bool> locked;
+        std::vector<bool> removed;
+        std::vector<unsigned int> stamps;//bumped when a vertex's edges need working out again
+        std::priority_queue<Collapse> heap;
+        std::vector<int> fromRing, toRing;
+    };
+}
+
+//triangles and simplified hold 9 floats per triangle. tolerance is how far, in
+//mesh units, the surface may move, 0 only merges flat regions
+inline void simplifyMesh(const std::vector<float> &triangles, float tolerance, std::vector<float> &simplified)
+{
+    simplify::Decimator decimator(triangles);
+    decimator.run(tolerance);
+    decimator.output(simplified);
+}
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef TASKGRAPH_H
+#define TASKGRAPH_H
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+//A graph of startup work. CPU tasks run on a pool of worker threads, GL tasks
+//are handed back to whichever thread calls run() since that one owns the context.
+//A task only starts once everything it depends on has finished, and if a task
+//fails everything after it is skipped.
+class TaskGraph
+{
+public:
+    enum Lane
+    {
+        CPU,//any worker thread
+        GL//the thread that called run()
+    };
+
+    explicit TaskGraph(unsigned int workers)
+    {
+        numWorkers = workers > 0 ? workers : 1;
+        remaining = 0;
+        failed = false;
+    }
+
+    //work returns false to fail the graph
+    int add(Lane lane, std::function<bool()> work)
+    {
+        Task task;
+        task.lane = lane;
+        task.work = work;
+        task.pending = 0;
+        task.skip = false;
+        tasks.push_back(task);
+        return tasks.size() - 1;
+    }
+
+    //task will not start until on has finished
+    void depend(int task, int on)
+    {
+        tasks[on].successors.push_back(task);
+        tasks[task].pending++;
+    }
+
+    //runs everything, blocking until the graph is done
+    bool run()
+    {
+        remaining = tasks.size();
+        for(unsigned int i = 0; i < tasks.size(); i++) {
+            if(tasks[i].pending == 0)
+                queue(i);
+        }
+
+        std::vector<std::thread> pool;
+        for(unsigned int i = 0; i < numWorkers; i++)
+            pool.push_back(std::thread(&TaskGraph::worker, this));
+
+        //this thread drains the GL lane until nothing is left
+        std::unique_lock<std::mutex> lock(mutex);
+        while(remaining > 0) {
+            if(glQueue.empty()) {
+                glReady.wait(lock);
+                continue;
+            }
+            int task = glQueue.front();
+            glQueue.pop_front();
+            lock.unlock();
+            execute(task);
+            lock.lock();
+        }
+        lock.unlock();
+        cpuReady.notify_all();
+
+        for(unsigned int i = 0; i < pool.size(); i++)
+            pool[i].join();
+        return !failed;
+    }
+
+    unsigned int workers() const
+    {
+        return numWorkers;
+    }
+
+private:
+    struct Task
+    {
+        Lane lane;
+        std::function<bool()> work;
+        int pending;//dependencies still running
+        bool skip;//something before this failed
+        std::vector<int> successors;
+    };
+
+    std::vector<Task> tasks;
+    std::deque<int> cpuQueue;
+    std::deque<int> glQueue;
+    std::mutex mutex;
+    std::condition_variable cpuReady;
+    std::condition_variable glReady;
+    unsigned int numWorkers;
+    unsigned int remaining;
+    bool failed;
+
+    //call with the lock held, or before the workers start
+    void queue(int task)
+    {
+        if(tasks[task].lane == GL) {
+            glQueue.push_back(task);
+            glReady.notify_one();
+        }
+        else {
+            cpuQueue.push_back(task);
+            cpuReady.notify_one();
+        }
+    }
+
+    void worker()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while(remaining > 0) {
+            if(cpuQueue.empty()) {
+                cpuReady.wait(lock);
+                continue;
+            }
+            int task = cpuQueue.front();
+            cpuQueue.pop_front();
+            lock.unlock();
+            execute(task);
+            lock.lock();
+        }
+    }
+
+    void execute(int task)
+    {
+        bool success = tasks[task].skip || tasks[task].work();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!success) {
+            failed = true;
+        }
+        for(unsigned int i = 0; i < tasks[task].successors.size(); i++) {
+            Task &next = tasks[tasks[task].successors[i]];
+            next.skip = next.skip || tasks[task].skip || !success;
+            if(--next.pending == 0)
+                queue(tasks[task].successors[i]);
+        }
+        if(--remaining == 0) {
+            cpuReady.notify_all();
+            glReady.notify_all();
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,345 @@
+//texcook: bakes images into mipmapped, block compressed .dds files
+//  texcook image [image...]
+//writes "<image>.dds" next to each one, the game loads that instead when it is there
+//and was cooked from the image as it is now, images already cooked that way are skipped
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+
+#include "IL/il.h"
+
+#include "dds.h"
+
+using namespace std;
+
+
+//--Data types
+//one RGBA mip level
+struct Image
+{
+    unsigned int width;
+    unsigned int height;
+    std::vector<unsigned char> pixels;
+};
+
+//--Function Prototypes
+bool cook(const char* input, const char* output);
+Image downsample(const Image &image);
+void compressLevel(const Image &image, bool alpha, std::vector<unsigned char> &out);
+void encodeColorBlock(const unsigned char texels[16][4], unsigned char out[8]);
+void encodeAlphaBlock(const unsigned char texels[16][4], unsigned char out[8]);
+unsigned short packColor(const float color[3]);
+void unpackColor(unsigned short packed, float color[3]);
+
+//sRGB-ish texels are averaged in linear light so mips don't darken
+float toLinear[256];
+
+
+//--Main
+int main(int argc, char **argv) {
+    if(argc < 2) {
+        cout << "Usage: texcook image [image...]" << endl;
+        return 1;
+    }
+    for(int i = 0; i < 256; i++)
+        toLinear[i] = pow(i / 255.0f, 2.2f);
+
+    ilInit();
+    int failed = 0;
+    for(int i = 1; i < argc; i++) {
+        std::string output = std::string(argv[i]) + ".dds";
+        if(!cook(argv[i], output.c_str()))
+            failed++;
+    }
+    return failed > 0 ? 1 : 0;
+}
+
+//--Implementations
+bool cook(const char* input, const char* output) {
+    unsigned long long sourceHash;
+    if(!ddsHashFile(input, sourceHash)) {
+        cout << "Error: Unable to load texture " << input << endl;
+        return false;
+    }
+    DDSImage existing;
+    if(readDDS(output, existing) && existing.sourceHash == sourceHash) {
+        cout << input << ": up to date" << endl;
+        return true;
+    }
+
+    //decode with the same DevIL defaults the game uses so rows end up the same way round
+    ILuint handle;
+    ilGenImages(1, &handle);
+    ilBindImage(handle);
+    if(!ilLoadImage((const ILstring)input)) {
+        cout << "Error: Unable to load texture " << input << endl;
+        ilDeleteImages(1, &handle);
+        return false;
+    }
+    if(!ilConvertImage(IL_RGBA, IL_UNSIGNED_BYTE)) {
+        cout << "Error: Unable to convert image " << input << endl;
+        ilDeleteImages(1, &handle);
+        return false;
+    }
+    Image image;
+    image.width = ilGetInteger(IL_IMAGE_WIDTH);
+    image.height = ilGetInteger(IL_IMAGE_HEIGHT);
+    ILubyte* data = ilGetData();
+    image.pixels.assign(data, data + image.width * image.height * 4);
+    ilDeleteImages(1, &handle);
+
+    //only pay for BC3 when something is actually see-through
+    bool alpha = false;
+    for(size_t i = 3; i < image.pixels.size() && !alpha; i += 4)
+        alpha = image.pixels[i] != 255;
+    unsigned int fourCC = alpha ? DDS_FOURCC_DXT5 : DDS_FOURCC_DXT1;
+
+    //full chain down to 1x1
+    unsigned int width = image.width;
+    unsigned int height = image.height;
+    std::vector<unsigned char> blocks;
+    unsigned int levels = 1;
+    compressLevel(image, alpha, blocks);
+    while(image.width > 1 || image.height > 1) {
+        image = downsample(image);
+        compressLevel(image, alpha, blocks);
+        levels++;
+    }
+
+    DDSHeader header;
+    memset(&header, 0, sizeof(header));
+    header.size = sizeof(DDSHeader);
+    header.flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE;
+    header.width = width;
+    header.height = height;
+    header.linearSize = ddsLevelSize(header.width, header.height, fourCC);
+    header.mipMapCount = levels;
+    header.format.size = sizeof(DDSPixelFormat);
+    header.format.flags = DDPF_FOURCC;
+    header.format.fourCC = fourCC;
+    header.caps = DDSCAPS_COMPLEX | DDSCAPS_TEXTURE | DDSCAPS_MIPMAP;
+    //the loaders check this against the image so an edited one isn't shadowed by a stale cook
+    header.reserved1[0] = DDS_SOURCE_TAG;
+    header.reserved1[1] = (unsigned int)sourceHash;
+    header.reserved1[2] = (unsigned int)(sourceHash >> 32);
+
+    //rename so a half written file is never picked up
+    std::string tempPath = std::string(output) + ".tmp";
+    std::ofstream file(tempPath.c_str(), std::ios::binary);
+    file.write((const char*)&DDS_MAGIC, sizeof(DDS_MAGIC));
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)&blocks[0], blocks.size());
+    file.close();
+    if(!file || rename(tempPath.c_str(), output) != 0) {
+        cout << "Error: Unable to write " << output << endl;
+        remove(tempPath.c_str());
+        return false;
+    }
+
+    cout << input << ": " << header.width << "x" << header.height << ", " << levels << " levels, "
+         << (alpha ? "DXT5" : "DXT1") << ", " << header.width * header.height * (alpha ? 4 : 3)
+         << " bytes -> " << blocks.size() << " bytes" << endl;
+    return true;
+}
+
+//halves an image with a 2x2 box filter, odd edges reuse their last row or column
+Image downsample(const Image &image) {
+    Image half;
+    half.width = image.width > 1 ? image.width / 2 : 1;
+    half.height = image.height > 1 ? image.height / 2 : 1;
+    half.pixels.resize(half.width * half.height * 4);
+
+    for(unsigned int y = 0; y < half.height; y++) {
+        unsigned int y0 = 2 * y < image.height ? 2 * y : image.height - 1;
+        unsigned int y1 = y0 + 1 < image.height ? y0 + 1 : y0;
+        for(unsigned int x = 0; x < half.width; x++) {
+            unsigned int x0 = 2 * x < image.width ? 2 * x : image.width - 1;
+            unsigned int x1 = x0 + 1 < image.width ? x0 + 1 : x0;
+            const unsigned char* texels[4] = {&image.pixels[4 * (y0 * image.width + x0)],
+                                              &image.pixels[4 * (y0 * image.width + x1)],
+                                              &image.pixels[4 * (y1 * image.width + x0)],
+                                              &image.pixels[4 * (y1 * image.width + x1)]};
+            unsigned char* out = &half.pixels[4 * (y * half.width + x)];
+            for(int c = 0; c < 3; c++) {
+                float sum = 0.0;
+                for(int i = 0; i < 4; i++)
+                    sum += toLinear[texels[i][c]];
+                out[c] = (unsigned char)(pow(sum / 4.0f, 1.0f / 2.2f) * 255.0f + 0.5f);
+            }
+            out[3] = (texels[0][3] + texels[1][3] + texels[2][3] + texels[3][3] + 2) / 4;
+        }
+    }
+    return half;
+}
+
+//appends one level's blocks, left to right then top to bottom
+void compressLevel(const Image &image, bool alpha, std::vector<unsigned char> &out) {
+    unsigned char texels[16][4];
+    unsigned char block[16];
+    for(unsigned int by = 0; by < image.height; by += 4) {
+        for(unsigned int bx = 0; bx < image.width; bx += 4) {
+            //partial blocks at the edges repeat the last texel
+            for(unsigned int i = 0; i < 16; i++) {
+                unsigned int x = bx + i % 4 < image.width ? bx + i % 4 : image.width - 1;
+                unsigned int y = by + i / 4 < image.height ? by + i / 4 : image.height - 1;
+                memcpy(texels[i], &image.pixels[4 * (y * image.width + x)], 4);
+            }
+            if(alpha) {
+                encodeAlphaBlock(texels, block);
+                encodeColorBlock(texels, block + 8);
+                out.insert(out.end(), block, block + 16);
+            }
+            else {
+                encodeColorBlock(texels, block);
+                out.insert(out.end(), block, block + 8);
+            }
+        }
+    }
+}
+
+//BC1 color block, endpoints on the block's principal axis and 2 bit indices to the nearest of the 4 colors
+void encodeColorBlock(const unsigned char texels[16][4], unsigned char out[8]) {
+    float mean[3] = {0.0, 0.0, 0.0};
+    for(int i = 0; i < 16; i++)
+        for(int c = 0; c < 3; c++)
+            mean[c] += texels[i][c] / 16.0f;
+
+    float covariance[6] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};//rr rg rb gg gb bb
+    for(int i = 0; i < 16; i++) {
+        float r = texels[i][0] - mean[0];
+        float g = texels[i][1] - mean[1];
+        float b = texels[i][2] - mean[2];
+        covariance[0] += r*r; covariance[1] += r*g; covariance[2] += r*b;
+        covariance[3] += g*g; covariance[4] += g*b; covariance[5] += b*b;
+    }
+
+    //a few rounds of power iteration is plenty for a 3x3
+    float axis[3] = {1.0, 1.0, 1.0};
+    for(int k = 0; k < 8; k++) {
+        float x = covariance[0]*axis[0] + covariance[1]*axis[1] + covariance[2]*axis[2];
+        float y = covariance[1]*axis[0] + covariance[3]*axis[1] + covariance[4]*axis[2];
+        float z = covariance[2]*axis[0] + covariance[4]*axis[1] + covariance[5]*axis[2];
+        float length = sqrt(x*x + y*y + z*z);
+        if(length < 1e-6f)
+            break;//flat block, any axis will do
+        axis[0] = x / length;
+        axis[1] = y / length;
+        axis[2] = z / length;
+    }
+
+    float low = 1e9, high = -1e9;
+    for(int i = 0; i < 16; i++) {
+        float t = (texels[i][0] - mean[0]) * axis[0] + (texels[i][1] - mean[1]) * axis[1] +
+                  (texels[i][2] - mean[2]) * axis[2];
+        if(t < low) low = t;
+        if(t > high) high = t;
+    }
+    //pull the ends in a little, the outliers rarely deserve a whole endpoint
+    float inset = (high - low) / 16.0f;
+    low += inset;
+    high -= inset;
+
+    float end0[3], end1[3];
+    for(int c = 0; c < 3; c++) {
+        end0[c] = mean[c] + axis[c] * high;
+        end1[c] = mean[c] + axis[c] * low;
+    }
+    unsigned short color0 = packColor(end0);
+    unsigned short color1 = packColor(end1);
+    //color0 > color1 selects the 4 color mode
+    if(color0 < color1) {
+        unsigned short swap = color0;
+        color0 = color1;
+        color1 = swap;
+    }
+
+    float palette[4][3];
+    unpackColor(color0, palette[0]);
+    unpackColor(color1, palette[1]);
+    for(int c = 0; c < 3; c++) {
+        palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+        palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+    }
+
+    unsigned int indices = 0;
+    for(int i = 0; i < 16 && color0 != color1; i++) {
+        int best = 0;
+        float bestDistance = 1e9;
+        for(int p = 0; p < 4; p++) {
+            float dr = texels[i][0] - palette[p][0];
+            float dg = texels[i][1] - palette[p][1];
+            float db = texels[i][2] - palette[p][2];
+            float distance = dr*dr + dg*dg + db*db;
+            if(distance < bestDistance) {
+                bestDistance = distance;
+                best = p;
+            }
+        }
+        indices |= best << (2 * i);
+    }
+
+    //little endian throughout
+    out[0] = color0 & 0xff;
+    out[1] = color0 >> 8;
+    out[2] = color1 & 0xff;
+    out[3] = color1 >> 8;
+    for(int i = 0; i < 4; i++)
+        out[4 + i] = (indices >> (8 * i)) & 0xff;
+}
+
+//BC3 alpha block, the block's alpha range split 8 ways with 3 bit indices
+void encodeAlphaBlock(const unsigned char texels[16][4], unsigned char out[8]) {
+    int alpha0 = 0, alpha1 = 255;
+    for(int i = 0; i < 16; i++) {
+        if(texels[i][3] > alpha0) alpha0 = texels[i][3];
+        if(texels[i][3] < alpha1) alpha1 = texels[i][3];
+    }
+
+    //alpha0 > alpha1 selects the 8 value mode
+    int palette[8];
+    palette[0] = alpha0;
+    palette[1] = alpha1;
+    for(int p = 1; p < 7; p++)
+        palette[p + 1] = ((7 - p) * alpha0 + p * alpha1) / 7;
+
+    unsigned long long indices = 0;
+    for(int i = 0; i < 16 && alpha0 != alpha1; i++) {
+        int best = 0;
+        for(int p = 1; p < 8; p++) {
+            if(abs(texels[i][3] - palette[p]) < abs(texels[i][3] - palette[best]))
+                best = p;
+        }
+        indices |= (unsigned long long)best << (3 * i);
+    }
+
+    out[0] = alpha0;
+    out[1] = alpha1;
+    for(int i = 0; i < 6; i++)
+        out[2 + i] = (indices >> (8 * i)) & 0xff;
+}
+
+//RGB565 with rounding, clamped to the byte range
+unsigned short packColor(const float color[3]) {
+    int bits[3] = {5, 6, 5};
+    unsigned short packed = 0;
+    for(int c = 0; c < 3; c++) {
+        float value = color[c] < 0.0f ? 0.0f : (color[c] > 255.0f ? 255.0f : color[c]);
+        int max = (1 << bits[c]) - 1;
+        packed = (packed << bits[c]) | (int)(value / 255.0f * max + 0.5f);
+    }
+    return packed;
+}
+
+//back to 8 bits per channel the way the GPU expands it
+void unpackColor(unsigned short packed, float color[3]) {
+    int r = (packed >> 11) & 31;
+    int g = (packed >> 5) & 63;
+    int b = packed & 31;
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+}